@@ -28,7 +28,12 @@ import java.io.IOException;
 import java.io.ObjectOutputStream;
 import java.lang.management.ManagementFactory;
 import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.HashMap;
 import java.util.List;
+import java.util.Map;
+import java.util.regex.Matcher;
+import java.util.regex.Pattern;
 
 /**
  * Implementation of the mbean, controls the underlying native profiler
@@ -72,6 +77,18 @@ public class JCozProfiler implements JCozProfilerMBean {
      */
     private List<Experiment> cachedOutput = new ArrayList<>();
 
+    /**
+     * is the agent meant to profile indefinitely whether or not anyone
+     * fetches results, i.e. duty cycled or publishing to a result ring
+     */
+    private boolean alwaysOn = false;
+
+    /**
+     * experiments kept for fetching when always on; the agent's profile
+     * file has all of them
+     */
+    private static final int MAX_CACHED_EXPERIMENTS = 10000;
+
     /**
      * start profiling with the current scope and progress point
      */
@@ -87,11 +104,21 @@ public class JCozProfiler implements JCozProfilerMBean {
         }
         experimentRunning = true;
         lastCollectionMillis = System.currentTimeMillis();
-        return startProfilingNative();
+        alwaysOn = getDutyCycleNative() < 100 || hasResultRingNative();
+        int returnCode = startProfilingNative();
+        if (returnCode != JCozProfilingErrorCodes.NORMAL_RETURN) {
+            // e.g. the agent is already profiling headless
+            experimentRunning = false;
+        }
+        return returnCode;
     }
 
     private native int startProfilingNative();
 
+    private native int getDutyCycleNative();
+
+    private native boolean hasResultRingNative();
+
     /**
      * end the current profiling
      */
@@ -161,12 +188,20 @@ public class JCozProfiler implements JCozProfilerMBean {
      * @param speedup
      * @param duration
      * @param pointsHit
+     * @param samplePeriod
+     * @param gcPause
+     * @param windowStart
      */
     private synchronized void cacheOutput(String classSig, int lineNo,
-            float speedup, long duration, long pointsHit) {
+            float speedup, long duration, long pointsHit, long samplePeriod,
+            long gcPause, long windowStart) {
         cachedOutput.add(new Experiment(classSig, lineNo, speedup, duration,
-                    pointsHit));
-        if (System.currentTimeMillis() - lastCollectionMillis > INACTIVITY_THRESHOLD) {
+                    pointsHit, samplePeriod, gcPause, windowStart));
+        if (alwaysOn) {
+            if (cachedOutput.size() > MAX_CACHED_EXPERIMENTS) {
+                cachedOutput.subList(0, cachedOutput.size() - MAX_CACHED_EXPERIMENTS).clear();
+            }
+        } else if (System.currentTimeMillis() - lastCollectionMillis > INACTIVITY_THRESHOLD) {
             new Thread(() -> endProfiling()).start();
         }
     }
@@ -201,6 +236,140 @@ public class JCozProfiler implements JCozProfilerMBean {
         return progressPointClass + ":" + progressPointLineNo;
     }
 
+    /**
+     * queue an experiment to run at a fixed wall-clock time
+     */
+    public synchronized int scheduleExperiment(String classSig, int lineNo,
+            float speedup, long startMillis, long durationMillis) {
+        if (!experimentRunning) {
+            return JCozProfilingErrorCodes.PROFILER_NOT_RUNNING;
+        }
+        lastCollectionMillis = System.currentTimeMillis();
+        return scheduleExperimentNative(classSig, lineNo, speedup, startMillis, durationMillis);
+    }
+
+    private native int scheduleExperimentNative(String classSig, int lineNo,
+            float speedup, long startMillis, long durationMillis);
+
+    /**
+     * go back to choosing experiment lines locally
+     */
+    public synchronized int clearExperimentSchedule() {
+        if (!experimentRunning) {
+            return JCozProfilingErrorCodes.PROFILER_NOT_RUNNING;
+        }
+        return clearExperimentScheduleNative();
+    }
+
+    private native int clearExperimentScheduleNative();
+
+    /*
+     * layout of the array returned by getOverheadStatsNative, must match
+     * the kStats* constants in src/native/stats.h
+     */
+    private static final int NUM_CALL_TRACE_SLOTS = 13;
+    private static final int NUM_HISTOGRAM_BUCKETS = 32;
+    private static final int HISTOGRAM_LENGTH = NUM_HISTOGRAM_BUCKETS + 2;
+    private static final int STATS_SAMPLES = 0;
+    private static final int STATS_SAMPLES_DROPPED = 1;
+    private static final int STATS_SPIN_WAIT_NANOS = 2;
+    private static final int STATS_CALL_TRACE_RESULTS = 3;
+    private static final int STATS_HANDLER_LATENCY = STATS_CALL_TRACE_RESULTS + NUM_CALL_TRACE_SLOTS;
+    private static final int STATS_DELAY_OVERSHOOT = STATS_HANDLER_LATENCY + HISTOGRAM_LENGTH;
+    private static final int STATS_AGENT_CYCLE = STATS_DELAY_OVERSHOOT + HISTOGRAM_LENGTH;
+
+    private native long[] getOverheadStatsNative();
+
+    public long getSamplesTaken() {
+        return getOverheadStatsNative()[STATS_SAMPLES];
+    }
+
+    public long getSamplesDropped() {
+        return getOverheadStatsNative()[STATS_SAMPLES_DROPPED];
+    }
+
+    public long getSpinLockWaitNanos() {
+        return getOverheadStatsNative()[STATS_SPIN_WAIT_NANOS];
+    }
+
+    public long[] getCallTraceResultCounts() {
+        return Arrays.copyOfRange(getOverheadStatsNative(),
+                STATS_CALL_TRACE_RESULTS, STATS_CALL_TRACE_RESULTS + NUM_CALL_TRACE_SLOTS);
+    }
+
+    public long[] getHandlerLatencyHistogram() {
+        return histogramBuckets(STATS_HANDLER_LATENCY);
+    }
+
+    public long getHandlerLatencyTotalNanos() {
+        return histogramTotal(STATS_HANDLER_LATENCY);
+    }
+
+    public long[] getDelayOvershootHistogram() {
+        return histogramBuckets(STATS_DELAY_OVERSHOOT);
+    }
+
+    public long getDelayOvershootTotalNanos() {
+        return histogramTotal(STATS_DELAY_OVERSHOOT);
+    }
+
+    public long[] getAgentCycleHistogram() {
+        return histogramBuckets(STATS_AGENT_CYCLE);
+    }
+
+    public long getAgentCycleTotalNanos() {
+        return histogramTotal(STATS_AGENT_CYCLE);
+    }
+
+    private native int getProfiledThreadCountNative();
+
+    public int getProfiledThreadCount() {
+        return getProfiledThreadCountNative();
+    }
+
+    /**
+     * "name" #id ... nid=0x1f2e (or nid=7982), the header of each thread
+     * in a HotSpot thread dump
+     */
+    private static final Pattern THREAD_DUMP_HEADER =
+        Pattern.compile("^\".*\" #(\\d+)\\b.*\\bnid=(0x[0-9a-fA-F]+|\\d+)");
+
+    /**
+     * kernel thread ids of the threads with the given Thread.getId()s, 0
+     * where one is not found. Called by the agent when it is loaded into
+     * a running JVM, since JVMTI gives no way to aim a signal at a thread
+     * that already exists; the ids come from the VM's own thread dump.
+     */
+    public static int[] nativeThreadIds(long[] threadIds) throws JMException {
+        String dump = (String) ManagementFactory.getPlatformMBeanServer().invoke(
+                new ObjectName("com.sun.management:type=DiagnosticCommand"), "threadPrint",
+                new Object[] {new String[0]}, new String[] {String[].class.getName()});
+        Map<Long, Integer> nids = new HashMap<>();
+        for (String line : dump.split("\n")) {
+            Matcher header = THREAD_DUMP_HEADER.matcher(line);
+            if (header.find()) {
+                String nid = header.group(2);
+                nids.put(Long.parseLong(header.group(1)), nid.startsWith("0x")
+                        ? Integer.parseInt(nid.substring(2), 16) : Integer.parseInt(nid));
+            }
+        }
+        int[] result = new int[threadIds.length];
+        for (int i = 0; i < threadIds.length; i++) {
+            Integer nid = nids.get(threadIds[i]);
+            result[i] = nid == null ? 0 : nid;
+        }
+        return result;
+    }
+
+    private long[] histogramBuckets(int offset) {
+        return Arrays.copyOfRange(getOverheadStatsNative(), offset, offset + NUM_HISTOGRAM_BUCKETS);
+    }
+
+    private long histogramTotal(int offset) {
+        // buckets are followed by the count, then the sum
+        return getOverheadStatsNative()[offset + NUM_HISTOGRAM_BUCKETS + 1];
+    }
+
     /**
      * register the profiler with the Platform mbean server
      */
@@ -37,4 +37,56 @@ public interface JCozProfilerMBean {
     public String getCurrentScope();
 
     public String getProgressPoint();
+
+    /**
+     * Queue an experiment on the given line to run from startMillis
+     * (wall clock) for durationMillis, so that several profiled JVMs can
+     * run it together. classSig is in the form experiments report it.
+     * From the first call until clearExperimentSchedule the profiler
+     * runs only scheduled experiments.
+     */
+    public int scheduleExperiment(String classSig, int lineNo, float speedup,
+            long startMillis, long durationMillis);
+
+    /**
+     * drop any queued experiments and go back to choosing lines locally
+     */
+    public int clearExperimentSchedule();
+
+    /*
+     * Profiler self-overhead, summed over every thread since the agent
+     * was loaded.  Histograms are arrays of power-of-two buckets: element
+     * i counts values in [2^i, 2^(i+1)) nanoseconds.
+     */
+
+    public long getSamplesTaken();
+
+    public long getSamplesDropped();
+
+    public long getSpinLockWaitNanos();
+
+    /**
+     * Element i counts AsyncGetCallTrace results of -i (0 being a
+     * native-only stack), followed by unknown error codes and then
+     * successful stack walks.
+     */
+    public long[] getCallTraceResultCounts();
+
+    public long[] getHandlerLatencyHistogram();
+
+    public long getHandlerLatencyTotalNanos();
+
+    public long[] getDelayOvershootHistogram();
+
+    public long getDelayOvershootTotalNanos();
+
+    public long[] getAgentCycleHistogram();
+
+    public long getAgentCycleTotalNanos();
+
+    /**
+     * number of live threads the profiler samples, whether they were
+     * running when the agent was attached or started later
+     */
+    public int getProfiledThreadCount();
 }
@@ -0,0 +1,114 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package jcoz.client.cli;
+
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.io.ObjectInputStream;
+import java.rmi.RemoteException;
+import java.util.ArrayList;
+import java.util.List;
+
+import jcoz.agent.JCozProfilingErrorCodes;
+import jcoz.profile.Experiment;
+import jcoz.service.JCozException;
+import jcoz.service.JCozExceptionFactory;
+import jcoz.service.JCozServiceInterface;
+
+/**
+ * Profiles several replicas of the same application as one: the scope
+ * and progress point are set on every replica, and the service runs the
+ * same experiments on all of them and pools the results.
+ */
+public class CoordinatedProcessWrapper implements TargetProcessInterface {
+
+    JCozServiceInterface service;
+    int[] remotePids;
+    List<RemoteProcessWrapper> replicas = new ArrayList<>();
+
+    public CoordinatedProcessWrapper(JCozServiceInterface service, int[] pids) throws JCozException{
+        this.service = service;
+        this.remotePids = pids;
+        for (int pid : pids) {
+            replicas.add(new RemoteProcessWrapper(service, pid));
+        }
+    }
+
+    public void startProfiling() throws JCozException{
+        int returnCode;
+        try {
+            returnCode = service.startCoordinatedProfiling(remotePids);
+        } catch (RemoteException e) {
+            throw new JCozException(e);
+        }
+        if(returnCode != JCozProfilingErrorCodes.NORMAL_RETURN){
+            throw JCozExceptionFactory.getInstance().getJCozExceptionFromErrorCode(returnCode);
+        }
+    }
+
+    public void endProfiling() throws JCozException{
+        int returnCode;
+        try {
+            returnCode = service.endCoordinatedProfiling();
+        } catch (RemoteException e) {
+            throw new JCozException(e);
+        }
+        if(returnCode != JCozProfilingErrorCodes.NORMAL_RETURN){
+            throw JCozExceptionFactory.getInstance().getJCozExceptionFromErrorCode(returnCode);
+        }
+    }
+
+    public void setProgressPoint(String className, int lineNo) throws JCozException{
+        for (RemoteProcessWrapper replica : replicas) {
+            replica.setProgressPoint(className, lineNo);
+        }
+    }
+
+    public void setScope(String scope) throws JCozException{
+        for (RemoteProcessWrapper replica : replicas) {
+            replica.setScope(scope);
+        }
+    }
+
+    public List<Experiment> getProfilerOutput() throws JCozException{
+        List<Experiment> experiments = new ArrayList<>();
+        try {
+            byte[] profOutput = service.getCoordinatedProfilerOutput();
+            if (profOutput == null || profOutput.length == 0){
+                return experiments;
+            }
+            ObjectInputStream ois = new ObjectInputStream(new ByteArrayInputStream(profOutput));
+            int numExperiments = ois.readInt();
+            for (int j = 0; j < numExperiments; j++){
+                experiments.add(Experiment.deserialize(ois));
+            }
+        } catch (IOException e) {
+            throw new JCozException(e);
+        }
+
+        return experiments;
+    }
+
+    public String getCurrentScope() throws JCozException{
+        return replicas.get(0).getCurrentScope();
+    }
+
+    public String getProgressPoint() throws JCozException{
+        return replicas.get(0).getProgressPoint();
+    }
+
+}
@@ -53,7 +53,8 @@ public class JCozCLI {
         ppLineNoOption.setRequired(true);
         ops.addOption(ppLineNoOption);
 
-        Option pidOption = new Option("p", "pid", true, "ProcessID to jcoz.profile");
+        Option pidOption = new Option("p", "pid", true,
+                "ProcessID to jcoz.profile; with --host, a comma-separated list profiles replicas together");
         pidOption.setRequired(true);
         ops.addOption(pidOption);
 
@@ -71,6 +72,7 @@ public class JCozCLI {
         String scopePkg = cl.getOptionValue('s');
         int ppLineNo = -1;
         int pid = -1;
+        int[] pids = null;
         try {
             ppLineNo = Integer.parseInt(cl.getOptionValue('l'));
         } catch (NumberFormatException e) {
@@ -78,9 +80,14 @@ public class JCozCLI {
             System.exit(-1);
         }
         try {
-            pid = Integer.parseInt(cl.getOptionValue('p'));
+            String[] pidValues = cl.getOptionValue('p').split(",");
+            pids = new int[pidValues.length];
+            for (int i = 0; i < pidValues.length; i++) {
+                pids[i] = Integer.parseInt(pidValues[i].trim());
+            }
+            pid = pids[0];
         } catch (NumberFormatException e) {
-            logger.error("Invalid pid: {}", cl.getOptionValue('l'));
+            logger.error("Invalid pid: {}", cl.getOptionValue('p'));
             System.exit(-1);
         }
 
@@ -91,7 +98,9 @@ public class JCozCLI {
             try {
                 Profile profile = new Profile(remoteHost);
                 final RemoteServiceWrapper remoteService = new RemoteServiceWrapper(remoteHost);
-                TargetProcessInterface profiledClient = remoteService.attachToProcess(pid);
+                TargetProcessInterface profiledClient = pids.length > 1
+                    ? remoteService.attachToProcesses(pids)
+                    : remoteService.attachToProcess(pid);
                 profiledClient.setProgressPoint(ppClass, ppLineNo);
                 profiledClient.setScope(scopePkg);
                 profiledClient.startProfiling();
@@ -109,6 +118,10 @@ public class JCozCLI {
                 logger.error("Unable to connect to target process, stacktrace: {}", stringWriter);
             }
         } else {
+            if (pids.length > 1) {
+                logger.error("Profiling several processes together needs --host");
+                System.exit(-1);
+            }
             logger.info("Connecting to localhost");
             VirtualMachineDescriptor descriptor = null;
             for (VirtualMachineDescriptor vmDesc : VirtualMachine.list()) {
@@ -76,6 +76,14 @@ public class RemoteServiceWrapper {
         return new RemoteProcessWrapper(service, remotePid);
     }
 
+    /**
+     * attach to several replicas of one application and profile them
+     * together, with the same experiments run on all of them at once
+     */
+    public TargetProcessInterface attachToProcesses(int[] remotePids) throws JCozException{
+        return new CoordinatedProcessWrapper(service, remotePids);
+    }
+
     public String getHost() {
         return this.host;
     }
@@ -31,6 +31,11 @@ import java.io.ObjectOutputStream;
  */
 public class Experiment implements Comparable<Experiment> {
 
+    /**
+     * share of an experiment's duration above which GC pauses dominate it
+     */
+    public static final double GC_DOMINATED_SHARE = 0.5;
+
     /**
      * public constructor, pass all data for experiment
      *
@@ -39,41 +44,106 @@ public class Experiment implements Comparable<Experiment> {
      * @param speedup   selected experiment speedup
      * @param duration  length of experiment - pause time
      * @param pointsHit number of time the progress point was hit in the experiment
+     * @param samplePeriod sampling period the experiment ran at, in nanoseconds
+     * @param gcPause   time spent in GC pauses during the experiment, in nanoseconds
+     * @param windowStart wall-clock start, in milliseconds, of the window a
+     *                  scheduled experiment ran in, 0 if the agent chose it
      */
     public Experiment(String classSig,
             int lineNo,
             float speedup,
             long duration,
-            long pointsHit) {
+            long pointsHit,
+            long samplePeriod,
+            long gcPause,
+            long windowStart) {
         this.classSig = classSig;
         this.lineNo = lineNo;
         this.speedup = speedup;
         this.duration = duration;
         this.pointsHit = pointsHit;
+        this.samplePeriod = samplePeriod;
+        this.gcPause = gcPause;
+        this.windowStart = windowStart;
+    }
+
+    /**
+     * an experiment the agent chose itself
+     */
+    public Experiment(String classSig,
+            int lineNo,
+            float speedup,
+            long duration,
+            long pointsHit,
+            long samplePeriod,
+            long gcPause) {
+        this(classSig, lineNo, speedup, duration, pointsHit, samplePeriod, gcPause, 0);
+    }
+
+    /**
+     * an experiment whose GC pauses are not known
+     */
+    public Experiment(String classSig,
+            int lineNo,
+            float speedup,
+            long duration,
+            long pointsHit,
+            long samplePeriod) {
+        this(classSig, lineNo, speedup, duration, pointsHit, samplePeriod, 0);
+    }
+
+    /**
+     * an experiment whose sampling period is not known
+     */
+    public Experiment(String classSig,
+            int lineNo,
+            float speedup,
+            long duration,
+            long pointsHit) {
+        this(classSig, lineNo, speedup, duration, pointsHit, 0);
     }
 
     /**
      * Create an experiment object from a coz string in the form
-     * returned by Experiment.toString().
+     * returned by Experiment.toString(). Fields after duration were
+     * added over time, so older profiles may lack them.
      *
      * @param exp
      */
     public Experiment(String exp) {
-        int selectedIndex = exp.indexOf("selected=");
-        int lineNoIndex = exp.indexOf(':', selectedIndex);
-        int speedupIndex = exp.indexOf("\tspeedup=");
-        int durationIndex = exp.indexOf("\tduration=");
         int firstLineEndIndex = exp.indexOf('\n');
+        for (String field : exp.substring(0, firstLineEndIndex).split("\t")) {
+            int equalsIndex = field.indexOf('=');
+            if (equalsIndex < 0) {
+                continue;
+            }
+            String key = field.substring(0, equalsIndex);
+            String value = field.substring(equalsIndex + 1);
+            switch (key) {
+                case "selected":
+                    int lineNoIndex = value.indexOf(':');
+                    this.classSig = value.substring(0, lineNoIndex);
+                    this.lineNo = Integer.parseInt(value.substring(lineNoIndex + 1));
+                    break;
+                case "speedup":
+                    this.speedup = Float.parseFloat(value);
+                    break;
+                case "duration":
+                    this.duration = Long.parseLong(value);
+                    break;
+                case "period":
+                    this.samplePeriod = Long.parseLong(value);
+                    break;
+                case "gc-pause":
+                    this.gcPause = Long.parseLong(value);
+                    break;
+                default:
+                    break;
+            }
+        }
         int pointsHitIndex = exp.indexOf("\tdelta=");
-
-        this.classSig = exp.substring(selectedIndex + ("selected=").length(), lineNoIndex);
-        this.lineNo = Integer.parseInt(exp.substring(lineNoIndex + 1, speedupIndex));
-        this.speedup = Float.parseFloat(
-                exp.substring(speedupIndex + "\tspeedup=".length(), durationIndex));
-        this.duration = Long.parseLong(
-                exp.substring(durationIndex + "\tduration=".length(), firstLineEndIndex));
         this.pointsHit = Long.parseLong(
-                exp.substring(pointsHitIndex + "\tdelta=".length()));
+                exp.substring(pointsHitIndex + "\tdelta=".length()).trim());
     }
 
     /**
@@ -96,12 +166,28 @@ public class Experiment implements Comparable<Experiment> {
      * number of times the progress point was hit
      */
     private long pointsHit;
+    /**
+     * sampling period in nanoseconds, 0 if not known. Delays are a
+     * multiple of it, so experiments are only comparable at like periods.
+     */
+    private long samplePeriod;
+    /**
+     * nanoseconds of the experiment spent in GC pauses, 0 if not known.
+     * They are part of the duration.
+     */
+    private long gcPause;
+    /**
+     * wall-clock start in milliseconds of the scheduled window the
+     * experiment ran in, 0 if it was not scheduled. Not part of the coz
+     * format.
+     */
+    private long windowStart;
 
 
     /*
      * getters
      */
-    String getClassSig() {
+    public String getClassSig() {
         return classSig;
     }
 
@@ -109,18 +195,50 @@ public class Experiment implements Comparable<Experiment> {
         return lineNo;
     }
 
-    float getSpeedup() {
+    public float getSpeedup() {
         return speedup;
     }
 
-    long getDuration() {
+    public long getDuration() {
         return duration;
     }
 
-    long getPointsHit() {
+    public long getPointsHit() {
         return pointsHit;
     }
 
+    public long getSamplePeriod() {
+        return samplePeriod;
+    }
+
+    public long getGcPause() {
+        return gcPause;
+    }
+
+    public long getWindowStart() {
+        return windowStart;
+    }
+
+    public boolean isScheduled() {
+        return windowStart != 0;
+    }
+
+    /**
+     * duration less the time spent in GC pauses, which stop every thread
+     * whatever line is being sped up
+     */
+    public long getDurationWithoutGc() {
+        return duration - gcPause;
+    }
+
+    /**
+     * true if GC pauses took so much of the experiment that its result
+     * says more about the collector than about its line
+     */
+    public boolean isGcDominated() {
+        return gcPause > GC_DOMINATED_SHARE * duration;
+    }
+
     /**
      * serialize the object into an object output stream
      */
@@ -130,6 +248,9 @@ public class Experiment implements Comparable<Experiment> {
         oos.writeFloat(speedup);
         oos.writeLong(duration);
         oos.writeLong(pointsHit);
+        oos.writeLong(samplePeriod);
+        oos.writeLong(gcPause);
+        oos.writeLong(windowStart);
     }
 
     /**
@@ -149,6 +270,8 @@ public class Experiment implements Comparable<Experiment> {
             "\t" +
             "duration=" +
             duration +
+            (samplePeriod > 0 ? "\tperiod=" + samplePeriod : "") +
+            (gcPause > 0 ? "\tgc-pause=" + gcPause : "") +
             "\n" +
             "progress-point" +
             "\t" +
@@ -168,7 +291,8 @@ public class Experiment implements Comparable<Experiment> {
      * @throws IOException
      */
     public static Experiment deserialize(ObjectInputStream ois) throws IOException {
-        return new Experiment(ois.readUTF(), ois.readInt(), ois.readFloat(), ois.readLong(), ois.readLong());
+        return new Experiment(ois.readUTF(), ois.readInt(), ois.readFloat(), ois.readLong(), ois.readLong(),
+                ois.readLong(), ois.readLong(), ois.readLong());
     }
 
     @Override
@@ -71,7 +71,9 @@ public class LineSpeedup {
     }
 
     /**
-     * Update the speedup map to use the latest experiment data.
+     * Update the speedup map to use the latest experiment data. GC pauses
+     * are left out of the durations, and experiments dominated by them are
+     * dropped.
      *
      * @throws InsufficientBaselineResultsException
      */
@@ -88,7 +90,7 @@ public class LineSpeedup {
 
             for (Experiment exp : speedupExperiments) {
                 pointsHit += exp.getPointsHit();
-                totalDuration += exp.getDuration();
+                totalDuration += exp.getDurationWithoutGc();
             }
 
             // avoid divide-by-zero
@@ -111,8 +113,8 @@ public class LineSpeedup {
         double baselinePointsHit = 0;
 
         for (Experiment exp : this.experiments) {
-            if (exp.getSpeedup() == 0) {
-                baselineDuration += exp.getDuration();
+            if (exp.getSpeedup() == 0 && !exp.isGcDominated()) {
+                baselineDuration += exp.getDurationWithoutGc();
                 baselinePointsHit += exp.getPointsHit();
             }
         }
@@ -133,6 +135,9 @@ public class LineSpeedup {
     private Map<Float, List<Experiment>> groupExperimentsBySpeedups() {
         Map<Float, List<Experiment>> partitionedExperiments = new HashMap<>();
         for (Experiment exp : this.experiments) {
+            if (exp.isGcDominated()) {
+                continue;
+            }
             float speedup = exp.getSpeedup();
             if (!partitionedExperiments.containsKey(speedup)) {
                 partitionedExperiments.put(speedup, new ArrayList<>());
@@ -0,0 +1,353 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package jcoz.service;
+
+import jcoz.agent.JCozProfilerMBean;
+import jcoz.agent.JCozProfilingErrorCodes;
+import jcoz.profile.Experiment;
+
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.io.ObjectInputStream;
+import java.util.ArrayList;
+import java.util.Collection;
+import java.util.HashMap;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+import java.util.Random;
+
+import org.slf4j.Logger;
+import org.slf4j.LoggerFactory;
+
+/**
+ * Runs the same experiments on several replicas of a service at once and
+ * pools their results. A replica that gets 1/n of the load hits the
+ * progress point 1/n as often; running each experiment (line, speedup
+ * and time window) on all n and adding up the hits gives one experiment
+ * with the sample rate of the whole fleet.
+ *
+ * The lines come from the replicas: for a discovery period they pick
+ * experiments on their own as usual, and every line they pick becomes a
+ * candidate. Coordinated rounds then cycle through the candidates.
+ * Discovery is repeated every ROUNDS_PER_DISCOVERY rounds so that lines
+ * which get hot later are picked up. Experiments from discovery only
+ * nominate lines; they are never pooled.
+ *
+ * A round is pooled only once every replica has reported it, so every
+ * pooled experiment has the rate of the same n replicas. A round that
+ * some replica skipped or refused is dropped.
+ */
+public class ExperimentCoordinator implements Runnable {
+
+    private static final Logger logger = LoggerFactory.getLogger(ExperimentCoordinator.class);
+
+    /**
+     * length of each coordinated experiment
+     */
+    public static final long DEFAULT_WINDOW_MILLIS = 1000;
+
+    /**
+     * experiments are scheduled this far ahead so that every replica has
+     * them before the window opens
+     */
+    public static final long DEFAULT_LEAD_MILLIS = 500;
+
+    /**
+     * time replicas get to report an experiment after its window closes
+     */
+    private static final long REPORT_GRACE_MILLIS = 500;
+
+    /**
+     * length of a discovery period; locally chosen experiments last at
+     * least 2 seconds, longer when progress is slow
+     */
+    private static final long DISCOVERY_MILLIS = 12000;
+
+    /**
+     * how often results are fetched during discovery
+     */
+    private static final long DISCOVERY_POLL_MILLIS = 1000;
+
+    /**
+     * coordinated rounds between discovery periods
+     */
+    private static final int ROUNDS_PER_DISCOVERY = 50;
+
+    /**
+     * a round still missing reports this long after its window closed
+     * is dropped
+     */
+    private static final long STALE_ROUND_MILLIS = 10000;
+
+    /**
+     * a candidate line and how many coordinated rounds it has had
+     */
+    private static class Line {
+        final String classSig;
+        final int lineNo;
+        int rounds = 0;
+
+        Line(String classSig, int lineNo) {
+            this.classSig = classSig;
+            this.lineNo = lineNo;
+        }
+    }
+
+    private final Map<Integer, JCozProfilerMBean> replicas;
+
+    private final long windowMillis;
+
+    private final long leadMillis;
+
+    private final Random random = new Random();
+
+    private final Map<String, Line> lines = new LinkedHashMap<>();
+
+    /**
+     * reports of coordinated rounds that not every replica has sent yet,
+     * by window start and then by replica
+     */
+    private final Map<Long, Map<Integer, Experiment>> rounds = new HashMap<>();
+
+    /**
+     * pooled experiments not yet fetched with getOutput
+     */
+    private final List<Experiment> pooled = new ArrayList<>();
+
+    private volatile boolean running = false;
+
+    private Thread thread;
+
+    public ExperimentCoordinator(Map<Integer, JCozProfilerMBean> replicas,
+            long windowMillis, long leadMillis) {
+        this.replicas = replicas;
+        this.windowMillis = windowMillis;
+        this.leadMillis = leadMillis;
+    }
+
+    public ExperimentCoordinator(Map<Integer, JCozProfilerMBean> replicas) {
+        this(replicas, DEFAULT_WINDOW_MILLIS, DEFAULT_LEAD_MILLIS);
+    }
+
+    /**
+     * start coordinating; the replicas must already be profiling
+     */
+    public synchronized void start() {
+        running = true;
+        thread = new Thread(this, "jcoz-coordinator");
+        thread.setDaemon(true);
+        thread.start();
+    }
+
+    /**
+     * stop coordinating and hand line choice back to the replicas
+     */
+    public void stop() {
+        running = false;
+        thread.interrupt();
+        try {
+            thread.join();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+        clearSchedules();
+    }
+
+    /**
+     * pooled experiments since the last call
+     */
+    public synchronized List<Experiment> getOutput() {
+        List<Experiment> output = new ArrayList<>(pooled);
+        pooled.clear();
+        return output;
+    }
+
+    @Override
+    public void run() {
+        try {
+            while (running) {
+                discover();
+                for (int round = 0; running && round < ROUNDS_PER_DISCOVERY && !lines.isEmpty(); round++) {
+                    runRound();
+                }
+            }
+        } catch (InterruptedException e) {
+            // stop() was called
+        }
+    }
+
+    /**
+     * let the replicas choose lines for a while and remember the ones
+     * they chose
+     */
+    private void discover() throws InterruptedException {
+        clearSchedules();
+        long end = System.currentTimeMillis() + DISCOVERY_MILLIS;
+        while (running && System.currentTimeMillis() < end) {
+            Thread.sleep(DISCOVERY_POLL_MILLIS);
+            collect();
+        }
+        logger.info("Coordinating experiments over {} candidate lines", lines.size());
+    }
+
+    /**
+     * schedule one experiment on every replica, wait for it to finish and
+     * pool the results
+     */
+    private void runRound() throws InterruptedException {
+        Line line = null;
+        for (Line candidate : lines.values()) {
+            if (line == null || candidate.rounds < line.rounds) {
+                line = candidate;
+            }
+        }
+        line.rounds++;
+        float speedup = randomSpeedup();
+        long start = System.currentTimeMillis() + leadMillis;
+
+        for (Map.Entry<Integer, JCozProfilerMBean> replica : replicas.entrySet()) {
+            try {
+                int returnCode = replica.getValue().scheduleExperiment(line.classSig, line.lineNo,
+                        speedup, start, windowMillis);
+                if (returnCode != JCozProfilingErrorCodes.NORMAL_RETURN) {
+                    logger.warn("Replica {} refused to schedule an experiment, error code {}",
+                            replica.getKey(), returnCode);
+                }
+            } catch (RuntimeException e) {
+                logger.warn("Could not schedule an experiment on replica {}", replica.getKey(), e);
+            }
+        }
+
+        long reportAt = start + windowMillis + REPORT_GRACE_MILLIS;
+        long now;
+        while ((now = System.currentTimeMillis()) < reportAt) {
+            Thread.sleep(reportAt - now);
+        }
+        collect();
+    }
+
+    /**
+     * 0 a quarter of the time, so that every line gets baseline rounds of
+     * its own, otherwise 0.05 to 1.0 in steps of 0.05. Unlike the agent,
+     * the coordinator keeps no results to plan speedups from.
+     */
+    private float randomSpeedup() {
+        if (random.nextInt(4) == 0) {
+            return 0;
+        }
+        return (random.nextInt(20) + 1) * 5 / 100.f;
+    }
+
+    private void clearSchedules() {
+        for (Map.Entry<Integer, JCozProfilerMBean> replica : replicas.entrySet()) {
+            try {
+                replica.getValue().clearExperimentSchedule();
+            } catch (RuntimeException e) {
+                logger.warn("Could not clear the schedule on replica {}", replica.getKey(), e);
+            }
+        }
+    }
+
+    /**
+     * fetch every replica's experiments and pool the rounds that all of
+     * them have reported. A pooled experiment has the summed hits and the
+     * mean duration of the replicas, so its hit rate is that of the
+     * replicas together. Its sampling period and GC pause time are the
+     * means of theirs.
+     */
+    private void collect() {
+        for (Map.Entry<Integer, JCozProfilerMBean> replica : replicas.entrySet()) {
+            for (Experiment experiment : fetch(replica.getKey(), replica.getValue())) {
+                String lineKey = experiment.getClassSig() + ":" + experiment.getLineNo();
+                if (!lines.containsKey(lineKey)) {
+                    lines.put(lineKey, new Line(experiment.getClassSig(), experiment.getLineNo()));
+                }
+                if (!experiment.isScheduled()) {
+                    continue;
+                }
+                Long window = experiment.getWindowStart();
+                if (!rounds.containsKey(window)) {
+                    rounds.put(window, new HashMap<Integer, Experiment>());
+                }
+                rounds.get(window).put(replica.getKey(), experiment);
+            }
+        }
+
+        List<Experiment> results = new ArrayList<>();
+        long now = System.currentTimeMillis();
+        Iterator<Map.Entry<Long, Map<Integer, Experiment>>> it = rounds.entrySet().iterator();
+        while (it.hasNext()) {
+            Map.Entry<Long, Map<Integer, Experiment>> round = it.next();
+            Map<Integer, Experiment> byReplica = round.getValue();
+            if (byReplica.size() == replicas.size()) {
+                results.add(pool(byReplica.values()));
+                it.remove();
+            } else if (now > round.getKey() + windowMillis + STALE_ROUND_MILLIS) {
+                logger.warn("Dropping the round at {}: {} of {} replicas reported it",
+                        round.getKey(), byReplica.size(), replicas.size());
+                it.remove();
+            }
+        }
+
+        synchronized (this) {
+            pooled.addAll(results);
+        }
+    }
+
+    /**
+     * one experiment out of every replica's report of the same round
+     */
+    private static Experiment pool(Collection<Experiment> reports) {
+        Experiment first = null;
+        long duration = 0;
+        long pointsHit = 0;
+        long samplePeriod = 0;
+        long gcPause = 0;
+        for (Experiment experiment : reports) {
+            first = first == null ? experiment : first;
+            duration += experiment.getDuration();
+            pointsHit += experiment.getPointsHit();
+            samplePeriod += experiment.getSamplePeriod();
+            gcPause += experiment.getGcPause();
+        }
+        int n = reports.size();
+        logger.debug("Pooled {}:{} at speedup {} over {} replicas", first.getClassSig(),
+                first.getLineNo(), first.getSpeedup(), n);
+        return new Experiment(first.getClassSig(), first.getLineNo(), first.getSpeedup(),
+                duration / n, pointsHit, samplePeriod / n, gcPause / n, first.getWindowStart());
+    }
+
+    private List<Experiment> fetch(int pid, JCozProfilerMBean replica) {
+        List<Experiment> experiments = new ArrayList<>();
+        try {
+            byte[] output = replica.getProfilerOutput();
+            if (output == null || output.length == 0) {
+                return experiments;
+            }
+            ObjectInputStream ois = new ObjectInputStream(new ByteArrayInputStream(output));
+            int numExperiments = ois.readInt();
+            for (int i = 0; i < numExperiments; i++) {
+                experiments.add(Experiment.deserialize(ois));
+            }
+        } catch (IOException | RuntimeException e) {
+            logger.warn("Could not fetch experiments from replica {}", pid, e);
+        }
+        return experiments;
+    }
+}
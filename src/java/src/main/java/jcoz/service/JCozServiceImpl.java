@@ -20,6 +20,8 @@
  */
 package jcoz.service;
 
+import com.sun.tools.attach.AgentInitializationException;
+import com.sun.tools.attach.AgentLoadException;
 import com.sun.tools.attach.AttachNotSupportedException;
 import com.sun.tools.attach.VirtualMachine;
 import com.sun.tools.attach.VirtualMachineDescriptor;
@@ -27,15 +29,20 @@ import jcoz.JCozVMDescriptor;
 import jcoz.agent.JCozProfiler;
 import jcoz.agent.JCozProfilerMBean;
 import jcoz.agent.JCozProfilingErrorCodes;
+import jcoz.profile.Experiment;
 
 import javax.management.JMX;
 import javax.management.MBeanServerConnection;
 import javax.management.remote.JMXConnector;
 import javax.management.remote.JMXConnectorFactory;
 import javax.management.remote.JMXServiceURL;
+import java.io.ByteArrayOutputStream;
+import java.io.File;
 import java.io.IOException;
+import java.io.ObjectOutputStream;
 import java.io.PrintWriter;
 import java.io.StringWriter;
+import java.net.URISyntaxException;
 import java.rmi.RemoteException;
 import java.util.*;
 
@@ -52,11 +59,30 @@ public class JCozServiceImpl implements JCozServiceInterface {
 
     private static final String CONNECTOR_ADDRESS_PROPERTY_KEY = "com.sun.management.jmxremote.localConnectorAddress";
 
+    /*
+     * path of liblagent.so, loaded into JVMs that were started without it
+     */
+    public static final String AGENT_PATH_PROPERTY_KEY = "jcoz.agent.path";
+
+    /*
+     * extra agent options for JVMs the agent is loaded into, e.g.
+     * logfile=/tmp/jcoz.log
+     */
+    public static final String AGENT_OPTIONS_PROPERTY_KEY = "jcoz.agent.options";
+
     // use a tree map so it is sorted
     private Map<Integer, JCozProfilerMBean> attachedVMs = new TreeMap<>();
 
     private static final String JVM_WITH_PID_IS_NOT_ATTACHED = "JVM with pid %d is not attached";
 
+    /*
+     * profiled JVMs running the same experiments, and what schedules them;
+     * null when not coordinating
+     */
+    private Map<Integer, JCozProfilerMBean> coordinatedVMs = null;
+
+    private ExperimentCoordinator coordinator = null;
+
     /*
      * (non-Javadoc)
      *
@@ -96,14 +122,20 @@ public class JCozServiceImpl implements JCozServiceInterface {
                     JMXConnector connector = JMXConnectorFactory.connect(url);
                     MBeanServerConnection mbeanConn = connector
                         .getMBeanServerConnection();
+                    if (!mbeanConn.isRegistered(JCozProfiler.getMBeanName())
+                            && !loadAgent(vm, localProcessId)) {
+                        connector.close();
+                        vm.detach();
+                        return JCozProfilingErrorCodes.INVALID_JAVA_PROCESS;
+                    }
                     attachedVMs.put(localProcessId, JMX.newMXBeanProxy(mbeanConn,
                                 JCozProfiler.getMBeanName(),
                                 JCozProfilerMBean.class));
                     return JCozProfilingErrorCodes.NORMAL_RETURN;
                 }
             }
-        } catch (IOException | NumberFormatException
-                | AttachNotSupportedException e) {
+        } catch (IOException | NumberFormatException | AttachNotSupportedException
+                | AgentLoadException | AgentInitializationException | URISyntaxException e) {
             StringWriter stringWriter = new StringWriter();
             e.printStackTrace(new PrintWriter(stringWriter));
             logger.error("Got an exception during attachToProcess, stacktrace: {}", stringWriter);
@@ -113,6 +145,34 @@ public class JCozServiceImpl implements JCozServiceInterface {
         return JCozProfilingErrorCodes.INVALID_JAVA_PROCESS;
     }
 
+    /**
+     * load the agent into a JVM that is already running without it. The
+     * agent is told where this jar is so that it can find JCozProfiler,
+     * which registers the MBean before loadAgentPath returns.
+     *
+     * @return false if no agent path was configured
+     */
+    private boolean loadAgent(VirtualMachine vm, int localProcessId) throws URISyntaxException,
+            AgentLoadException, AgentInitializationException, IOException {
+        String agentPath = System.getProperty(AGENT_PATH_PROPERTY_KEY);
+        if (agentPath == null) {
+            logger.error("JVM {} was not started with the JCoz agent; set -D{} to load it",
+                    localProcessId, AGENT_PATH_PROPERTY_KEY);
+            return false;
+        }
+        String jarPath = new File(JCozProfiler.class.getProtectionDomain().getCodeSource()
+                .getLocation().toURI()).getAbsolutePath();
+        String options = "jar=" + jarPath;
+        String extraOptions = System.getProperty(AGENT_OPTIONS_PROPERTY_KEY);
+        if (extraOptions != null && !extraOptions.isEmpty()) {
+            options += "," + extraOptions;
+        }
+        logger.info("Loading agent {} into process {} with options {}", agentPath,
+                localProcessId, options);
+        vm.loadAgentPath(agentPath, options);
+        return true;
+    }
+
     /* (non-Javadoc)
      * @see jcoz.service.JCozServiceInterface#startProfiling(int)
      */
@@ -194,4 +254,83 @@ public class JCozServiceImpl implements JCozServiceInterface {
         return attachedVMs.get(pid).getProgressPoint();
     }
 
+    /* (non-Javadoc)
+     * @see jcoz.service.JCozServiceInterface#startCoordinatedProfiling(int[])
+     */
+    @Override
+    public synchronized int startCoordinatedProfiling(int[] pids) throws RemoteException {
+        if (coordinator != null) {
+            return JCozProfilingErrorCodes.CANNOT_CALL_WHEN_RUNNING;
+        }
+        Map<Integer, JCozProfilerMBean> replicas = new TreeMap<>();
+        for (int pid : pids) {
+            if (!attachedVMs.containsKey(pid)) {
+                throw new RemoteException("", new JCozException(String.format(JVM_WITH_PID_IS_NOT_ATTACHED, pid)));
+            }
+            replicas.put(pid, attachedVMs.get(pid));
+        }
+
+        List<JCozProfilerMBean> started = new ArrayList<>();
+        for (JCozProfilerMBean replica : replicas.values()) {
+            int returnCode = replica.startProfiling();
+            if (returnCode != JCozProfilingErrorCodes.NORMAL_RETURN) {
+                for (JCozProfilerMBean startedReplica : started) {
+                    startedReplica.endProfiling();
+                }
+                return returnCode;
+            }
+            started.add(replica);
+        }
+
+        logger.info("Coordinating experiments across {} JVMs", replicas.size());
+        coordinatedVMs = replicas;
+        coordinator = new ExperimentCoordinator(replicas);
+        coordinator.start();
+        return JCozProfilingErrorCodes.NORMAL_RETURN;
+    }
+
+    /* (non-Javadoc)
+     * @see jcoz.service.JCozServiceInterface#endCoordinatedProfiling()
+     */
+    @Override
+    public synchronized int endCoordinatedProfiling() throws RemoteException {
+        if (coordinator == null) {
+            return JCozProfilingErrorCodes.PROFILER_NOT_RUNNING;
+        }
+        coordinator.stop();
+        int returnCode = JCozProfilingErrorCodes.NORMAL_RETURN;
+        for (JCozProfilerMBean replica : coordinatedVMs.values()) {
+            int replicaReturnCode = replica.endProfiling();
+            if (returnCode == JCozProfilingErrorCodes.NORMAL_RETURN) {
+                returnCode = replicaReturnCode;
+            }
+        }
+        coordinator = null;
+        coordinatedVMs = null;
+        return returnCode;
+    }
+
+    /* (non-Javadoc)
+     * @see jcoz.service.JCozServiceInterface#getCoordinatedProfilerOutput()
+     */
+    @Override
+    public synchronized byte[] getCoordinatedProfilerOutput() throws RemoteException {
+        if (coordinator == null) {
+            return new ByteArrayOutputStream().toByteArray();
+        }
+        try {
+            List<Experiment> experiments = coordinator.getOutput();
+            ByteArrayOutputStream baos = new ByteArrayOutputStream();
+            ObjectOutputStream oos = new ObjectOutputStream(baos);
+            oos.writeInt(experiments.size());
+            for (Experiment e : experiments) {
+                e.serialize(oos);
+            }
+            oos.flush();
+            return baos.toByteArray();
+        } catch (IOException e) {
+            throw new RemoteException("", e);
+        }
+    }
+
 }
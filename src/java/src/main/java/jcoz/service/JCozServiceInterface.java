@@ -50,5 +50,11 @@ public interface JCozServiceInterface extends Remote{
 
     public String getProgressPoint(int pid) throws RemoteException;
 
+    public int startCoordinatedProfiling(int[] pids) throws RemoteException;
+
+    public int endCoordinatedProfiling() throws RemoteException;
+
+    public byte[] getCoordinatedProfilerOutput() throws RemoteException;
+
 
 }
@@ -0,0 +1,184 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.UUID;
+
+import javax.management.JMX;
+import javax.management.remote.JMXConnector;
+import javax.management.remote.JMXConnectorFactory;
+import javax.management.remote.JMXServiceURL;
+
+import com.sun.tools.attach.VirtualMachine;
+import com.sun.tools.attach.VirtualMachineDescriptor;
+
+import jcoz.agent.JCozProfiler;
+import jcoz.agent.JCozProfilerMBean;
+import jcoz.agent.JCozProfilingErrorCodes;
+import jcoz.service.JCozServiceImpl;
+
+/**
+ * Checks that an agent attached to a running JVM profiles the same
+ * threads as one loaded at startup. A ThreadGroupWorkload is profiled
+ * both ways: once started with -agentpath, once started bare and then
+ * attached to. Either way only its main thread group should be sampled,
+ * not the threads of its other group or the JVM's own, so the two
+ * thread counts must agree. Exits with status 1 if they do not.
+ *
+ * usage: java test.AttachedThreadsTest --agent=<liblagent.so>
+ */
+public class AttachedThreadsTest {
+
+    private static final long STARTUP_TIMEOUT_MILLIS = 30000;
+
+    /**
+     * time for every adopted thread to be signaled and bind its slot
+     */
+    private static final long SETTLE_MILLIS = 3000;
+
+    public static void main(String[] args) throws Exception {
+        String agentPath = null;
+        for (String arg : args) {
+            if (arg.startsWith("--agent=")) {
+                agentPath = arg.substring("--agent=".length());
+            } else {
+                usage();
+            }
+        }
+        if (agentPath == null) {
+            usage();
+        }
+        System.setProperty(JCozServiceImpl.AGENT_PATH_PROPERTY_KEY, agentPath);
+
+        int launched = profiledThreads(agentPath, true);
+        int attached = profiledThreads(agentPath, false);
+        // main plus its workers, at the least
+        int expected = ThreadGroupWorkload.MAIN_GROUP_WORKERS + 1;
+        boolean ok = launched == attached && launched >= expected;
+        System.out.printf("%s: %d threads profiled when launched with the agent, %d when attached,"
+                + " at least %d expected%n", ok ? "ok" : "FAIL", launched, attached, expected);
+        System.exit(ok ? 0 : 1);
+    }
+
+    private static void usage() {
+        System.err.println("usage: java test.AttachedThreadsTest --agent=<liblagent.so>");
+        System.exit(2);
+    }
+
+    /**
+     * runs a ThreadGroupWorkload, with the agent from the start or
+     * attached once it is running, profiles it for a while and returns
+     * how many of its threads the agent samples
+     */
+    private static int profiledThreads(String agentPath, boolean withAgent) throws Exception {
+        String tag = "threads-" + UUID.randomUUID();
+        Process process = startWorkload(withAgent ? agentPath : null, tag);
+        try {
+            String progressPoint = readProgressPoint(process);
+            int pid = findWorkload(tag);
+
+            JCozServiceImpl service = new JCozServiceImpl();
+            check(service.attachToProcess(pid), "attach");
+            int colon = progressPoint.lastIndexOf(':');
+            check(service.setProgressPoint(pid, progressPoint.substring(0, colon),
+                        Integer.parseInt(progressPoint.substring(colon + 1))), "set the progress point");
+            check(service.setScope(pid, "test"), "set the scope");
+            check(service.startProfiling(pid), "start profiling");
+            Thread.sleep(SETTLE_MILLIS);
+
+            int threads = profiledThreadCount(pid);
+            service.endProfiling(pid);
+            return threads;
+        } finally {
+            process.destroy();
+        }
+    }
+
+    private static void check(int returnCode, String what) throws IOException {
+        if (returnCode != JCozProfilingErrorCodes.NORMAL_RETURN) {
+            throw new IOException("could not " + what + ": error " + returnCode);
+        }
+    }
+
+    private static int profiledThreadCount(int pid) throws Exception {
+        VirtualMachine vm = VirtualMachine.attach(Integer.toString(pid));
+        try {
+            JMXConnector connector = JMXConnectorFactory.connect(
+                    new JMXServiceURL(vm.startLocalManagementAgent()));
+            try {
+                JCozProfilerMBean profiler = JMX.newMXBeanProxy(connector.getMBeanServerConnection(),
+                        JCozProfiler.getMBeanName(), JCozProfilerMBean.class);
+                return profiler.getProfiledThreadCount();
+            } finally {
+                connector.close();
+            }
+        } finally {
+            vm.detach();
+        }
+    }
+
+    private static Process startWorkload(String agentPath, String tag) throws IOException {
+        List<String> command = new ArrayList<>();
+        command.add(System.getProperty("java.home") + File.separator + "bin" + File.separator + "java");
+        if (agentPath != null) {
+            command.add("-agentpath:" + agentPath);
+        }
+        command.add("-cp");
+        command.add(System.getProperty("java.class.path"));
+        command.add(ThreadGroupWorkload.class.getName());
+        command.add(tag);
+        return new ProcessBuilder(command)
+            .redirectError(ProcessBuilder.Redirect.INHERIT)
+            .start();
+    }
+
+    /**
+     * wait for the workload to print where its progress point is
+     */
+    private static String readProgressPoint(Process process) throws IOException {
+        BufferedReader reader = new BufferedReader(new InputStreamReader(process.getInputStream()));
+        String line;
+        while ((line = reader.readLine()) != null) {
+            if (line.startsWith("progress-point ")) {
+                return line.substring("progress-point ".length());
+            }
+        }
+        throw new IOException("workload exited before printing its progress point");
+    }
+
+    /**
+     * pid of the workload JVM, found by the tag in its display name
+     */
+    private static int findWorkload(String tag) throws IOException, InterruptedException {
+        long deadline = System.currentTimeMillis() + STARTUP_TIMEOUT_MILLIS;
+        while (System.currentTimeMillis() < deadline) {
+            for (VirtualMachineDescriptor desc : VirtualMachine.list()) {
+                if (desc.displayName().contains(tag)) {
+                    return Integer.parseInt(desc.id());
+                }
+            }
+            Thread.sleep(500);
+        }
+        throw new IOException("workload JVM did not show up for attaching");
+    }
+}
@@ -0,0 +1,246 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.HashSet;
+import java.util.List;
+import java.util.Set;
+import java.util.UUID;
+
+import com.sun.tools.attach.VirtualMachine;
+import com.sun.tools.attach.VirtualMachineDescriptor;
+
+import jcoz.client.cli.CoordinatedProcessWrapper;
+import jcoz.client.cli.TargetProcessInterface;
+import jcoz.profile.Experiment;
+import jcoz.profile.Profile;
+import jcoz.service.ExperimentCoordinator;
+import jcoz.service.JCozServiceImpl;
+
+/**
+ * Coordinated profiling on one machine: starts several ReplicaWorkload
+ * JVMs, each with a share of the load, profiles them together through an
+ * in-process JCozServiceImpl and pools their experiments into one
+ * profile, written to coordinated-replicas.coz.
+ *
+ * The pooled experiments are then checked: each is one scheduled round,
+ * no longer than its window, and the baseline rounds all have about the
+ * same rate, as they would not if some were pooled over fewer replicas
+ * than others. Exits with status 1 if a check fails.
+ *
+ * usage: java test.CoordinatedServiceTest --agent=<liblagent.so>
+ *            [--replicas=<n>] [--seconds=<n>]
+ */
+public class CoordinatedServiceTest {
+
+    private static final long STARTUP_TIMEOUT_MILLIS = 30000;
+
+    private static final long POLL_MILLIS = 2000;
+
+    /**
+     * slack on a round's duration for the agent's last sampling period
+     */
+    private static final long WINDOW_SLACK_MILLIS = 200;
+
+    /**
+     * a baseline round's rate may be this far from the median, either way
+     */
+    private static final double MAX_RATE_RATIO = 2.0;
+
+    public static void main(String[] args) throws Exception {
+        String agentPath = null;
+        int replicas = 4;
+        int seconds = 120;
+        for (String arg : args) {
+            if (arg.startsWith("--agent=")) {
+                agentPath = arg.substring("--agent=".length());
+            } else if (arg.startsWith("--replicas=")) {
+                replicas = Integer.parseInt(arg.substring("--replicas=".length()));
+            } else if (arg.startsWith("--seconds=")) {
+                seconds = Integer.parseInt(arg.substring("--seconds=".length()));
+            } else {
+                usage();
+            }
+        }
+        if (agentPath == null || replicas < 1) {
+            usage();
+        }
+
+        String tag = "replica-" + UUID.randomUUID();
+        List<Process> processes = new ArrayList<>();
+        List<Experiment> pooled = new ArrayList<>();
+        try {
+            String progressPoint = null;
+            for (int i = 0; i < replicas; i++) {
+                Process process = startReplica(agentPath, tag, replicas);
+                processes.add(process);
+                progressPoint = readProgressPoint(process);
+            }
+            int[] pids = findReplicas(tag, replicas);
+
+            TargetProcessInterface fleet = new CoordinatedProcessWrapper(new JCozServiceImpl(), pids);
+            int colon = progressPoint.lastIndexOf(':');
+            fleet.setProgressPoint(progressPoint.substring(0, colon),
+                    Integer.parseInt(progressPoint.substring(colon + 1)));
+            fleet.setScope("test");
+            fleet.startProfiling();
+
+            Profile profile = new Profile("coordinated-replicas");
+            int experiments = 0;
+            long pointsHit = 0;
+            long end = System.currentTimeMillis() + seconds * 1000L;
+            while (System.currentTimeMillis() < end) {
+                Thread.sleep(POLL_MILLIS);
+                List<Experiment> output = fleet.getProfilerOutput();
+                for (Experiment exp : output) {
+                    System.out.println(exp);
+                    experiments++;
+                    pointsHit += exp.getPointsHit();
+                }
+                pooled.addAll(output);
+                profile.addExperiments(output);
+            }
+            fleet.endProfiling();
+            profile.flushAndCloseLog(new ArrayList<Experiment>());
+
+            System.out.printf("%d pooled experiments over %d replicas, %.1f progress points each%n",
+                    experiments, replicas, experiments == 0 ? 0.0 : (double) pointsHit / experiments);
+        } finally {
+            for (Process process : processes) {
+                process.destroy();
+            }
+        }
+        System.exit(check(pooled) ? 0 : 1);
+    }
+
+    /**
+     * checks the pooled experiments; returns false and says why if one
+     * fails
+     */
+    private static boolean check(List<Experiment> pooled) {
+        boolean ok = true;
+        if (pooled.isEmpty()) {
+            System.out.println("FAIL: no pooled experiments");
+            return false;
+        }
+
+        Set<Long> windows = new HashSet<>();
+        List<Double> baselineRates = new ArrayList<>();
+        long maxDuration = (ExperimentCoordinator.DEFAULT_WINDOW_MILLIS + WINDOW_SLACK_MILLIS) * 1000000L;
+        for (Experiment exp : pooled) {
+            if (!exp.isScheduled()) {
+                System.out.println("FAIL: pooled experiment outside a scheduled round: " + exp);
+                ok = false;
+                continue;
+            }
+            if (!windows.add(exp.getWindowStart())) {
+                System.out.println("FAIL: round at " + exp.getWindowStart() + " pooled twice");
+                ok = false;
+            }
+            if (exp.getDuration() <= 0 || exp.getDuration() > maxDuration) {
+                System.out.println("FAIL: pooled duration " + exp.getDuration()
+                        + " ns does not fit a " + ExperimentCoordinator.DEFAULT_WINDOW_MILLIS + " ms window");
+                ok = false;
+            }
+            if (exp.getSpeedup() == 0 && exp.getDurationWithoutGc() > 0) {
+                baselineRates.add((double) exp.getPointsHit() / exp.getDurationWithoutGc());
+            }
+        }
+
+        if (baselineRates.size() < 2) {
+            System.out.println("FAIL: only " + baselineRates.size() + " baseline rounds to compare");
+            return false;
+        }
+        List<Double> sorted = new ArrayList<>(baselineRates);
+        Collections.sort(sorted);
+        double median = sorted.get(sorted.size() / 2);
+        for (double rate : baselineRates) {
+            if (rate * MAX_RATE_RATIO < median || rate > median * MAX_RATE_RATIO) {
+                System.out.printf("FAIL: baseline rate %.3g hits/s is off the median %.3g hits/s%n",
+                        rate * 1e9, median * 1e9);
+                ok = false;
+            }
+        }
+        System.out.printf("%s: %d rounds, %d baselines at a median %.3g hits/s%n", ok ? "ok" : "FAIL",
+                pooled.size(), baselineRates.size(), median * 1e9);
+        return ok;
+    }
+
+    private static void usage() {
+        System.err.println("usage: java test.CoordinatedServiceTest --agent=<liblagent.so>"
+                + " [--replicas=<n>] [--seconds=<n>]");
+        System.exit(2);
+    }
+
+    private static Process startReplica(String agentPath, String tag, int replicas) throws IOException {
+        List<String> command = new ArrayList<>();
+        command.add(System.getProperty("java.home") + File.separator + "bin" + File.separator + "java");
+        command.add("-agentpath:" + agentPath);
+        command.add("-cp");
+        command.add(System.getProperty("java.class.path"));
+        command.add(ReplicaWorkload.class.getName());
+        command.add(tag);
+        command.add(Integer.toString(replicas));
+        return new ProcessBuilder(command)
+            .redirectError(ProcessBuilder.Redirect.INHERIT)
+            .start();
+    }
+
+    /**
+     * wait for the replica to print where its progress point is
+     */
+    private static String readProgressPoint(Process process) throws IOException {
+        BufferedReader reader = new BufferedReader(new InputStreamReader(process.getInputStream()));
+        String line;
+        while ((line = reader.readLine()) != null) {
+            if (line.startsWith("progress-point ")) {
+                return line.substring("progress-point ".length());
+            }
+        }
+        throw new IOException("replica exited before printing its progress point");
+    }
+
+    /**
+     * pids of the replica JVMs, found by the tag in their display names
+     */
+    private static int[] findReplicas(String tag, int replicas) throws IOException, InterruptedException {
+        long deadline = System.currentTimeMillis() + STARTUP_TIMEOUT_MILLIS;
+        while (System.currentTimeMillis() < deadline) {
+            List<Integer> pids = new ArrayList<>();
+            for (VirtualMachineDescriptor desc : VirtualMachine.list()) {
+                if (desc.displayName().contains(tag)) {
+                    pids.add(Integer.parseInt(desc.id()));
+                }
+            }
+            if (pids.size() == replicas) {
+                int[] result = new int[replicas];
+                for (int i = 0; i < replicas; i++) {
+                    result[i] = pids.get(i);
+                }
+                return result;
+            }
+            Thread.sleep(500);
+        }
+        throw new IOException("replica JVMs did not all show up for attaching");
+    }
+}
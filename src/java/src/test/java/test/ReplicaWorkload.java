@@ -0,0 +1,91 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+
+/**
+ * One replica of a service, for CoordinatedServiceTest. Each of n
+ * replicas gets 1/n of the load: after every request it idles for n - 1
+ * times as long as the request took.
+ *
+ * usage: java test.ReplicaWorkload <tag> <replicas>
+ *
+ * The tag only makes the JVM easy to find by its display name. The
+ * progress point line is printed on startup.
+ */
+public class ReplicaWorkload {
+
+    public static final long LOOP_ITERS = 2000000L;
+    public static final int numThreads = 4;
+
+    static volatile long sink;
+
+    public static void main(String[] args) throws Exception {
+        if (args.length != 2) {
+            System.err.println("usage: java test.ReplicaWorkload <tag> <replicas>");
+            System.exit(2);
+        }
+        int replicas = Integer.parseInt(args[1]);
+
+        ExecutorService executor = Executors.newFixedThreadPool(numThreads);
+        List<Callable<Void>> workers = new ArrayList<>();
+        for (int i = 0; i < numThreads; i++) {
+            workers.add(new ParallelWorker());
+        }
+
+        System.out.println("progress-point " + ReplicaWorkload.class.getName() + ":" + finishRequest());
+        System.out.flush();
+
+        while (true) {
+            long start = System.nanoTime();
+            executor.invokeAll(workers);
+            doSerial();
+            finishRequest();
+            long idleMillis = (System.nanoTime() - start) * (replicas - 1) / 1000000L;
+            Thread.sleep(idleMillis);
+        }
+    }
+
+    public static void doSerial() {
+        long sum = 0;
+        for (long i = 0; i < LOOP_ITERS; i++)
+            sum += (System.nanoTime() % 9999);
+        sink = sum;
+    }
+
+    /**
+     * the progress point; returns its own line
+     */
+    static int finishRequest() {
+        return new Throwable().getStackTrace()[0].getLineNumber();
+    }
+
+    static class ParallelWorker implements Callable<Void> {
+        public Void call() {
+            long sum = 0;
+            for (long i = 0; i < LOOP_ITERS; i++)
+                sum += (System.nanoTime() % 9999);
+            sink = sum;
+            return null;
+        }
+    }
+}
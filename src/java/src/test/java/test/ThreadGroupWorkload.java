@@ -0,0 +1,86 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test;
+
+/**
+ * A workload whose threads are split between the main thread group and
+ * another one, for AttachedThreadsTest. The profiler samples only the
+ * main group, so the same threads should be profiled whether the agent
+ * was there from the start or attached later.
+ *
+ * usage: java test.ThreadGroupWorkload <tag>
+ *
+ * The tag only makes the JVM easy to find by its display name. The
+ * progress point line is printed once every thread is running.
+ */
+public class ThreadGroupWorkload {
+
+    public static final int MAIN_GROUP_WORKERS = 3;
+    public static final int OTHER_GROUP_WORKERS = 2;
+    public static final long LOOP_ITERS = 1000000L;
+
+    static volatile long sink;
+
+    public static void main(String[] args) throws Exception {
+        if (args.length != 1) {
+            System.err.println("usage: java test.ThreadGroupWorkload <tag>");
+            System.exit(2);
+        }
+
+        ThreadGroup other = new ThreadGroup("other");
+        for (int i = 0; i < MAIN_GROUP_WORKERS; i++) {
+            startWorker(Thread.currentThread().getThreadGroup(), "main-worker-" + i);
+        }
+        for (int i = 0; i < OTHER_GROUP_WORKERS; i++) {
+            startWorker(other, "other-worker-" + i);
+        }
+
+        System.out.println("progress-point " + ThreadGroupWorkload.class.getName() + ":" + finishRequest());
+        System.out.flush();
+
+        while (true) {
+            doWork();
+            finishRequest();
+        }
+    }
+
+    private static void startWorker(ThreadGroup group, String name) {
+        Thread worker = new Thread(group, new Runnable() {
+            public void run() {
+                while (true) {
+                    doWork();
+                }
+            }
+        }, name);
+        worker.setDaemon(true);
+        worker.start();
+    }
+
+    public static void doWork() {
+        long sum = 0;
+        for (long i = 0; i < LOOP_ITERS; i++)
+            sum += (System.nanoTime() % 9999);
+        sink = sum;
+    }
+
+    /**
+     * the progress point; returns its own line
+     */
+    static int finishRequest() {
+        return new Throwable().getStackTrace()[0].getLineNumber();
+    }
+}
@@ -0,0 +1,285 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy;
+
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.io.ObjectInputStream;
+import java.lang.management.ManagementFactory;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+import java.util.Map;
+import java.util.TreeMap;
+
+import javax.management.JMX;
+
+import jcoz.agent.JCozProfiler;
+import jcoz.agent.JCozProfilerMBean;
+import jcoz.profile.Experiment;
+import jcoz.profile.InsufficientBaselineResultsException;
+import jcoz.profile.LineSpeedup;
+import test.accuracy.workloads.ForkJoin;
+import test.accuracy.workloads.LockBound;
+import test.accuracy.workloads.NoEffect;
+import test.accuracy.workloads.ProducerConsumer;
+import test.accuracy.workloads.SerialChain;
+import test.accuracy.workloads.VirtualThreadServer;
+
+/**
+ * Checks JCoz's predictions against workloads with known answers.
+ *
+ * For each workload the runner first turns the workload's knob to
+ * really speed up its target line and measures the throughput change at
+ * each speedup; that is the true impact curve. It then profiles the
+ * workload through the in-process JCozProfiler MBean and, once a second,
+ * rebuilds JCoz's predicted curve for the target line from the
+ * experiments so far. It reports the mean absolute error between the two
+ * curves at the end, and how long the prediction took to come within
+ * --tolerance of the truth and stay there.
+ *
+ * Run with the agent loaded, e.g. make run-accuracy.
+ */
+public class AccuracyRunner {
+
+    private static final String SCOPE = "test/accuracy/workloads";
+
+    private static double[] speedups = {0.25, 0.5, 0.75};
+    private static long warmupMillis = 3000;
+    private static long measureMillis = 3000;
+    private static int measureRounds = 3;
+    private static long profileMillis = 120000;
+    private static double tolerance = 0.05;
+    private static String only = null;
+
+    public static void main(String[] args) throws Exception {
+        for (String arg : args) {
+            if (arg.startsWith("--workload=")) {
+                only = value(arg);
+            } else if (arg.startsWith("--profile-seconds=")) {
+                profileMillis = Long.parseLong(value(arg)) * 1000;
+            } else if (arg.startsWith("--measure-seconds=")) {
+                measureMillis = Long.parseLong(value(arg)) * 1000;
+            } else if (arg.startsWith("--tolerance=")) {
+                tolerance = Double.parseDouble(value(arg));
+            } else if (arg.startsWith("--speedups=")) {
+                speedups = parseSpeedups(value(arg));
+            } else {
+                System.out.println("usage: java test.accuracy.AccuracyRunner [--workload=<name>]"
+                        + " [--profile-seconds=<n>] [--measure-seconds=<n>]"
+                        + " [--tolerance=<error>] [--speedups=<s1,s2,...>]");
+                System.exit(arg.equals("--help") ? 0 : 1);
+            }
+        }
+
+        JCozProfilerMBean profiler = JMX.newMBeanProxy(ManagementFactory.getPlatformMBeanServer(),
+                JCozProfiler.getMBeanName(), JCozProfilerMBean.class);
+
+        List<Workload> workloads = new ArrayList<>(Arrays.asList(new SerialChain(), new ForkJoin(),
+                new ProducerConsumer(), new LockBound(), new NoEffect()));
+        if (VirtualThreadServer.isSupported()) {
+            workloads.add(new VirtualThreadServer());
+        }
+        List<String> summary = new ArrayList<>();
+        for (Workload workload : workloads) {
+            if (only != null && !only.equals(workload.getName())) {
+                continue;
+            }
+            summary.add(evaluate(workload, profiler));
+        }
+
+        System.out.println();
+        System.out.println("workload\tmean_abs_error\tconverged_after_s\texperiments");
+        for (String line : summary) {
+            System.out.println(line);
+        }
+    }
+
+    private static String value(String arg) {
+        return arg.substring(arg.indexOf('=') + 1);
+    }
+
+    private static double[] parseSpeedups(String list) {
+        String[] parts = list.split(",");
+        double[] parsed = new double[parts.length];
+        for (int i = 0; i < parts.length; i++) {
+            parsed[i] = Double.parseDouble(parts[i]);
+        }
+        return parsed;
+    }
+
+    private static String evaluate(Workload workload, JCozProfilerMBean profiler) throws Exception {
+        System.out.println("== " + workload.getName());
+        workload.start();
+        Thread.sleep(warmupMillis);
+
+        Knob knob = workload.getKnob();
+        Progress progress = workload.getProgress();
+        System.out.println("target " + knob.getClassName() + ":" + knob.getLineNo()
+                + ", progress point " + progress.getClassName() + ":" + progress.getLineNo());
+
+        Map<Double, Double> truth = measureTruth(workload);
+        for (Map.Entry<Double, Double> entry : truth.entrySet()) {
+            System.out.printf("measured: line speedup %.2f -> program speedup %.3f%n",
+                    entry.getKey(), entry.getValue());
+        }
+
+        List<Experiment> experiments = new ArrayList<>();
+        profiler.setScope(SCOPE);
+        profiler.setProgressPoint(progress.getClassName(), progress.getLineNo());
+        profiler.startProfiling();
+
+        long start = System.currentTimeMillis();
+        double error = Double.NaN;
+        long convergedAt = -1;
+        while (System.currentTimeMillis() - start < profileMillis) {
+            Thread.sleep(1000);
+            experiments.addAll(fetchExperiments(profiler));
+            error = predictionError(experiments, knob, truth, false);
+            long elapsed = System.currentTimeMillis() - start;
+            if (Double.isNaN(error) || error > tolerance) {
+                convergedAt = -1;
+            } else if (convergedAt < 0) {
+                convergedAt = elapsed;
+            }
+        }
+        profiler.endProfiling();
+        workload.stop();
+
+        predictionError(experiments, knob, truth, true);
+        int targetExperiments = 0;
+        for (Experiment exp : experiments) {
+            if (onTarget(exp, knob)) {
+                targetExperiments++;
+            }
+        }
+        return String.format("%s\t%s\t%s\t%d/%d", workload.getName(),
+                Double.isNaN(error) ? "n/a" : String.format("%.4f", error),
+                convergedAt < 0 ? "not converged" : String.format("%.1f", convergedAt / 1000.0),
+                targetExperiments, experiments.size());
+    }
+
+    /**
+     * Turn the knob through each speedup and measure the real change in
+     * time per progress point. Speedups are visited in interleaved
+     * rounds so slow drift in the machine does not favour any of them.
+     */
+    private static Map<Double, Double> measureTruth(Workload workload) throws InterruptedException {
+        double baselinePeriod = 0;
+        double[] periods = new double[speedups.length];
+        for (int round = 0; round < measureRounds; round++) {
+            baselinePeriod += measurePeriod(workload, 0);
+            for (int i = 0; i < speedups.length; i++) {
+                periods[i] += measurePeriod(workload, speedups[i]);
+            }
+        }
+        workload.getKnob().setSpeedup(0);
+
+        Map<Double, Double> truth = new TreeMap<>();
+        truth.put(0.0, 0.0);
+        for (int i = 0; i < speedups.length; i++) {
+            truth.put(speedups[i], (baselinePeriod - periods[i]) / baselinePeriod);
+        }
+        return truth;
+    }
+
+    private static double measurePeriod(Workload workload, double speedup) throws InterruptedException {
+        workload.getKnob().setSpeedup(speedup);
+        Thread.sleep(measureMillis / 4);
+        long startCount = workload.getProgress().getCount();
+        long startNanos = System.nanoTime();
+        Thread.sleep(measureMillis);
+        long points = workload.getProgress().getCount() - startCount;
+        long elapsed = System.nanoTime() - startNanos;
+        return (double) elapsed / Math.max(points, 1);
+    }
+
+    private static List<Experiment> fetchExperiments(JCozProfilerMBean profiler) throws IOException {
+        List<Experiment> experiments = new ArrayList<>();
+        byte[] output = profiler.getProfilerOutput();
+        if (output.length == 0) {
+            return experiments;
+        }
+        ObjectInputStream ois = new ObjectInputStream(new ByteArrayInputStream(output));
+        int count = ois.readInt();
+        for (int i = 0; i < count; i++) {
+            experiments.add(Experiment.deserialize(ois));
+        }
+        return experiments;
+    }
+
+    private static boolean onTarget(Experiment exp, Knob knob) {
+        return exp.getLineNo() == knob.getLineNo() && exp.getClassSig().equals(knob.getClassName());
+    }
+
+    /**
+     * Mean absolute difference between JCoz's predicted curve for the
+     * target line and the measured one, at the measured speedups. NaN
+     * until there is a prediction for every one of them.
+     */
+    private static double predictionError(List<Experiment> experiments, Knob knob,
+            Map<Double, Double> truth, boolean print) {
+        List<Experiment> target = new ArrayList<>();
+        for (Experiment exp : experiments) {
+            if (onTarget(exp, knob)) {
+                target.add(exp);
+            }
+        }
+        if (target.isEmpty()) {
+            return Double.NaN;
+        }
+
+        TreeMap<Double, Double> predicted;
+        try {
+            predicted = new TreeMap<>(new LineSpeedup(knob.getLineNo(), target).getSpeedupMap());
+        } catch (InsufficientBaselineResultsException e) {
+            return Double.NaN;
+        }
+
+        double totalError = 0;
+        for (double speedup : speedups) {
+            double prediction = interpolate(predicted, speedup);
+            if (Double.isNaN(prediction)) {
+                return Double.NaN;
+            }
+            double error = Math.abs(prediction - truth.get(speedup));
+            if (print) {
+                System.out.printf("predicted: line speedup %.2f -> program speedup %.3f (error %.3f)%n",
+                        speedup, prediction, error);
+            }
+            totalError += error;
+        }
+        return totalError / speedups.length;
+    }
+
+    /**
+     * JCoz picks speedups in steps of 0.05, so there is seldom a result
+     * at exactly the speedup measured; interpolate between neighbours.
+     */
+    private static double interpolate(TreeMap<Double, Double> curve, double speedup) {
+        Map.Entry<Double, Double> below = curve.floorEntry(speedup);
+        Map.Entry<Double, Double> above = curve.ceilingEntry(speedup);
+        if (below == null || above == null) {
+            return Double.NaN;
+        }
+        if (above.getKey().equals(below.getKey())) {
+            return below.getValue();
+        }
+        double t = (speedup - below.getKey()) / (above.getKey() - below.getKey());
+        return below.getValue() + t * (above.getValue() - below.getValue());
+    }
+}
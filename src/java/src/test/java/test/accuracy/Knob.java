@@ -0,0 +1,75 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy;
+
+/**
+ * The line of a workload whose impact JCoz should predict, with a dial
+ * that really makes it faster. At speedup s the line does (1 - s) of its
+ * work, so measuring throughput across speedups gives the true impact
+ * curve to compare JCoz's virtual speedups against.
+ *
+ * A workload calls burn() from exactly one line, and nothing else may
+ * be on that line.
+ */
+public final class Knob {
+
+    private final long units;
+
+    private volatile double speedup = 0;
+
+    private volatile String className = null;
+
+    private volatile int lineNo = -1;
+
+    public Knob(long units) {
+        this.units = units;
+    }
+
+    /**
+     * do this line's work, scaled down by the current speedup
+     */
+    public void burn() {
+        if (lineNo < 0) {
+            locate();
+        }
+        Work.spin((long) (units * (1.0 - speedup)));
+    }
+
+    private synchronized void locate() {
+        StackTraceElement caller = Work.callerOfCaller();
+        className = Work.outerClassName(caller);
+        lineNo = caller.getLineNumber();
+    }
+
+    public void setSpeedup(double speedup) {
+        this.speedup = speedup;
+    }
+
+    /**
+     * class of the target line, null until burn() has run once
+     */
+    public String getClassName() {
+        return className;
+    }
+
+    /**
+     * the target line, -1 until burn() has run once
+     */
+    public int getLineNo() {
+        return lineNo;
+    }
+}
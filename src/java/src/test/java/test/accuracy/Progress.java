@@ -0,0 +1,59 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy;
+
+import java.util.concurrent.atomic.AtomicLong;
+
+/**
+ * A workload's progress point. The workload calls hit() from exactly one
+ * line each time it finishes a unit of work; JCoz sets its progress
+ * point on that line and the runner reads the counter to measure real
+ * throughput.
+ */
+public final class Progress {
+
+    private final AtomicLong count = new AtomicLong();
+
+    private volatile String className = null;
+
+    private volatile int lineNo = -1;
+
+    public void hit() {
+        if (lineNo < 0) {
+            locate();
+        }
+        count.incrementAndGet();
+    }
+
+    private synchronized void locate() {
+        StackTraceElement caller = Work.callerOfCaller();
+        className = Work.outerClassName(caller);
+        lineNo = caller.getLineNumber();
+    }
+
+    public long getCount() {
+        return count.get();
+    }
+
+    public String getClassName() {
+        return className;
+    }
+
+    public int getLineNo() {
+        return lineNo;
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy;
+
+/**
+ * CPU-bound busy work for the accuracy workloads. This lives outside the
+ * profiled package, so samples taken inside it are charged to the line
+ * in the workload that called it.
+ */
+public final class Work {
+
+    private static volatile long sink;
+
+    private Work() {
+    }
+
+    /**
+     * spin for the given number of units of work
+     */
+    public static void spin(long units) {
+        long sum = 0;
+        for (long i = 0; i < units; i++) {
+            sum += (i * 0x9E3779B97F4A7C15L) >>> 7;
+        }
+        sink += sum;
+    }
+
+    /**
+     * the source line that called the method calling this one, with any
+     * nested class suffix dropped the same way the agent reports it
+     */
+    static StackTraceElement callerOfCaller() {
+        return new Throwable().getStackTrace()[3];
+    }
+
+    static String outerClassName(StackTraceElement element) {
+        String className = element.getClassName();
+        int nested = className.indexOf('$');
+        return nested < 0 ? className : className.substring(0, nested);
+    }
+}
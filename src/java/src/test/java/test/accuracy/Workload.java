@@ -0,0 +1,80 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy;
+
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * A synthetic program with a known bottleneck. Subclasses start their
+ * threads in run(), do the target line's work through knob and report
+ * each finished unit of work through progress.
+ */
+public abstract class Workload {
+
+    protected final Knob knob;
+
+    protected final Progress progress = new Progress();
+
+    private volatile boolean running = false;
+
+    private final List<Thread> threads = new ArrayList<>();
+
+    protected Workload(long targetUnits) {
+        this.knob = new Knob(targetUnits);
+    }
+
+    public abstract String getName();
+
+    /**
+     * start the workload's threads, each looping while isRunning()
+     */
+    protected abstract void run();
+
+    public Knob getKnob() {
+        return knob;
+    }
+
+    public Progress getProgress() {
+        return progress;
+    }
+
+    protected boolean isRunning() {
+        return running;
+    }
+
+    protected void spawn(String name, Runnable body) {
+        Thread thread = new Thread(body, getName() + "-" + name);
+        thread.setDaemon(true);
+        threads.add(thread);
+        thread.start();
+    }
+
+    public void start() {
+        running = true;
+        run();
+    }
+
+    public void stop() throws InterruptedException {
+        running = false;
+        for (Thread thread : threads) {
+            thread.interrupt();
+            thread.join();
+        }
+        threads.clear();
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy.workloads;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+
+import test.accuracy.Work;
+import test.accuracy.Workload;
+
+/**
+ * Each round forks the target line out to a pool of equal tasks, joins
+ * them, then runs a serial phase. The target line only gates progress
+ * through the slowest task, and only while the parallel phase is
+ * running, so its impact depends on how many cores there are.
+ */
+public class ForkJoin extends Workload {
+
+    private static final long TARGET_UNITS = 2000000L;
+    private static final long SERIAL_UNITS = 1000000L;
+    private static final int NUM_TASKS = 4;
+
+    private ExecutorService executor;
+
+    public ForkJoin() {
+        super(TARGET_UNITS);
+    }
+
+    public String getName() {
+        return "fork-join";
+    }
+
+    protected void run() {
+        executor = Executors.newFixedThreadPool(NUM_TASKS);
+        final List<Callable<Void>> tasks = new ArrayList<>();
+        for (int i = 0; i < NUM_TASKS; i++) {
+            tasks.add(() -> {
+                knob.burn();
+                return null;
+            });
+        }
+        spawn("main", () -> {
+            try {
+                while (isRunning()) {
+                    executor.invokeAll(tasks);
+                    Work.spin(SERIAL_UNITS);
+                    progress.hit();
+                }
+            } catch (InterruptedException e) {
+                // stopped
+            }
+        });
+    }
+
+    public void stop() throws InterruptedException {
+        super.stop();
+        executor.shutdownNow();
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy.workloads;
+
+import test.accuracy.Work;
+import test.accuracy.Workload;
+
+/**
+ * Several threads contend for one lock, and the target line is the
+ * critical section. Throughput is set by the time spent holding the
+ * lock, so the program speeds up almost one for one with the line.
+ */
+public class LockBound extends Workload {
+
+    private static final long TARGET_UNITS = 1000000L;
+    private static final long OUTSIDE_UNITS = 1000000L;
+    private static final int NUM_THREADS = 4;
+
+    private final Object lock = new Object();
+
+    public LockBound() {
+        super(TARGET_UNITS);
+    }
+
+    public String getName() {
+        return "lock-bound";
+    }
+
+    protected void run() {
+        for (int i = 0; i < NUM_THREADS; i++) {
+            spawn("worker-" + i, () -> {
+                while (isRunning()) {
+                    Work.spin(OUTSIDE_UNITS);
+                    synchronized (lock) {
+                        knob.burn();
+                    }
+                    progress.hit();
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy.workloads;
+
+import test.accuracy.Work;
+import test.accuracy.Workload;
+
+/**
+ * The target line runs on a background thread that nothing waits for,
+ * so speeding it up should not change throughput at all (given a spare
+ * core for it to run on).
+ */
+public class NoEffect extends Workload {
+
+    private static final long TARGET_UNITS = 500000L;
+    private static final long MAIN_UNITS = 2000000L;
+
+    public NoEffect() {
+        super(TARGET_UNITS);
+    }
+
+    public String getName() {
+        return "no-effect";
+    }
+
+    protected void run() {
+        spawn("main", () -> {
+            while (isRunning()) {
+                Work.spin(MAIN_UNITS);
+                progress.hit();
+            }
+        });
+        spawn("background", () -> {
+            try {
+                while (isRunning()) {
+                    knob.burn();
+                    Thread.sleep(2);
+                }
+            } catch (InterruptedException e) {
+                // stopped
+            }
+        });
+    }
+}
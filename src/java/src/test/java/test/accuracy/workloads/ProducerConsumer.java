@@ -0,0 +1,72 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy.workloads;
+
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+
+import test.accuracy.Work;
+import test.accuracy.Workload;
+
+/**
+ * One producer doing the target line feeds two consumers through a
+ * bounded queue. The producer is the bottleneck until it is about a
+ * quarter faster; past that the consumers are, so the impact curve
+ * flattens out.
+ */
+public class ProducerConsumer extends Workload {
+
+    private static final long TARGET_UNITS = 2000000L;
+    private static final long CONSUMER_UNITS = 3000000L;
+    private static final int NUM_CONSUMERS = 2;
+
+    private final BlockingQueue<Integer> queue = new ArrayBlockingQueue<>(16);
+
+    public ProducerConsumer() {
+        super(TARGET_UNITS);
+    }
+
+    public String getName() {
+        return "producer-consumer";
+    }
+
+    protected void run() {
+        spawn("producer", () -> {
+            try {
+                while (isRunning()) {
+                    knob.burn();
+                    queue.put(1);
+                }
+            } catch (InterruptedException e) {
+                // stopped
+            }
+        });
+        for (int i = 0; i < NUM_CONSUMERS; i++) {
+            spawn("consumer-" + i, () -> {
+                try {
+                    while (isRunning()) {
+                        queue.take();
+                        Work.spin(CONSUMER_UNITS);
+                        progress.hit();
+                    }
+                } catch (InterruptedException e) {
+                    // stopped
+                }
+            });
+        }
+    }
+}
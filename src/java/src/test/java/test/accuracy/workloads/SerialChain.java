@@ -0,0 +1,49 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy.workloads;
+
+import test.accuracy.Work;
+import test.accuracy.Workload;
+
+/**
+ * One thread doing the target line and an equal amount of other work in
+ * sequence. Speeding the target line up by s should speed the program
+ * up by about s / 2.
+ */
+public class SerialChain extends Workload {
+
+    private static final long TARGET_UNITS = 2000000L;
+    private static final long OTHER_UNITS = 2000000L;
+
+    public SerialChain() {
+        super(TARGET_UNITS);
+    }
+
+    public String getName() {
+        return "serial";
+    }
+
+    protected void run() {
+        spawn("main", () -> {
+            while (isRunning()) {
+                knob.burn();
+                Work.spin(OTHER_UNITS);
+                progress.hit();
+            }
+        });
+    }
+}
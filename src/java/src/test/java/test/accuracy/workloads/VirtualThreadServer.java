@@ -0,0 +1,118 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.accuracy.workloads;
+
+import java.lang.reflect.Method;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Semaphore;
+import java.util.concurrent.locks.ReentrantLock;
+
+import test.accuracy.Work;
+import test.accuracy.Workload;
+
+/**
+ * A server that handles each request on its own virtual thread. A
+ * handler parses the request, waits on a backend call, then appends to
+ * a shared log under a lock, which is the target line. The backend wait
+ * unmounts the handler, so it usually finishes on another carrier than
+ * it started on, and its delay debt has to follow it there. The log is
+ * the bottleneck, so the program speeds up almost one for one with the
+ * line, as in lock-bound.
+ *
+ * Needs JDK 21; the executor is looked up reflectively so the suite
+ * still builds on older JDKs, where this workload is left out.
+ */
+public class VirtualThreadServer extends Workload {
+
+    private static final long TARGET_UNITS = 500000L;
+    private static final long PARSE_UNITS = 500000L;
+    private static final long BACKEND_MILLIS = 2;
+    private static final int IN_FLIGHT = 64;
+
+    private static final Method NEW_EXECUTOR = findExecutorFactory();
+
+    private final ReentrantLock log = new ReentrantLock();
+
+    private final Semaphore inFlight = new Semaphore(IN_FLIGHT);
+
+    private ExecutorService executor;
+
+    public VirtualThreadServer() {
+        super(TARGET_UNITS);
+    }
+
+    public static boolean isSupported() {
+        return NEW_EXECUTOR != null;
+    }
+
+    private static Method findExecutorFactory() {
+        try {
+            return Executors.class.getMethod("newVirtualThreadPerTaskExecutor");
+        } catch (NoSuchMethodException e) {
+            return null;
+        }
+    }
+
+    public String getName() {
+        return "virtual-thread-server";
+    }
+
+    protected void run() {
+        try {
+            executor = (ExecutorService) NEW_EXECUTOR.invoke(null);
+        } catch (ReflectiveOperationException e) {
+            throw new IllegalStateException("Cannot create a virtual thread executor", e);
+        }
+        // Accepts requests as fast as handlers free up.
+        spawn("acceptor", () -> {
+            try {
+                while (isRunning()) {
+                    inFlight.acquire();
+                    executor.execute(this::handle);
+                }
+            } catch (InterruptedException e) {
+                // stopped
+            }
+        });
+    }
+
+    private void handle() {
+        try {
+            Work.spin(PARSE_UNITS);
+            Thread.sleep(BACKEND_MILLIS);
+            // ReentrantLock rather than synchronized, which would pin the
+            // handler to its carrier.
+            log.lock();
+            try {
+                knob.burn();
+            } finally {
+                log.unlock();
+            }
+            progress.hit();
+        } catch (InterruptedException e) {
+            // stopped
+        } finally {
+            inFlight.release();
+        }
+    }
+
+    public void stop() throws InterruptedException {
+        super.stop();
+        executor.shutdownNow();
+    }
+}
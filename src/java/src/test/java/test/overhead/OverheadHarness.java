@@ -0,0 +1,236 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.overhead;
+
+import java.io.BufferedReader;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStreamReader;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Map;
+
+/**
+ * Measures how much the agent slows an application down. Every
+ * workload in OverheadWorkload is run in a fresh JVM in each of these
+ * configurations:
+ *
+ *   none          no agent
+ *   loaded        agent loaded, profiling never started
+ *   profiling     agent loaded and profiling (sampling and experiments)
+ *   none-high     no agent, --high-threads threads
+ *   high-threads  agent loaded and profiling, --high-threads threads
+ *
+ * Runs are repeated and interleaved across configurations so that drift
+ * in the machine is spread evenly. For each configuration the harness
+ * prints the throughput loss against its no-agent baseline with a 95%
+ * confidence interval, and exits with status 1 if a loss is larger than
+ * its threshold (--max-idle-overhead for loaded, --max-profiling-overhead
+ * for the profiling configurations, both in percent).
+ *
+ * Run through make overhead.
+ */
+public class OverheadHarness {
+
+    private static String agentPath = null;
+    private static List<String> workloads = Arrays.asList("cpu", "alloc", "threads");
+    private static int threads = Runtime.getRuntime().availableProcessors();
+    private static int highThreads = 256;
+    private static int repeats = 5;
+    private static int warmupSeconds = 3;
+    private static int measureSeconds = 10;
+    private static double maxIdleOverhead = 2;
+    private static double maxProfilingOverhead = 10;
+
+    // Two-sided 95% Student's t quantiles for 1 to 30 degrees of freedom.
+    private static final double[] T_95 = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+
+    private static class Config {
+        final String name;
+        final boolean agent;
+        final boolean profile;
+        final boolean high;
+        final String baseline;
+        final List<Double> throughputs = new ArrayList<>();
+
+        Config(String name, boolean agent, boolean profile, boolean high, String baseline) {
+            this.name = name;
+            this.agent = agent;
+            this.profile = profile;
+            this.high = high;
+            this.baseline = baseline;
+        }
+
+        int threads() {
+            return high ? highThreads : threads;
+        }
+
+        double maxOverhead() {
+            return profile ? maxProfilingOverhead : maxIdleOverhead;
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        for (String arg : args) {
+            String value = arg.substring(arg.indexOf('=') + 1);
+            if (arg.startsWith("--agent=")) {
+                agentPath = new File(value).getAbsolutePath();
+            } else if (arg.startsWith("--workloads=")) {
+                workloads = Arrays.asList(value.split(","));
+            } else if (arg.startsWith("--threads=")) {
+                threads = Integer.parseInt(value);
+            } else if (arg.startsWith("--high-threads=")) {
+                highThreads = Integer.parseInt(value);
+            } else if (arg.startsWith("--repeats=")) {
+                repeats = Integer.parseInt(value);
+            } else if (arg.startsWith("--warmup-seconds=")) {
+                warmupSeconds = Integer.parseInt(value);
+            } else if (arg.startsWith("--measure-seconds=")) {
+                measureSeconds = Integer.parseInt(value);
+            } else if (arg.startsWith("--max-idle-overhead=")) {
+                maxIdleOverhead = Double.parseDouble(value);
+            } else if (arg.startsWith("--max-profiling-overhead=")) {
+                maxProfilingOverhead = Double.parseDouble(value);
+            } else {
+                usage();
+            }
+        }
+        if (agentPath == null || repeats < 2) {
+            usage();
+        }
+
+        boolean failed = false;
+        System.out.println("workload\tconfig\tthreads\tops_per_s\toverhead_pct\tci95_pct\tverdict");
+        for (String workload : workloads) {
+            Map<String, Config> configs = new LinkedHashMap<>();
+            configs.put("none", new Config("none", false, false, false, null));
+            configs.put("loaded", new Config("loaded", true, false, false, "none"));
+            configs.put("profiling", new Config("profiling", true, true, false, "none"));
+            configs.put("none-high", new Config("none-high", false, false, true, null));
+            configs.put("high-threads", new Config("high-threads", true, true, true, "none-high"));
+
+            for (int r = 0; r < repeats; r++) {
+                for (Config config : configs.values()) {
+                    config.throughputs.add(run(workload, config));
+                }
+            }
+
+            for (Config config : configs.values()) {
+                failed |= report(workload, config,
+                        config.baseline == null ? null : configs.get(config.baseline));
+            }
+        }
+        System.exit(failed ? 1 : 0);
+    }
+
+    private static void usage() {
+        System.err.println("usage: java test.overhead.OverheadHarness --agent=<liblagent.so>"
+                + " [--workloads=cpu,alloc,threads] [--threads=<n>] [--high-threads=<n>]"
+                + " [--repeats=<n, at least 2>] [--warmup-seconds=<n>] [--measure-seconds=<n>]"
+                + " [--max-idle-overhead=<pct>] [--max-profiling-overhead=<pct>]");
+        System.exit(2);
+    }
+
+    private static double run(String workload, Config config) throws IOException, InterruptedException {
+        List<String> command = new ArrayList<>();
+        command.add(System.getProperty("java.home") + File.separator + "bin" + File.separator + "java");
+        if (config.agent) {
+            command.add("-agentpath:" + agentPath);
+        }
+        command.add("-cp");
+        command.add(System.getProperty("java.class.path"));
+        command.add(OverheadWorkload.class.getName());
+        command.add(workload);
+        command.add(Integer.toString(config.threads()));
+        command.add(Integer.toString(warmupSeconds));
+        command.add(Integer.toString(measureSeconds));
+        if (config.profile) {
+            command.add("--profile");
+        }
+
+        Process process = new ProcessBuilder(command)
+            .redirectError(ProcessBuilder.Redirect.INHERIT)
+            .start();
+        Double throughput = null;
+        try (BufferedReader reader = new BufferedReader(new InputStreamReader(process.getInputStream()))) {
+            String line;
+            while ((line = reader.readLine()) != null) {
+                if (line.startsWith("throughput ")) {
+                    throughput = Double.parseDouble(line.substring("throughput ".length()));
+                }
+            }
+        }
+        int status = process.waitFor();
+        if (status != 0 || throughput == null) {
+            throw new IOException(workload + "/" + config.name + " run failed with status " + status);
+        }
+        return throughput;
+    }
+
+    private static double mean(List<Double> values) {
+        double sum = 0;
+        for (double value : values) {
+            sum += value;
+        }
+        return sum / values.size();
+    }
+
+    private static double variance(List<Double> values) {
+        double mean = mean(values);
+        double sum = 0;
+        for (double value : values) {
+            sum += (value - mean) * (value - mean);
+        }
+        return sum / (values.size() - 1);
+    }
+
+    /**
+     * Print one result line and return whether it breaks its threshold.
+     * The interval is for the ratio of the means, from the first-order
+     * (delta method) variance of each mean relative to its size.
+     */
+    private static boolean report(String workload, Config config, Config baseline) {
+        double mean = mean(config.throughputs);
+        if (baseline == null) {
+            System.out.printf("%s\t%s\t%d\t%.1f\t-\t-\tbaseline%n",
+                    workload, config.name, config.threads(), mean);
+            return false;
+        }
+
+        double baseMean = mean(baseline.throughputs);
+        double ratio = mean / baseMean;
+        double relVariance = variance(config.throughputs) / (config.throughputs.size() * mean * mean)
+            + variance(baseline.throughputs) / (baseline.throughputs.size() * baseMean * baseMean);
+        int df = config.throughputs.size() + baseline.throughputs.size() - 2;
+        double t = T_95[Math.min(df, T_95.length) - 1];
+        double halfWidth = t * ratio * Math.sqrt(relVariance);
+
+        double overhead = (1 - ratio) * 100;
+        boolean failed = overhead > config.maxOverhead();
+        System.out.printf("%s\t%s\t%d\t%.1f\t%.2f\t[%.2f, %.2f]\t%s%n",
+                workload, config.name, config.threads(), mean, overhead,
+                overhead - halfWidth * 100, overhead + halfWidth * 100,
+                failed ? "FAIL (max " + config.maxOverhead() + ")" : "ok");
+        return failed;
+    }
+}
@@ -0,0 +1,172 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+package test.overhead;
+
+import java.lang.management.ManagementFactory;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.ThreadLocalRandom;
+
+import javax.management.JMX;
+
+import jcoz.agent.JCozProfiler;
+import jcoz.agent.JCozProfilerMBean;
+import test.accuracy.Progress;
+
+/**
+ * One run of an overhead workload, started by OverheadHarness in a JVM
+ * of its own. Runs the workload on the given number of threads, warms
+ * up, then prints the throughput seen over the measurement window as
+ * "throughput <ops per second>".
+ *
+ * usage: java test.overhead.OverheadWorkload cpu|alloc|threads
+ *     <threads> <warmup seconds> <measure seconds> [--profile]
+ *
+ * With --profile the workload profiles itself through the in-process
+ * JCozProfiler MBean from the end of warmup, so the agent must be
+ * loaded.
+ */
+public class OverheadWorkload {
+
+    private static final String SCOPE = "test/overhead";
+
+    private static final Progress progress = new Progress();
+
+    private static volatile boolean running = true;
+
+    private static volatile long sink;
+
+    public static void main(String[] args) throws Exception {
+        if (args.length < 4) {
+            System.err.println("usage: java test.overhead.OverheadWorkload cpu|alloc|threads"
+                    + " <threads> <warmup seconds> <measure seconds> [--profile]");
+            System.exit(1);
+        }
+        final String workload = args[0];
+        int numThreads = Integer.parseInt(args[1]);
+        long warmupMillis = Long.parseLong(args[2]) * 1000;
+        long measureMillis = Long.parseLong(args[3]) * 1000;
+        boolean profile = args.length > 4 && args[4].equals("--profile");
+
+        List<Thread> threads = new ArrayList<>();
+        for (int i = 0; i < numThreads; i++) {
+            Thread thread = new Thread(() -> {
+                while (running) {
+                    runOp(workload);
+                    progress.hit();
+                }
+            });
+            thread.setDaemon(true);
+            threads.add(thread);
+            thread.start();
+        }
+
+        Thread.sleep(warmupMillis);
+
+        JCozProfilerMBean profiler = null;
+        if (profile) {
+            profiler = JMX.newMBeanProxy(ManagementFactory.getPlatformMBeanServer(),
+                    JCozProfiler.getMBeanName(), JCozProfilerMBean.class);
+            profiler.setScope(SCOPE);
+            profiler.setProgressPoint(progress.getClassName(), progress.getLineNo());
+            profiler.startProfiling();
+        }
+
+        long startCount = progress.getCount();
+        long startNanos = System.nanoTime();
+        long deadline = System.currentTimeMillis() + measureMillis;
+        while (System.currentTimeMillis() < deadline) {
+            Thread.sleep(1000);
+            if (profiler != null) {
+                // keep the profiler from ending itself for inactivity
+                profiler.getProfilerOutput();
+            }
+        }
+        long ops = progress.getCount() - startCount;
+        double seconds = (System.nanoTime() - startNanos) / 1e9;
+
+        running = false;
+        if (profiler != null) {
+            profiler.endProfiling();
+        }
+        System.out.println("throughput " + (ops / seconds));
+        System.exit(0);
+    }
+
+    private static void runOp(String workload) {
+        switch (workload) {
+            case "cpu":
+                cpuOp();
+                break;
+            case "alloc":
+                allocOp();
+                break;
+            case "threads":
+                threadsOp();
+                break;
+            default:
+                throw new IllegalArgumentException("unknown workload " + workload);
+        }
+    }
+
+    /**
+     * pure arithmetic, no allocation or synchronization
+     */
+    private static void cpuOp() {
+        long sum = 0;
+        for (long i = 0; i < 200000; i++) {
+            sum += (i * 0x9E3779B97F4A7C15L) >>> 11;
+        }
+        sink += sum;
+    }
+
+    /**
+     * short-lived garbage of mixed sizes, with a few survivors so the
+     * collector has some real work
+     */
+    private static void allocOp() {
+        ThreadLocalRandom random = ThreadLocalRandom.current();
+        List<byte[]> kept = new ArrayList<>();
+        for (int i = 0; i < 2000; i++) {
+            byte[] block = new byte[16 + random.nextInt(1024)];
+            if (i % 100 == 0) {
+                kept.add(block);
+            }
+        }
+        sink += kept.size();
+    }
+
+    /**
+     * start and join a handful of short threads, which exercises the
+     * agent's thread start and end callbacks
+     */
+    private static void threadsOp() {
+        Thread[] children = new Thread[4];
+        for (int i = 0; i < children.length; i++) {
+            children[i] = new Thread(OverheadWorkload::cpuOp);
+            children[i].start();
+        }
+        for (Thread child : children) {
+            try {
+                child.join();
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,517 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Microbenchmarks for the agent's hot paths.  This links against the
+// agent objects and drives them without a JVM: AsyncGetCallTrace and
+// the jvmtiEnv are stubbed out below.
+//
+// Every result is printed as one JSON object per line so that runs from
+// different commits can be diffed or loaded into a spreadsheet:
+//
+//   make bench > before.json
+//
+// Usage: jcoz-bench [--quick] [--filter=<substring of bench name>]
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "governor.h"
+#include "profiler.h"
+
+extern thread_local struct UserThread *curr_ut;
+
+// In-scope methods the lookup benchmarks register, and the depth of
+// the stacks the stub AsyncGetCallTrace hands back.
+static const int kBenchMethods = 1000;
+static const int kBenchDepth = 64;
+
+static const int kThreadCounts[] = {1, 2, 4, 8};
+static const int kNumThreadCounts = sizeof(kThreadCounts) / sizeof(int);
+
+static bool quick = false;
+static std::string filter;
+
+// Fake jmethodIDs; the agent only ever compares them.
+static jmethodID FakeMethod(int i) {
+  return reinterpret_cast<jmethodID>((uintptr_t) (i + 1) * 16);
+}
+
+// A stack of kBenchDepth frames where every fourth frame is in scope.
+static void FillStack(JVMPI_CallFrame *frames, int depth) {
+  for (int i = 0; i < depth; i++) {
+    frames[i].lineno = i;
+    frames[i].method_id = FakeMethod(i % 4 == 3 ? i : kBenchMethods + i);
+  }
+}
+
+static void StubAsgct(JVMPI_CallTrace *trace, jint depth, void *context) {
+  IMPLICITLY_USE(context);
+  int frames = depth < kBenchDepth ? depth : kBenchDepth;
+  FillStack(trace->frames, frames);
+  trace->num_frames = frames;
+}
+
+// Anything that reaches for a JVMTI function crashes on the NULL entry,
+// which is what we want: none of the paths measured here may call it.
+static jvmtiInterface_1 stub_jvmti_functions;
+static jvmtiEnv stub_jvmti;
+
+static long Iterations(long iterations) {
+  return quick ? std::max(iterations / 10, 1L) : iterations;
+}
+
+static bool Selected(const char *name) {
+  return filter.empty() || strstr(name, filter.c_str()) != NULL;
+}
+
+static void Report(const char *name, int threads, long ops, double ns_per_op,
+    const std::string &extra) {
+  printf("{\"bench\":\"%s\",\"threads\":%d,\"ops\":%ld,\"ns_per_op\":%.2f%s}\n",
+      name, threads, ops, ns_per_op, extra.c_str());
+  fflush(stdout);
+}
+
+// Keeps the compiler from dropping a computation whose result is unused.
+template <typename T>
+static inline void KeepAlive(const T &value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct Worker {
+  pthread_t thread;
+  void (*body)(Worker *);
+  pthread_barrier_t *barrier;
+  long iterations;
+  uint64_t elapsed_ns;
+  long counter;
+};
+
+static void *RunWorker(void *arg) {
+  Worker *worker = static_cast<Worker *>(arg);
+  pthread_barrier_wait(worker->barrier);
+  uint64_t start = ProfilerStats::Now();
+  worker->body(worker);
+  worker->elapsed_ns = ProfilerStats::Now() - start;
+  return NULL;
+}
+
+// Runs body on the given number of threads at once and returns the mean
+// per-operation latency seen by each thread.
+static double RunThreads(int threads, long iterations, void (*body)(Worker *)) {
+  std::vector<Worker> workers(threads);
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, threads);
+  for (int i = 0; i < threads; i++) {
+    workers[i].body = body;
+    workers[i].barrier = &barrier;
+    workers[i].iterations = iterations;
+    workers[i].elapsed_ns = 0;
+    workers[i].counter = 0;
+    pthread_create(&workers[i].thread, NULL, &RunWorker, &workers[i]);
+  }
+  double total = 0;
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    total += (double) workers[i].elapsed_ns / iterations;
+  }
+  pthread_barrier_destroy(&barrier);
+  return total / threads;
+}
+
+class ProfilerBench {
+  public:
+    static void Setup() {
+      memset(&stub_jvmti_functions, 0, sizeof(stub_jvmti_functions));
+      stub_jvmti.functions = &stub_jvmti_functions;
+      Profiler::jvmti = &stub_jvmti;
+      Asgct::SetAsgct(&StubAsgct);
+
+      std::vector<jmethodID> methods;
+      for (int i = 0; i < kBenchMethods; i++) {
+        methods.push_back(FakeMethod(i * 4 + 3));
+      }
+      Profiler::addInScopeMethods(kBenchMethods, &methods[0]);
+      FrameScan::Init();
+
+      static std::pair<jint, jint> ranges[8];
+      for (int i = 0; i < 8; i++) {
+        ranges[i] = std::make_pair(i * 8, i * 8 + 4);
+      }
+      Profiler::current_experiment.method_id = FakeMethod(kBenchMethods);
+      Profiler::current_experiment.location_ranges = ranges;
+      Profiler::current_experiment.num_ranges = 8;
+      Profiler::current_experiment.delay = 0;
+    }
+
+    static void FrameInScope(Worker *worker) {
+      JVMPI_CallFrame frames[kBenchDepth];
+      FillStack(frames, kBenchDepth);
+      long hits = 0;
+      for (long i = 0; i < worker->iterations; i++) {
+        hits += Profiler::frameInScope(frames[i % kBenchDepth]);
+      }
+      worker->counter = hits;
+      KeepAlive(hits);
+    }
+
+    static void InExperiment(Worker *worker) {
+      // Half the frames are in the experiment's method, spread over
+      // its line ranges and the gaps between them.
+      JVMPI_CallFrame frames[kBenchDepth];
+      for (int i = 0; i < kBenchDepth; i++) {
+        frames[i].lineno = i;
+        frames[i].method_id = FakeMethod(i % 2 == 0 ? kBenchMethods : i);
+      }
+      long hits = 0;
+      for (long i = 0; i < worker->iterations; i++) {
+        hits += Profiler::inExperiment(frames[i % kBenchDepth]);
+      }
+      worker->counter = hits;
+      KeepAlive(hits);
+    }
+
+    // A deep stack with nothing in scope but its outermost frame, the
+    // way framework-heavy services look.
+    static void FillDeepStack(JVMPI_CallFrame *frames) {
+      for (int i = 0; i < kMaxFramesToCapture; i++) {
+        frames[i].lineno = i;
+        frames[i].method_id = FakeMethod(4 * kBenchMethods + i);
+      }
+      frames[kMaxFramesToCapture - 1].method_id = FakeMethod(kBenchMethods);
+      frames[kMaxFramesToCapture - 1].lineno = 2;
+    }
+
+    static void ScopeFilter(Worker *worker) {
+      JVMPI_CallFrame frames[kMaxFramesToCapture];
+      FillDeepStack(frames);
+      long passed = 0;
+      for (long i = 0; i < worker->iterations; i++) {
+        for (int f = 0; f < kMaxFramesToCapture; f++) {
+          passed += Profiler::in_scope_filter.MayContain(frames[f].method_id);
+        }
+      }
+      worker->counter = passed;
+      KeepAlive(passed);
+    }
+
+    static void ExperimentScan(Worker *worker) {
+      JVMPI_CallFrame frames[kMaxFramesToCapture];
+      FillDeepStack(frames);
+      JVMPI_CallTrace trace;
+      trace.frames = frames;
+      trace.num_frames = kMaxFramesToCapture;
+      long hits = 0;
+      for (long i = 0; i < worker->iterations; i++) {
+        hits += Profiler::traceInExperiment(trace);
+        KeepAlive(frames);
+      }
+      worker->counter = hits;
+      KeepAlive(hits);
+    }
+
+    // Counting a trace that is already in the table, the common case
+    // once a run has warmed up.
+    static void TraceAdd(Worker *worker) {
+      JVMPI_CallFrame frames[kMaxFramesToCapture];
+      FillDeepStack(frames);
+      JVMPI_CallTrace trace;
+      trace.frames = frames;
+      trace.num_frames = kMaxFramesToCapture;
+      long added = 0;
+      for (long i = 0; i < worker->iterations; i++) {
+        added += Profiler::traces.Add(trace);
+        KeepAlive(frames);
+      }
+      worker->counter = added;
+      KeepAlive(added);
+    }
+
+    // The whole signal handler, called directly rather than through a
+    // signal, outside of an experiment.
+    static void Handle(Worker *worker) {
+      Accessors::SetCurrentJniEnv(reinterpret_cast<JNIEnv *>(worker));
+      curr_ut = UserThreadSlab::Acquire();
+      for (long i = 0; i < worker->iterations; i++) {
+        Profiler::Handle(SIGPROF, NULL, NULL);
+      }
+      UserThreadSlab::Release(curr_ut);
+      curr_ut = NULL;
+      Accessors::SetCurrentJniEnv(NULL);
+    }
+
+    static void SpinLock(Worker *worker) {
+      static volatile int lock = 0;
+      static long shared_counter = 0;
+      struct ThreadStats *stats = ProfilerStats::Shared();
+      for (long i = 0; i < worker->iterations; i++) {
+        spin_lock(&lock, 1, stats);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        shared_counter++;
+        std::atomic_thread_fence(std::memory_order_release);
+        lock = 0;
+      }
+      KeepAlive(shared_counter);
+    }
+
+    static void SetProfReady(bool ready) { Profiler::prof_ready = ready; }
+
+    static void SignalUserThreads() { Profiler::signal_user_threads(); }
+
+    static struct sigaction InstallHandler(SignalHandler *handler) {
+      return handler->SetAction(&Profiler::Handle);
+    }
+};
+
+static void BenchLookups() {
+  static const struct {
+    const char *name;
+    void (*body)(Worker *);
+  } benches[] = {
+    {"frame_in_scope", &ProfilerBench::FrameInScope},
+    {"in_experiment", &ProfilerBench::InExperiment},
+  };
+  for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+    if (!Selected(benches[b].name)) {
+      continue;
+    }
+    long iterations = Iterations(20000000);
+    for (int t = 0; t < kNumThreadCounts; t++) {
+      double ns = RunThreads(kThreadCounts[t], iterations, benches[b].body);
+      Report(benches[b].name, kThreadCounts[t], iterations, ns, "");
+    }
+  }
+}
+
+// Whole-stack scans over kMaxFramesToCapture frames, one per op.
+static void BenchStackScans() {
+  static const struct {
+    const char *name;
+    void (*body)(Worker *);
+  } benches[] = {
+    {"scope_filter", &ProfilerBench::ScopeFilter},
+    {"experiment_scan", &ProfilerBench::ExperimentScan},
+    {"trace_add", &ProfilerBench::TraceAdd},
+  };
+  for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+    if (!Selected(benches[b].name)) {
+      continue;
+    }
+    long iterations = Iterations(1000000);
+    double ns = RunThreads(1, iterations, benches[b].body);
+    char extra[64];
+    snprintf(extra, sizeof(extra), ",\"frames\":%d,\"isa\":\"%s\"",
+        kMaxFramesToCapture, FrameScan::Isa());
+    Report(benches[b].name, 1, iterations, ns, extra);
+  }
+}
+
+static void BenchHandle() {
+  if (!Selected("handle")) {
+    return;
+  }
+  ProfilerBench::SetProfReady(true);
+  long iterations = Iterations(200000);
+  for (int t = 0; t < kNumThreadCounts; t++) {
+    double ns = RunThreads(kThreadCounts[t], iterations, &ProfilerBench::Handle);
+    char extra[64];
+    snprintf(extra, sizeof(extra), ",\"depth\":%d", kBenchDepth);
+    Report("handle", kThreadCounts[t], iterations, ns, extra);
+  }
+  ProfilerBench::SetProfReady(false);
+}
+
+static void BenchSpinLock() {
+  if (!Selected("spin_lock")) {
+    return;
+  }
+  long iterations = Iterations(2000000);
+  for (int t = 0; t < kNumThreadCounts; t++) {
+    uint64_t waited = ProfilerStats::Shared()->spin_wait_ns.Get();
+    double ns = RunThreads(kThreadCounts[t], iterations, &ProfilerBench::SpinLock);
+    waited = ProfilerStats::Shared()->spin_wait_ns.Get() - waited;
+    char extra[64];
+    snprintf(extra, sizeof(extra), ",\"spin_wait_ns\":%llu",
+        (unsigned long long) waited);
+    Report("spin_lock", kThreadCounts[t], iterations, ns, extra);
+  }
+}
+
+// Idle application threads for signal_user_threads to signal.  Each
+// holds a slab slot and parks until released.
+static pthread_mutex_t park_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+static bool park_release = false;
+static int parked = 0;
+
+static void *Park(void *arg) {
+  IMPLICITLY_USE(arg);
+  curr_ut = UserThreadSlab::Acquire();
+  pthread_mutex_lock(&park_mutex);
+  parked++;
+  pthread_cond_broadcast(&park_cond);
+  while (!park_release) {
+    pthread_cond_wait(&park_cond, &park_mutex);
+  }
+  pthread_mutex_unlock(&park_mutex);
+  UserThreadSlab::Release(curr_ut);
+  curr_ut = NULL;
+  return NULL;
+}
+
+static void BenchSignalUserThreads() {
+  if (!Selected("signal_user_threads")) {
+    return;
+  }
+
+  // The real handler, which returns straight away until profiling is
+  // ready, so this measures the agent side of a round.
+  SignalHandler handler;
+  struct sigaction old_action = ProfilerBench::InstallHandler(&handler);
+
+  static const int counts[] = {10, 100, 1000, 10000};
+  int num_counts = quick ? 3 : 4;
+  for (int c = 0; c < num_counts; c++) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    std::vector<pthread_t> threads;
+    park_release = false;
+    parked = 0;
+    for (int i = 0; i < counts[c]; i++) {
+      pthread_t thread;
+      if (pthread_create(&thread, &attr, &Park, NULL) != 0) {
+        break;
+      }
+      threads.push_back(thread);
+    }
+    pthread_attr_destroy(&attr);
+
+    pthread_mutex_lock(&park_mutex);
+    while (parked < (int) threads.size()) {
+      pthread_cond_wait(&park_cond, &park_mutex);
+    }
+    pthread_mutex_unlock(&park_mutex);
+
+    long rounds = Iterations(200);
+    uint64_t start = ProfilerStats::Now();
+    for (long r = 0; r < rounds; r++) {
+      ProfilerBench::SignalUserThreads();
+    }
+    double ns = (double) (ProfilerStats::Now() - start) / rounds;
+
+    // What the governor pays once a second to measure the overhead,
+    // which grows with the number of slots.
+    start = ProfilerStats::Now();
+    for (long r = 0; r < rounds; r++) {
+      OverheadGovernor::Reset();
+    }
+    double governor_ns = (double) (ProfilerStats::Now() - start) / rounds;
+
+    pthread_mutex_lock(&park_mutex);
+    park_release = true;
+    pthread_cond_broadcast(&park_cond);
+    pthread_mutex_unlock(&park_mutex);
+    for (size_t i = 0; i < threads.size(); i++) {
+      pthread_join(threads[i], NULL);
+    }
+
+    // "threads" is how many we managed to start; it can fall short of
+    // "requested" under a low ulimit -u.
+    char extra[128];
+    snprintf(extra, sizeof(extra),
+        ",\"requested\":%d,\"ns_per_thread\":%.2f,\"governor_ns\":%.0f",
+        counts[c], threads.empty() ? 0.0 : ns / threads.size(), governor_ns);
+    Report("signal_user_threads", (int) threads.size(), rounds, ns, extra);
+  }
+
+  sigaction(SIGPROF, &old_action, NULL);
+}
+
+static void BenchSleep() {
+  if (!Selected("jcoz_sleep")) {
+    return;
+  }
+  static const struct {
+    long nanos;
+    long samples;
+  } requests[] = {
+    {1000L, 200},
+    {10000L, 200},
+    {100000L, 100},
+    {1000000L, 50},
+    {10000000L, 10},
+    // Longer than a second, which nanosleep only takes split up.
+    {1100000000L, 1},
+  };
+  int num_requests = sizeof(requests) / sizeof(requests[0]);
+  if (quick) {
+    num_requests--;
+  }
+  for (int i = 0; i < num_requests; i++) {
+    long samples = Iterations(requests[i].samples);
+    double total = 0;
+    long max_overshoot = 0;
+    for (long s = 0; s < samples; s++) {
+      long actual = jcoz_sleep(requests[i].nanos);
+      total += actual;
+      max_overshoot = std::max(max_overshoot, actual - requests[i].nanos);
+    }
+    double mean = total / samples;
+    char extra[160];
+    snprintf(extra, sizeof(extra),
+        ",\"requested_ns\":%ld,\"mean_overshoot_ns\":%.2f,\"max_overshoot_ns\":%ld",
+        requests[i].nanos, mean - requests[i].nanos, max_overshoot);
+    Report("jcoz_sleep", 1, samples, mean, extra);
+  }
+}
+
+static void PrintUsage(const char *argv0) {
+  fprintf(stderr, "usage: %s [--quick] [--filter=<bench name substring>]\n", argv0);
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      quick = true;
+    } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+      filter = argv[i] + 9;
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  ProfilerBench::Setup();
+
+  BenchLookups();
+  BenchStackScans();
+  BenchHandle();
+  BenchSpinLock();
+  BenchSignalUserThreads();
+  BenchSleep();
+  return 0;
+}
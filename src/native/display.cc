@@ -27,86 +27,21 @@
 #include <string.h>
 
 #include <algorithm>
+#include <functional>
 #include <string>
+#include <thread>
 // The map used here doesn't need to be ordered, but unordered_map
 // seems to cause problems out of the box on Ubuntu, and hash_map is
 // non-standard.
 #include <map>
 #include <vector>
 
-void StackTracesPrinter::PrintStackTraces(TraceData *traces, int length) {
-  int count = 0;
-  int total = 0;
-  for (int i = 0; i < length; i++) {
-    if (traces[i].count != 0) {
-      total += traces[i].count;
-      count++;
-      fprintf(file_, "%" PRIdPTR " ", traces[i].count);
-      PrintStackTrace(&traces[i]);
-      fprintf(file_, "\n");
-    }
-  }
-  fprintf(file_, "Total trace count = %d, Total traces = %d\n", total, count);
-}
-
-typedef std::pair<jint, jmethodID> PairCallFrame;
-typedef std::pair<PairCallFrame, int> FrameCount;
-
-struct Sorter {
-  bool operator()(const FrameCount f1, const FrameCount f2) {
-    return f1.second > f2.second;
-  }
-};
-
-void StackTracesPrinter::PrintLeafHistogram(TraceData *traces, int length) {
-  fprintf(file_, "\n\nHot methods:\n");
-  std::map<PairCallFrame, int> hot_methods;
-  for (int i = 0; i < length; i++) {
-    if (traces[i].count != 0) {
-      JVMPI_CallTrace *t = &(traces[i].trace);
-      JVMPI_CallFrame *f = t->frames;
-      JVMPI_CallFrame *last_frame = f + t->num_frames;
-      while (f->lineno == -99 && f != last_frame) {
-        f++;
-      }
-      if (f == last_frame) {
-        continue;
-      }
-
-      PairCallFrame pair(f->lineno, f->method_id);
-      hot_methods[pair] += traces[i].count;
-    }
-  }
-
-  std::vector<FrameCount> sorted_methods;
-  Sorter sorter;
-
-  sorted_methods.reserve(hot_methods.size());
+// Fewer traces than this per thread are not worth a thread of their own.
+static const int kMinTracesPerThread = 256;
 
-  for (auto method : hot_methods) {
-    sorted_methods.emplace_back(method.first, method.second);
-  }
-
-  std::sort(sorted_methods.begin(), sorted_methods.end(), sorter);
-
-  JVMPI_CallFrame last;
-  last.method_id = NULL;
-  last.lineno = 0;
-
-  for (auto method : sorted_methods) {
-    int count = method.second;
-    PairCallFrame *f = &(method.first);
-    JVMPI_CallFrame curr_frame;
-    curr_frame.lineno = f->first;
-    curr_frame.method_id = f->second;
-    if (curr_frame.lineno == last.lineno &&
-        curr_frame.method_id == last.method_id) {
-      continue;
-    }
-    fprintf(file_, "%10d ", count);
-    PrintStackFrame(&curr_frame);
-    last = curr_frame;
-  }
+static bool IsPrintable(const JVMPI_CallFrame &frame) {
+  // -99 should never happen in a stock hotspot build
+  return frame.lineno != -99;
 }
 
 // This method changes the standard class signature "Lfoo/bar;" format
@@ -126,60 +61,13 @@ static void CleanJavaSignature(char *signature_ptr) {
   signature_ptr[signature_length - 1] = '\0';
 }
 
-// Given a method and a location, this method gets the line number.
-// Kind of expensive, comparatively.
-jint StackTracesPrinter::GetLineNumber(jmethodID method, jlocation location) {
-  jint entry_count;
-  JvmtiScopedPtr<jvmtiLineNumberEntry> table_ptr_ctr(jvmti_);
-  jint line_number = -1;
-
-  // Shortcut for native methods.
-  if (location == -1) {
-    return -1;
-  }
-
-  int jvmti_error = jvmti_->GetLineNumberTable(method,
-      &entry_count,
-      table_ptr_ctr.GetRef());
+void StackTracesPrinter::ResolveMethod(jmethodID method,
+    MethodSymbols *symbols) {
+  symbols->resolved = false;
 
-  // Go through all the line numbers...
-  if (JVMTI_ERROR_NONE != jvmti_error) {
-    table_ptr_ctr.AbandonBecauseOfError();
-  } else {
-    jvmtiLineNumberEntry *table_ptr = table_ptr_ctr.Get();
-    if (entry_count > 1) {
-      jlocation last_location = table_ptr[0].start_location;
-      for (int l = 1; l < entry_count; l++) {
-        // ... and if you see one that is in the right place for your
-        // location, you've found the line number!
-        if ((location < table_ptr[l].start_location) &&
-            (location >= last_location)) {
-          line_number = table_ptr[l-1].line_number;
-          return line_number;
-        }
-        last_location = table_ptr[l].start_location;
-      }
-      if (location >= last_location) {
-        return table_ptr[entry_count - 1].line_number;
-      }
-    } else if (entry_count == 1) {
-      line_number = table_ptr[0].line_number;
-    }
-  }
-  return line_number;
-}
-
-bool StackTracesPrinter::GetStackFrameElements(JVMPI_CallFrame *frame,
-    string *file_name,
-    string *class_name,
-    string *method_name,
-    int *line_number) {
   jint error;
   JvmtiScopedPtr<char> name_ptr(jvmti_);
-
-  // Get method name, put it in name_ptr
-  if ((error = jvmti_->GetMethodName(frame->method_id, name_ptr.GetRef(), NULL,
-          NULL)) !=
+  if ((error = jvmti_->GetMethodName(method, name_ptr.GetRef(), NULL, NULL)) !=
       JVMTI_ERROR_NONE) {
     name_ptr.AbandonBecauseOfError();
     if (error == JVMTI_ERROR_INVALID_METHODID) {
@@ -194,73 +82,323 @@ bool StackTracesPrinter::GetStackFrameElements(JVMPI_CallFrame *frame,
         fprintf(stderr, "Unexpected JVMTI error %d in GetMethodName", error);
       }
     }
-    return false;
+    return;
   }
 
-  // Get class name, put it in signature_ptr
   jclass declaring_class;
-  JVMTI_ERROR_1(
-      jvmti_->GetMethodDeclaringClass(frame->method_id, &declaring_class),
-      false);
+  JVMTI_ERROR(jvmti_->GetMethodDeclaringClass(method, &declaring_class));
 
-  JvmtiScopedPtr<char> signature_ptr2(jvmti_);
-  JVMTI_ERROR_CLEANUP_1(
-      jvmti_->GetClassSignature(declaring_class, signature_ptr2.GetRef(), NULL),
-      false, signature_ptr2.AbandonBecauseOfError());
+  JvmtiScopedPtr<char> signature_ptr(jvmti_);
+  JVMTI_ERROR_CLEANUP(
+      jvmti_->GetClassSignature(declaring_class, signature_ptr.GetRef(), NULL),
+      signature_ptr.AbandonBecauseOfError());
+
+  if (name_ptr.Get() == NULL || signature_ptr.Get() == NULL) {
+    return;
+  }
 
-  // Get source file, put it in source_name_ptr
-  char *filename;
   JvmtiScopedPtr<char> source_name_ptr(jvmti_);
-  static char file_unknown[] = "UnknownFile";
   if (JVMTI_ERROR_NONE !=
-      jvmti_->GetSourceFileName(declaring_class, source_name_ptr.GetRef())) {
+      jvmti_->GetSourceFileName(declaring_class, source_name_ptr.GetRef())
+      || source_name_ptr.Get() == NULL) {
     source_name_ptr.AbandonBecauseOfError();
-    filename = file_unknown;
+    symbols->file_name = "UnknownFile";
   } else {
-    filename = source_name_ptr.Get();
+    symbols->file_name = source_name_ptr.Get();
   }
 
-  CleanJavaSignature(signature_ptr2.Get());
-
   // CleanJavaSignature prepends a ' ' character
-  *class_name = signature_ptr2.Get() + 1;
-  *method_name = name_ptr.Get();
-  *file_name = filename;
+  CleanJavaSignature(signature_ptr.Get());
+  symbols->class_name = signature_ptr.Get() + 1;
+  symbols->method_name = name_ptr.Get();
+  symbols->qualified_name = symbols->class_name + "." + symbols->method_name;
+
+  jint entry_count;
+  JvmtiScopedPtr<jvmtiLineNumberEntry> table_ptr(jvmti_);
+  if (JVMTI_ERROR_NONE !=
+      jvmti_->GetLineNumberTable(method, &entry_count, table_ptr.GetRef())) {
+    table_ptr.AbandonBecauseOfError();
+  } else {
+    symbols->lines.reserve(entry_count);
+    for (int i = 0; i < entry_count; i++) {
+      symbols->lines.push_back(std::make_pair(table_ptr.Get()[i].start_location,
+            table_ptr.Get()[i].line_number));
+    }
+    std::sort(symbols->lines.begin(), symbols->lines.end());
+  }
+
+  symbols->resolved = true;
+}
+
+void StackTracesPrinter::ResolveMethods(TraceData *traces, int length) {
+  std::vector<jmethodID> unresolved;
+  for (int i = 0; i < length; i++) {
+    if (traces[i].count <= 0) {
+      continue;
+    }
+    JVMPI_CallTrace *t = &(traces[i].trace);
+    for (int j = 0; j < t->num_frames; j++) {
+      jmethodID method = t->frames[j].method_id;
+      if (IsPrintable(t->frames[j]) && methods_.count(method) == 0) {
+        // Reserve the entry so each method is queued once.
+        methods_[method].resolved = false;
+        unresolved.push_back(method);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < unresolved.size(); i++) {
+    ResolveMethod(unresolved[i], &methods_[unresolved[i]]);
+  }
+}
+
+const MethodSymbols &StackTracesPrinter::Symbols(jmethodID method) {
+  auto found = methods_.find(method);
+  if (found == methods_.end()) {
+    found = methods_.insert(std::make_pair(method, MethodSymbols())).first;
+    ResolveMethod(method, &found->second);
+  }
+  return found->second;
+}
+
+// Given a method's line table and a location, this method gets the line
+// number.
+jint StackTracesPrinter::GetLineNumber(const MethodSymbols &symbols,
+    jlocation location) {
+  // Shortcut for native methods.
+  if (location == -1 || symbols.lines.empty()) {
+    return -1;
+  }
+  if (symbols.lines.size() == 1) {
+    return symbols.lines[0].second;
+  }
 
-  if (line_number != NULL) {
+  // The last entry starting at or before location.
+  auto after = std::upper_bound(symbols.lines.begin(), symbols.lines.end(),
+      std::make_pair(location, (jint) INT32_MAX));
+  if (after == symbols.lines.begin()) {
+    return -1;
+  }
+  return (after - 1)->second;
+}
+
+const string &StackTracesPrinter::FrameString(const JVMPI_CallFrame &frame) {
+  FrameKey key(frame.method_id, frame.lineno);
+  auto found = frames_.find(key);
+  if (found != frames_.end()) {
+    return found->second;
+  }
+
+  const MethodSymbols &symbols = Symbols(frame.method_id);
+  string formatted;
+  if (symbols.resolved) {
     // TODO(jeremymanson): is frame->lineno correct?  GetLineNumber
     // expects a BCI.
-    *line_number = GetLineNumber(frame->method_id, frame->lineno);
+    formatted = "\t" + symbols.class_name + "." + symbols.method_name + "("
+      + symbols.file_name + ":"
+      + std::to_string(GetLineNumber(symbols, frame.lineno)) + ")\n";
+  } else {
+    formatted = "\t[unknown]\n";
   }
+  return frames_.insert(std::make_pair(key, formatted)).first->second;
+}
 
-  return true;
+void StackTracesPrinter::ResolveFrames(TraceData *traces, int length) {
+  for (int i = 0; i < length; i++) {
+    if (traces[i].count <= 0) {
+      continue;
+    }
+    JVMPI_CallTrace *t = &(traces[i].trace);
+    for (int j = 0; j < t->num_frames; j++) {
+      if (IsPrintable(t->frames[j])) {
+        FrameString(t->frames[j]);
+      }
+    }
+  }
 }
 
-bool StackTracesPrinter::PrintStackFrame(JVMPI_CallFrame *frame) {
-  if (frame->lineno == -99) {
-    // This should never happen in a stock hotspot build
-    return false;
+void StackTracesPrinter::AppendStackTrace(const TraceData &trace, string *out) {
+  const JVMPI_CallTrace &t = trace.trace;
+  *out += std::to_string(trace.count);
+  *out += ' ';
+  // Error traces - don't bother to print them.
+  if (t.num_frames >= 0) {
+    *out += std::to_string(t.num_frames);
+    *out += ' ';
+    for (int i = 0; i < t.num_frames; i++) {
+      if (IsPrintable(t.frames[i])) {
+        *out += frames_.find(FrameKey(t.frames[i].method_id,
+              t.frames[i].lineno))->second;
+      }
+    }
   }
+  *out += '\n';
+}
 
-  string method_name, class_name, file_name;
-  int line_num;
-  GetStackFrameElements(frame, &file_name, &class_name, &method_name,
-      &line_num);
-  fprintf(file_, "\t%s.%s(%s:%d)\n", class_name.c_str(), method_name.c_str(),
-      file_name.c_str(), line_num);
-  return true;
+void StackTracesPrinter::FormatChunk(TraceData *traces, int begin, int end,
+    string *out) {
+  for (int i = begin; i < end; i++) {
+    if (traces[i].count > 0) {
+      AppendStackTrace(traces[i], out);
+    }
+  }
 }
 
-void StackTracesPrinter::PrintStackTrace(TraceData *trace) {
-  JVMPI_CallTrace *t = &(trace->trace);
-  if (t->num_frames < 0) {
-    // Error trace - don't bother to print it.
-    return;
+void StackTracesPrinter::Write(const string &out) {
+  fwrite(out.data(), 1, out.size(), file_);
+}
+
+// Runs chunk(i, begin, end) over `threads` slices of [0, length), the
+// first on the calling thread, and waits for them all.
+static void RunChunked(int length, int threads,
+    const std::function<void(int, int, int)> &chunk) {
+  std::vector<std::thread> workers;
+  int per_thread = (length + threads - 1) / threads;
+  for (int t = 1; t < threads; t++) {
+    int begin = std::min(length, t * per_thread);
+    int end = std::min(length, begin + per_thread);
+    workers.push_back(std::thread(chunk, t, begin, end));
+  }
+  chunk(0, 0, std::min(length, per_thread));
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+}
+
+// Threads worth using for count traces.
+static int ThreadsFor(int count) {
+  return std::max(1, std::min((int) std::thread::hardware_concurrency(),
+        count / kMinTracesPerThread));
+}
+
+void StackTracesPrinter::PrintStackTraces(TraceData *traces, int length) {
+  ResolveMethods(traces, length);
+  ResolveFrames(traces, length);
+
+  int count = 0;
+  intptr_t total = 0;
+  for (int i = 0; i < length; i++) {
+    if (traces[i].count > 0) {
+      total += traces[i].count;
+      count++;
+    }
+  }
+
+  // From here on the caches are only read, so the text is built in
+  // slices on several threads and written out in order.
+  std::vector<string> chunks(ThreadsFor(count));
+  RunChunked(length, chunks.size(), [&](int t, int begin, int end) {
+    FormatChunk(traces, begin, end, &chunks[t]);
+  });
+  for (size_t t = 0; t < chunks.size(); t++) {
+    Write(chunks[t]);
+  }
+  fprintf(file_, "Total trace count = %" PRIdPTR ", Total traces = %d\n",
+      total, count);
+}
+
+typedef std::pair<jint, jmethodID> PairCallFrame;
+typedef std::pair<PairCallFrame, intptr_t> FrameCount;
+
+struct Sorter {
+  bool operator()(const FrameCount &f1, const FrameCount &f2) {
+    return f1.second > f2.second;
+  }
+};
+
+void StackTracesPrinter::PrintLeafHistogram(TraceData *traces, int length) {
+  std::map<PairCallFrame, intptr_t> hot_methods;
+  for (int i = 0; i < length; i++) {
+    if (traces[i].count > 0) {
+      JVMPI_CallTrace *t = &(traces[i].trace);
+      JVMPI_CallFrame *f = t->frames;
+      JVMPI_CallFrame *last_frame = f + std::max(t->num_frames, 0);
+      while (f != last_frame && !IsPrintable(*f)) {
+        f++;
+      }
+      if (f == last_frame) {
+        continue;
+      }
+
+      PairCallFrame pair(f->lineno, f->method_id);
+      hot_methods[pair] += traces[i].count;
+    }
+  }
+
+  std::vector<FrameCount> sorted_methods(hot_methods.begin(),
+      hot_methods.end());
+  std::sort(sorted_methods.begin(), sorted_methods.end(), Sorter());
+
+  string out = "\n\nHot methods:\n";
+  char count[32];
+  for (auto &method : sorted_methods) {
+    JVMPI_CallFrame frame;
+    frame.lineno = method.first.first;
+    frame.method_id = method.first.second;
+    snprintf(count, sizeof(count), "%10" PRIdPTR " ", method.second);
+    out += count;
+    out += FrameString(frame);
+  }
+  Write(out);
+}
+
+void StackTracesPrinter::CollapseChunk(TraceData *traces, int begin, int end,
+    std::unordered_map<string, intptr_t> *stacks) {
+  string stack;
+  for (int i = begin; i < end; i++) {
+    if (traces[i].count <= 0) {
+      continue;
+    }
+    JVMPI_CallTrace *t = &(traces[i].trace);
+    stack.clear();
+    for (int j = t->num_frames - 1; j >= 0; j--) {
+      if (!IsPrintable(t->frames[j])) {
+        continue;
+      }
+      const MethodSymbols &symbols =
+        methods_.find(t->frames[j].method_id)->second;
+      if (!stack.empty()) {
+        stack += ';';
+      }
+      stack += symbols.resolved ? symbols.qualified_name : "[unknown]";
+    }
+    if (!stack.empty()) {
+      (*stacks)[stack] += traces[i].count;
+    }
+  }
+}
+
+void StackTracesPrinter::PrintCollapsedStacks(TraceData *traces, int length) {
+  ResolveMethods(traces, length);
+
+  int count = 0;
+  for (int i = 0; i < length; i++) {
+    if (traces[i].count > 0) {
+      count++;
+    }
+  }
+
+  // Every method is resolved, so the traces are collapsed in slices on
+  // several threads.  Traces that differ only in bci collapse into the
+  // same line.
+  std::vector<std::unordered_map<string, intptr_t> > chunks(ThreadsFor(count));
+  RunChunked(length, chunks.size(), [&](int t, int begin, int end) {
+    CollapseChunk(traces, begin, end, &chunks[t]);
+  });
+
+  std::map<string, intptr_t> stacks;
+  for (size_t t = 0; t < chunks.size(); t++) {
+    for (auto &entry : chunks[t]) {
+      stacks[entry.first] += entry.second;
+    }
   }
 
-  fprintf(file_, "%d ", t->num_frames);
-  for (int i = 0; i < t->num_frames; i++) {
-    JVMPI_CallFrame *curr_frame = &(t->frames[i]);
-    PrintStackFrame(curr_frame);
+  string out;
+  for (auto &entry : stacks) {
+    out += entry.first;
+    out += ' ';
+    out += std::to_string(entry.second);
+    out += '\n';
   }
+  Write(out);
 }
@@ -23,6 +23,9 @@
 #include <stdio.h>
 
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "globals.h"
 #include "profiler.h"
@@ -37,6 +40,24 @@
 using std::string;
 #endif
 
+// What JVMTI tells us about one method, fetched once per dump.
+struct MethodSymbols {
+  bool resolved;
+  string class_name;
+  string method_name;
+  // "Class.method".
+  string qualified_name;
+  string file_name;
+  // (start bci, line number), sorted by bci.
+  std::vector<std::pair<jlocation, jint> > lines;
+};
+
+struct FrameKeyHash {
+  size_t operator()(const std::pair<jmethodID, jint> &key) const {
+    return std::hash<void *>()(key.first) * 31 + (size_t) key.second;
+  }
+};
+
 class StackTracesPrinter {
   public:
     StackTracesPrinter(FILE *file, jvmtiEnv *jvmti)
@@ -46,20 +67,52 @@ class StackTracesPrinter {
 
     void PrintLeafHistogram(TraceData *traces, int length);
 
+    // One "root;...;leaf count" line per distinct stack, the format
+    // flame graph tools read.  Frames are named Class.method.
+    void PrintCollapsedStacks(TraceData *traces, int length);
+
+    // What JVMTI says about method, looked up on first use.
+    const MethodSymbols &Symbols(jmethodID method);
+
   private:
+    typedef std::pair<jmethodID, jint> FrameKey;
+
     FILE *file_;
 
     jvmtiEnv *jvmti_;
 
-    bool PrintStackFrame(JVMPI_CallFrame *frame);
+    // Symbols by method, filled by ResolveMethods.
+    std::unordered_map<jmethodID, MethodSymbols> methods_;
+
+    // Formatted "\tClass.method(File:line)\n" by (method, bci), filled
+    // by ResolveFrames.
+    std::unordered_map<FrameKey, string, FrameKeyHash> frames_;
+
+    // Looks up every method in the traces that is not cached yet.  All
+    // the JVMTI calls happen here, on the calling thread.
+    void ResolveMethods(TraceData *traces, int length);
+
+    // Formats every frame in the traces that is not cached yet.
+    void ResolveFrames(TraceData *traces, int length);
+
+    const string &FrameString(const JVMPI_CallFrame &frame);
+
+    void ResolveMethod(jmethodID method, MethodSymbols *symbols);
+
+    void AppendStackTrace(const TraceData &trace, string *out);
+
+    // Formats traces[begin, end) with AppendStackTrace.  Only reads the
+    // caches, so chunks can be formatted on several threads.
+    void FormatChunk(TraceData *traces, int begin, int end, string *out);
 
-    void PrintStackTrace(TraceData *trace);
+    // Adds the collapsed stacks of traces[begin, end) to *stacks.  Like
+    // FormatChunk, only reads the method cache.
+    void CollapseChunk(TraceData *traces, int begin, int end,
+        std::unordered_map<string, intptr_t> *stacks);
 
-    bool GetStackFrameElements(JVMPI_CallFrame *frame, string *method_name,
-        string *class_name, string *file_name,
-        int *line_number);
+    jint GetLineNumber(const MethodSymbols &symbols, jlocation location);
 
-    jint GetLineNumber(jmethodID method, jlocation location);
+    void Write(const string &out);
 
     DISALLOW_COPY_AND_ASSIGN(StackTracesPrinter);
 };
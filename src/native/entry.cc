@@ -19,6 +19,7 @@
  * a copy of the license that was included with that original work.
  */
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <limits.h>
 #include <string.h>
@@ -26,9 +27,17 @@
 
 #include <string>
 
+#include "gc.h"
 #include "globals.h"
+#include "jit.h"
+#include "logger.h"
+#include "options.h"
 #include "profiler.h"
+#include "ring.h"
 #include "stacktraces.h"
+#include "stats.h"
+#include "timeline.h"
+#include "userthreads.h"
 
 static Profiler *prof;
 FILE *Globals::OutFile;
@@ -36,20 +45,17 @@ static bool updateEventsEnabledState(jvmtiEnv *jvmti, jvmtiEventMode enabledStat
 static volatile int class_prep_lock = 0;
 static bool acquireCreateLock(); static void releaseCreateLock();
 
+// Thread start and end are on the critical path of every thread the
+// application creates, so keep them free of logging and allocation.
 void JNICALL OnThreadStart(jvmtiEnv *jvmti_env, JNIEnv *jni_env,
     jthread thread) {
-  auto logger = prof->getLogger();
-  logger->info("OnThreadStart fired");
   IMPLICITLY_USE(jvmti_env);
-  IMPLICITLY_USE(thread);
   Accessors::SetCurrentJniEnv(jni_env);
 
-  prof->addUserThread(thread);
+  prof->addUserThread(jni_env, thread);
 }
 
 void JNICALL OnThreadEnd(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread) {
-  auto logger = prof->getLogger();
-  logger->info("OnThreadEnd fired");
   IMPLICITLY_USE(jvmti_env);
   IMPLICITLY_USE(jni_env);
   IMPLICITLY_USE(thread);
@@ -57,6 +63,86 @@ void JNICALL OnThreadEnd(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread) {
   prof->removeUserThread(thread);
 }
 
+#ifdef JCOZ_VIRTUAL_THREADS
+// Set if the VM lets us follow virtual threads (JDK 21 and later).
+static bool virtual_threads = false;
+
+void JNICALL OnVirtualThreadStart(jvmtiEnv *jvmti_env, JNIEnv *jni_env,
+    jthread vthread) {
+  IMPLICITLY_USE(jni_env);
+  Profiler::startVirtualThread(jvmti_env, vthread);
+}
+
+void JNICALL OnVirtualThreadEnd(jvmtiEnv *jvmti_env, JNIEnv *jni_env,
+    jthread vthread) {
+  IMPLICITLY_USE(jni_env);
+  Profiler::endVirtualThread(jvmti_env, vthread);
+}
+
+// Mount and unmount are HotSpot extension events, which are called as
+// jvmtiExtensionEvent with the JNIEnv and the virtual thread.
+static void JNICALL OnVirtualThreadMount(jvmtiEnv *jvmti_env, ...) {
+  va_list args;
+  va_start(args, jvmti_env);
+  va_arg(args, JNIEnv *);
+  jthread vthread = va_arg(args, jthread);
+  va_end(args);
+  Profiler::mountVirtualThread(jvmti_env, vthread);
+}
+
+static void JNICALL OnVirtualThreadUnmount(jvmtiEnv *jvmti_env, ...) {
+  va_list args;
+  va_start(args, jvmti_env);
+  va_arg(args, JNIEnv *);
+  jthread vthread = va_arg(args, jthread);
+  va_end(args);
+  Profiler::unmountVirtualThread(jvmti_env, vthread);
+}
+
+// Hooks up the mount and unmount extension events.  Returns false if
+// the VM does not have both.
+static bool RegisterMountEvents(jvmtiEnv *jvmti) {
+  jint count = 0;
+  jvmtiExtensionEventInfo *events = NULL;
+  if (jvmti->GetExtensionEvents(&count, &events) != JVMTI_ERROR_NONE) {
+    return false;
+  }
+  jint mount = -1;
+  jint unmount = -1;
+  for (jint i = 0; i < count; i++) {
+    if (strcmp(events[i].id, "com.sun.hotspot.events.VirtualThreadMount") == 0) {
+      mount = events[i].extension_event_index;
+    } else if (strcmp(events[i].id,
+          "com.sun.hotspot.events.VirtualThreadUnmount") == 0) {
+      unmount = events[i].extension_event_index;
+    }
+  }
+  for (jint i = 0; i < count; i++) {
+    for (jint p = 0; p < events[i].param_count; p++) {
+      jvmti->Deallocate((unsigned char *) events[i].params[p].name);
+    }
+    jvmti->Deallocate((unsigned char *) events[i].params);
+    jvmti->Deallocate((unsigned char *) events[i].id);
+    jvmti->Deallocate((unsigned char *) events[i].short_description);
+  }
+  jvmti->Deallocate((unsigned char *) events);
+
+  if (mount < 0 || unmount < 0) {
+    return false;
+  }
+  if (jvmti->SetExtensionEventCallback(mount,
+        (jvmtiExtensionEvent) &OnVirtualThreadMount) != JVMTI_ERROR_NONE) {
+    return false;
+  }
+  if (jvmti->SetExtensionEventCallback(unmount,
+        (jvmtiExtensionEvent) &OnVirtualThreadUnmount) != JVMTI_ERROR_NONE) {
+    jvmti->SetExtensionEventCallback(mount, NULL);
+    return false;
+  }
+  return true;
+}
+#endif
+
 // This has to be here, or the VM turns off class loading events.
 // And AsyncGetCallTrace needs class loading events to be turned on!
 void JNICALL OnClassLoad(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread,
@@ -71,8 +157,7 @@ void JNICALL OnClassLoad(jvmtiEnv *jvmti_env, JNIEnv *jni_env, jthread thread,
 // Create a java thread -- currently used
 // to run profiler thread
 jthread create_thread(JNIEnv *jni_env) {
-  auto logger = prof->getLogger();
-  logger->info("Creating a thread in create_thread");
+  JCOZ_DEBUG("Creating a thread in create_thread");
   jclass cls = jni_env->FindClass("java/lang/Thread");
   if( cls == NULL ) {
     exit(1);
@@ -95,8 +180,7 @@ jthread create_thread(JNIEnv *jni_env) {
  * are called.
  */
 static bool updateEventsEnabledState(jvmtiEnv *jvmti, jvmtiEventMode enabledState) {
-  auto logger = prof->getLogger();
-  logger->info("Setting CLASS_PREPARE to enabled");
+  JCOZ_INFO("Setting CLASS_PREPARE to enabled");
   JVMTI_ERROR_1(
       (jvmti->SetEventNotificationMode(enabledState, JVMTI_EVENT_CLASS_PREPARE, NULL)),
       false);
@@ -128,23 +212,22 @@ void CreateJMethodIDsForClass(jvmtiEnv *jvmti, jclass klass) {
   if (!prof->isRunning()){
     return;
   }
-  auto logger = prof->getLogger();
-  logger->info("In CreateJMethodIDsForClass start");
+  JCOZ_DEBUG("In CreateJMethodIDsForClass start");
   bool releaseLock = acquireCreateLock();
   jint method_count;
   JvmtiScopedPtr<jmethodID> methods(jvmti);
   jvmtiError e = jvmti->GetClassMethods(klass, &method_count, methods.GetRef());
-  logger->info("Got class methods from the JVM");
+  JCOZ_DEBUG("Got class methods from the JVM");
   if (e != JVMTI_ERROR_NONE) {
     JvmtiScopedPtr<char> ksig(jvmti);
     JVMTI_ERROR((jvmti->GetClassSignature(klass, ksig.GetRef(), NULL)));
-    logger->error("Failed to create method IDs for methods in class {} with error {}", ksig.Get(), e);
+    JCOZ_ERROR("Failed to create method IDs for methods in class {} with error {}", ksig.Get(), e);
   } else {
     JvmtiScopedPtr<char> ksig(jvmti);
     jvmti->GetClassSignature(klass, ksig.GetRef(), NULL);
 
     std::string package_str = "L" + prof->getPackage();
-    logger->info(
+    JCOZ_DEBUG(
         "Creating JMethod IDs. [Class: {class}] [Scope: {scope}]",
         fmt::arg("class", ksig.Get()), fmt::arg("scope", package_str));
     if( strstr(ksig.Get(), package_str.c_str()) == ksig.Get() ) {
@@ -164,9 +247,15 @@ void CreateJMethodIDsForClass(jvmtiEnv *jvmti, jclass klass) {
   }
 }
 
-jint JNICALL startProfilingNative(JNIEnv *env, jobject thisObj) {
-  auto logger = prof->getLogger();
-  logger->info("startProfilingNative called");
+// Same as JCozProfilingErrorCodes.CANNOT_CALL_WHEN_RUNNING and
+// PROFILER_NOT_RUNNING.
+static const jint kCannotCallWhenRunning = 3;
+static const jint kProfilerNotRunning = 4;
+
+// Starts profiling with the scope and progress point already set.
+// Experiments are reported to mbean, if there is one, and to the
+// profile and ring.  prof must be set.
+static void StartProfiling(JNIEnv *env, jobject mbean) {
   // Forces the creation of jmethodIDs of the classes that had already
   // been loaded (eg java.lang.Object, java.lang.ClassLoader) and
   // OnClassPrepare() misses.
@@ -174,7 +263,9 @@ jint JNICALL startProfilingNative(JNIEnv *env, jobject thisObj) {
   jint class_count;
   JvmtiScopedPtr<jclass> classes(jvmti);
   prof->setJNI(env);
-  prof->setMBeanObject(thisObj);
+  if (mbean != NULL) {
+    prof->setMBeanObject(mbean);
+  }
   prof->Start();
   updateEventsEnabledState(jvmti, JVMTI_ENABLE);
   jvmti->GetLoadedClasses(&class_count, classes.GetRef());
@@ -183,18 +274,51 @@ jint JNICALL startProfilingNative(JNIEnv *env, jobject thisObj) {
     jclass klass = classList[i];
     JvmtiScopedPtr<char> ksig(jvmti);
     jvmti->GetClassSignature(klass, ksig.GetRef(), NULL);
-    logger->info("Loading class {}", ksig.Get());
+    JCOZ_DEBUG("Loading class {}", ksig.Get());
     CreateJMethodIDsForClass(jvmti, klass);
   }
 
   jthread agent_thread = create_thread(env);
   jvmtiError agentErr = jvmti->RunAgentThread(agent_thread, &Profiler::runAgentThread, NULL, 1);
+}
+
+// Starts profiling with the scope and progress point from the agent
+// options, for a run that nobody drives over JMX.
+static void StartHeadless(JNIEnv *env) {
+  if (prof == NULL) {
+    return;
+  }
+  JCOZ_INFO("Profiling {} headless, writing experiments to {}",
+      AgentOptions::scope, AgentOptions::profile_file);
+  prof->setScope(AgentOptions::scope);
+  if (AgentOptions::end_to_end) {
+    prof->setEndToEnd(true);
+  } else {
+    JCOZ_INFO("Setting Progress point: {}:{}", AgentOptions::progress_class,
+        AgentOptions::progress_line);
+    prof->setProgressPoint(AgentOptions::progress_class,
+        AgentOptions::progress_line);
+  }
+  StartProfiling(env, NULL);
+}
+
+jint JNICALL startProfilingNative(JNIEnv *env, jobject thisObj) {
+  JCOZ_INFO("startProfilingNative called");
+  if (prof == NULL) {
+    return kProfilerNotRunning;
+  }
+  if (prof->isRunning()) {
+    return kCannotCallWhenRunning;
+  }
+  StartProfiling(env, thisObj);
   return 0;
 }
 
 jint JNICALL endProfilingNative(JNIEnv *env, jobject thisObj) {
-  auto logger = prof->getLogger();
-  logger->info("endProfilingNative called");
+  JCOZ_INFO("endProfilingNative called");
+  if (prof == NULL) {
+    return kProfilerNotRunning;
+  }
   prof->Stop();
   updateEventsEnabledState(prof->getJVMTI(), JVMTI_DISABLE);
   prof->clearMBeanObject();
@@ -203,9 +327,11 @@ jint JNICALL endProfilingNative(JNIEnv *env, jobject thisObj) {
 }
 
 jint JNICALL setProgressPointNative(JNIEnv *env, jobject thisObj, jstring className, jint line_no) {
+  if (prof->isRunning()) {
+    return kCannotCallWhenRunning;
+  }
   const char *nativeClassName = env->GetStringUTFChars(className, 0);
-  auto logger = prof->getLogger();
-  logger->info("Setting Progress point: {}:{}", nativeClassName, line_no);
+  JCOZ_INFO("Setting Progress point: {}:{}", nativeClassName, line_no);
   prof->setProgressPoint(nativeClassName, line_no);
 
 
@@ -215,58 +341,162 @@ jint JNICALL setProgressPointNative(JNIEnv *env, jobject thisObj, jstring classN
 }
 
 jint JNICALL setScopeNative(JNIEnv *env, jobject thisObj, jstring scope) {
+  if (prof->isRunning()) {
+    return kCannotCallWhenRunning;
+  }
   const char *nativeScope = env->GetStringUTFChars(scope, 0);
-  auto logger = prof->getLogger();
 
   prof->setScope(nativeScope);
-  logger->info("Setting scope {}", nativeScope);
+  JCOZ_INFO("Setting scope {}", nativeScope);
   env->ReleaseStringUTFChars(scope, nativeScope);
   return 0;
 }
 
+jint JNICALL scheduleExperimentNative(JNIEnv *env, jobject thisObj,
+    jstring classSig, jint line_no, jfloat speedup, jlong start_ms,
+    jlong duration_ms) {
+  IMPLICITLY_USE(thisObj);
+  const char *nativeClassSig = env->GetStringUTFChars(classSig, 0);
+  if (nativeClassSig == NULL) {
+    // OutOfMemoryError is pending.
+    return -1;
+  }
+  ScheduledExperiment scheduled;
+  scheduled.class_sig = nativeClassSig;
+  scheduled.lineno = line_no;
+  scheduled.speedup = speedup;
+  scheduled.start_ms = start_ms;
+  scheduled.duration_ms = duration_ms;
+  env->ReleaseStringUTFChars(classSig, nativeClassSig);
+
+  JCOZ_DEBUG("Scheduling experiment on {}:{} at speedup {} for {} ms",
+      scheduled.class_sig, line_no, speedup, duration_ms);
+  Profiler::scheduleExperiment(scheduled);
+  return 0;
+}
 
+jint JNICALL clearExperimentScheduleNative(JNIEnv *env, jobject thisObj) {
+  IMPLICITLY_USE(env);
+  IMPLICITLY_USE(thisObj);
+  JCOZ_INFO("Clearing the experiment schedule");
+  Profiler::clearSchedule();
+  return 0;
+}
 
-void JNICALL OnVMInit(jvmtiEnv *jvmti, JNIEnv *jni_env, jthread thread) {
-  IMPLICITLY_USE(thread);
-  IMPLICITLY_USE(jni_env);
+jlongArray JNICALL getOverheadStatsNative(JNIEnv *env, jobject thisObj) {
+  IMPLICITLY_USE(thisObj);
+  uint64_t stats[kStatsLength];
+  ProfilerStats::Snapshot(stats);
+
+  jlongArray result = env->NewLongArray(kStatsLength);
+  if (result != NULL) {
+    env->SetLongArrayRegion(result, 0, kStatsLength,
+        reinterpret_cast<jlong *>(stats));
+  }
+  return result;
+}
 
+jint JNICALL getDutyCycleNative(JNIEnv *env, jobject thisObj) {
+  IMPLICITLY_USE(env);
+  IMPLICITLY_USE(thisObj);
+  return AgentOptions::duty_cycle;
+}
 
-  // register mbean
+jint JNICALL getProfiledThreadCountNative(JNIEnv *env, jobject thisObj) {
+  IMPLICITLY_USE(env);
+  IMPLICITLY_USE(thisObj);
+  return UserThreadSlab::Active();
+}
 
-  auto logger = prof->getLogger();
-  logger->info("Trying to find JCozProfiler class");
+jboolean JNICALL hasResultRingNative(JNIEnv *env, jobject thisObj) {
+  IMPLICITLY_USE(env);
+  IMPLICITLY_USE(thisObj);
+  return ResultRing::Enabled() ? JNI_TRUE : JNI_FALSE;
+}
+
+// Registers the natives of jcoz.agent.JCozProfiler and has it register
+// its MBean.  Returns false if that could not be done.
+static bool RegisterProfilerClass(JNIEnv *jni_env) {
+  JCOZ_INFO("Trying to find JCozProfiler class");
   jclass cls = jni_env->FindClass("jcoz/agent/JCozProfiler");
   if (cls == nullptr){
-    logger->error("Could not find JCoz Profiler class, did you add the jar to the classpath?");
+    jni_env->ExceptionClear();
+    JCOZ_ERROR("Could not find JCoz Profiler class, did you add the jar to the classpath?");
     fprintf(stderr, "Could not find JCoz Profiler class, did you add the jar to the classpath?\n");
-    exit(-1);
+    return false;
   }
-  logger->info("Found JCozProfiler class. Trying to find register profiler method.");
+  JCOZ_INFO("Found JCozProfiler class. Trying to find register profiler method.");
   jmethodID mid = jni_env->GetStaticMethodID(cls, "registerProfilerWithMBeanServer", "()V");
   if (mid == nullptr){
-    logger->error("Could not find static method to register the mbean.");
+    jni_env->ExceptionClear();
+    JCOZ_ERROR("Could not find static method to register the mbean.");
     fprintf(stderr, "Could not find static method to register the mbean.\n");
-    exit(-1);
+    return false;
   }
-  logger->info("Successfully found JCoz Profiler class and static methodc to register mbean.");
+  JCOZ_INFO("Successfully found JCoz Profiler class and static methodc to register mbean.");
 
   JNINativeMethod methods[] = {
     {(char *)"startProfilingNative",   (char *)"()I",                     (void *)&startProfilingNative},
     {(char *)"endProfilingNative",     (char *)"()I",                     (void *)&endProfilingNative},
     {(char *)"setProgressPointNative", (char *)"(Ljava/lang/String;I)I",  (void *)&setProgressPointNative},
     {(char *)"setScopeNative",         (char *)"(Ljava/lang/String;)I",   (void *)&setScopeNative},
+    {(char *)"getOverheadStatsNative", (char *)"()[J",                    (void *)&getOverheadStatsNative},
+    {(char *)"scheduleExperimentNative", (char *)"(Ljava/lang/String;IFJJ)I", (void *)&scheduleExperimentNative},
+    {(char *)"clearExperimentScheduleNative", (char *)"()I",             (void *)&clearExperimentScheduleNative},
+    {(char *)"getDutyCycleNative",     (char *)"()I",                     (void *)&getDutyCycleNative},
+    {(char *)"hasResultRingNative",    (char *)"()Z",                     (void *)&hasResultRingNative},
+    {(char *)"getProfiledThreadCountNative", (char *)"()I",               (void *)&getProfiledThreadCountNative},
   };
 
   jint err;
-  logger->info("Registering native methods..");
+  JCOZ_INFO("Registering native methods..");
   err = jni_env->RegisterNatives(cls, methods, sizeof(methods)/sizeof(JNINativeMethod));
   if (err != JVMTI_ERROR_NONE){
     fprintf(stderr, "Could not register natives with error %d\n", err);
-    return;
+    return false;
   }
-  logger->info("Registered native methods. Registering profiler with MBean server...");
+  JCOZ_INFO("Registered native methods. Registering profiler with MBean server...");
   jni_env->CallStaticVoidMethod(cls, mid);
-  logger->info("Registered profiler with MBean server...");
+  if (jni_env->ExceptionCheck()) {
+    jni_env->ExceptionDescribe();
+    jni_env->ExceptionClear();
+    JCOZ_ERROR("Registering the profiler with the MBean server threw");
+    return false;
+  }
+  JCOZ_INFO("Registered profiler with MBean server...");
+  return true;
+}
+
+void JNICALL OnVMInit(jvmtiEnv *jvmti, JNIEnv *jni_env, jthread thread) {
+  IMPLICITLY_USE(jvmti);
+  IMPLICITLY_USE(thread);
+
+  // register mbean
+  if (!RegisterProfilerClass(jni_env)) {
+    if (!AgentOptions::Headless()) {
+      exit(-1);
+    }
+    JCOZ_WARN("Continuing headless without the JCoz MBean");
+  }
+  if (AgentOptions::Headless()) {
+    StartHeadless(jni_env);
+  }
+}
+
+// Forces the creation of jmethodIDs for every class loaded so far, so
+// that AsyncGetCallTrace can name the frames of classes that were
+// prepared before the agent was attached.
+static void CreateJMethodIDsForLoadedClasses(jvmtiEnv *jvmti) {
+  jint class_count;
+  JvmtiScopedPtr<jclass> classes(jvmti);
+  JVMTI_ERROR(jvmti->GetLoadedClasses(&class_count, classes.GetRef()));
+  jclass *classList = classes.Get();
+  for (int i = 0; i < class_count; ++i) {
+    jint method_count;
+    JvmtiScopedPtr<jmethodID> methods(jvmti);
+    jvmti->GetClassMethods(classList[i], &method_count, methods.GetRef());
+  }
+  JCOZ_INFO("Created method IDs for {} loaded classes", class_count);
 }
 
 void JNICALL OnClassPrepare(jvmtiEnv *jvmti_env, JNIEnv *jni_env,
@@ -280,6 +510,39 @@ void JNICALL OnClassPrepare(jvmtiEnv *jvmti_env, JNIEnv *jni_env,
   CreateJMethodIDsForClass(jvmti_env, klass);
 }
 
+void JNICALL OnCompiledMethodLoad(jvmtiEnv *jvmti_env, jmethodID method,
+    jint code_size, const void *code_addr, jint map_length,
+    const jvmtiAddrLocationMap *map, const void *compile_info) {
+  IMPLICITLY_USE(jvmti_env);
+  IMPLICITLY_USE(code_size);
+  IMPLICITLY_USE(code_addr);
+  IMPLICITLY_USE(map_length);
+  IMPLICITLY_USE(map);
+  IMPLICITLY_USE(compile_info);
+  JitActivity::OnCompiledMethodLoad(method);
+  Timeline::RecordShared(Timeline::Shared(), kTimelineCompile, method, 0, 0);
+}
+
+void JNICALL OnCompiledMethodUnload(jvmtiEnv *jvmti_env, jmethodID method,
+    const void *code_addr) {
+  IMPLICITLY_USE(jvmti_env);
+  IMPLICITLY_USE(code_addr);
+  JitActivity::OnCompiledMethodUnload(method);
+  Timeline::RecordShared(Timeline::Shared(), kTimelineUnload, method, 0, 0);
+}
+
+void JNICALL OnGarbageCollectionStart(jvmtiEnv *jvmti_env) {
+  IMPLICITLY_USE(jvmti_env);
+  GcPauses::OnStart();
+  Timeline::RecordShared(Timeline::Shared(), kTimelineGcStart, NULL, 0, 0);
+}
+
+void JNICALL OnGarbageCollectionFinish(jvmtiEnv *jvmti_env) {
+  IMPLICITLY_USE(jvmti_env);
+  GcPauses::OnFinish();
+  Timeline::RecordShared(Timeline::Shared(), kTimelineGcFinish, NULL, 0, 0);
+}
+
 void JNICALL OnVMDeath(jvmtiEnv *jvmti_env, JNIEnv *jni_env) {
   IMPLICITLY_USE(jvmti_env);
   IMPLICITLY_USE(jni_env);
@@ -287,7 +550,9 @@ void JNICALL OnVMDeath(jvmtiEnv *jvmti_env, JNIEnv *jni_env) {
   //  prof->printInScopeLineNumberMapping();
 
   // prof->clearProgressPoint();
-  prof->Stop();
+  if (prof != NULL) {
+    prof->Stop();
+  }
 
 }
 
@@ -304,6 +569,8 @@ static bool PrepareJvmti(jvmtiEnv *jvmti) {
   caps.can_get_bytecodes = 1;
   caps.can_get_constant_pool = 1;
   caps.can_generate_breakpoint_events = 1;
+  caps.can_generate_compiled_method_load_events = 1;
+  caps.can_generate_garbage_collection_events = 1;
 
   jvmtiCapabilities all_caps;
   memset(&all_caps, 0, sizeof(all_caps));
@@ -325,6 +592,14 @@ static bool PrepareJvmti(jvmtiEnv *jvmti) {
       }
     }
 
+#ifdef JCOZ_VIRTUAL_THREADS
+    // Optional: older VMs have no virtual threads to follow.
+    if (all_caps.can_support_virtual_threads) {
+      caps.can_support_virtual_threads = 1;
+      virtual_threads = true;
+    }
+#endif
+
     // This adds the capabilities.
     if ((error = jvmti->AddCapabilities(&caps)) != JVMTI_ERROR_NONE) {
       fprintf(stderr, "Failed to add capabilities with error %d\n", error);
@@ -336,8 +611,7 @@ static bool PrepareJvmti(jvmtiEnv *jvmti) {
 
 static bool RegisterJvmti(jvmtiEnv *jvmti) {
   // Create the list of callbacks to be called on given events.
-  auto logger = prof->getLogger();
-  logger->info("Registering jvmtiEventCallbacks in RegisterJvmti");
+  JCOZ_INFO("Registering jvmtiEventCallbacks in RegisterJvmti");
   jvmtiEventCallbacks *callbacks = new jvmtiEventCallbacks();
   memset(callbacks, 0, sizeof(jvmtiEventCallbacks));
 
@@ -350,25 +624,54 @@ static bool RegisterJvmti(jvmtiEnv *jvmti) {
   callbacks->ClassPrepare = &OnClassPrepare;
   callbacks->Breakpoint = &(Profiler::HandleBreakpoint);
 
+  callbacks->CompiledMethodLoad = &OnCompiledMethodLoad;
+  callbacks->CompiledMethodUnload = &OnCompiledMethodUnload;
+
+  callbacks->GarbageCollectionStart = &OnGarbageCollectionStart;
+  callbacks->GarbageCollectionFinish = &OnGarbageCollectionFinish;
+
   JVMTI_ERROR_1(
       (jvmti->SetEventCallbacks(callbacks, sizeof(jvmtiEventCallbacks))),
       false);
 
   jvmtiEvent events[] = {JVMTI_EVENT_CLASS_LOAD, JVMTI_EVENT_BREAKPOINT,
     JVMTI_EVENT_THREAD_END, JVMTI_EVENT_THREAD_START,
-    JVMTI_EVENT_VM_DEATH, JVMTI_EVENT_VM_INIT};
+    JVMTI_EVENT_VM_DEATH, JVMTI_EVENT_VM_INIT,
+    JVMTI_EVENT_COMPILED_METHOD_LOAD, JVMTI_EVENT_COMPILED_METHOD_UNLOAD,
+    JVMTI_EVENT_GARBAGE_COLLECTION_START, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH};
 
   size_t num_events = sizeof(events) / sizeof(jvmtiEvent);
 
   // Enable the callbacks to be triggered when the events occur.
   // Events are enumerated in jvmstatagent.h
-  logger->info("Setting event notification mode to JVMTI_ENABLE in Register Jvmti");
+  JCOZ_INFO("Setting event notification mode to JVMTI_ENABLE in Register Jvmti");
   for (int i = 0; i < num_events; i++) {
     JVMTI_ERROR_1(
         (jvmti->SetEventNotificationMode(JVMTI_ENABLE, events[i], NULL)),
         false);
   }
-  logger->info("Event notifications successfully enabled");
+  JCOZ_INFO("Event notifications successfully enabled");
+
+#ifdef JCOZ_VIRTUAL_THREADS
+  if (virtual_threads) {
+    callbacks->VirtualThreadStart = &OnVirtualThreadStart;
+    callbacks->VirtualThreadEnd = &OnVirtualThreadEnd;
+    JVMTI_ERROR_1(
+        (jvmti->SetEventCallbacks(callbacks, sizeof(jvmtiEventCallbacks))),
+        false);
+    // Without mount events a virtual thread's debt would stay with the
+    // carrier it started on, so follow all of them or none.
+    if (RegisterMountEvents(jvmti)
+        && jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+          JVMTI_EVENT_VIRTUAL_THREAD_START, NULL) == JVMTI_ERROR_NONE
+        && jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+          JVMTI_EVENT_VIRTUAL_THREAD_END, NULL) == JVMTI_ERROR_NONE) {
+      JCOZ_INFO("Following virtual threads across carriers");
+    } else {
+      JCOZ_WARN("Virtual thread events unavailable, virtual threads will not be profiled");
+    }
+  }
+#endif
 
   return true;
 }
@@ -400,14 +703,30 @@ static void SetFileFromOption(char *equals) {
   delete[] file_name;
 }
 
-AGENTEXPORT jint JNICALL Agent_OnLoad(JavaVM *vm, char *options,
-    void *reserved) {
-  IMPLICITLY_USE(reserved);
+// Sets up everything Agent_OnLoad and Agent_OnAttach have in common.
+// Returns what Agent_OnLoad should return; prof is only set if the
+// agent got far enough to profile.
+static jint InitAgent(JavaVM *vm, char *options) {
   int err;
   jvmtiEnv *jvmti;
 
   Accessors::Init();
 
+  if (!AgentOptions::Parse(options)) {
+    Profiler::print_usage();
+    return 1;
+  }
+
+  if (!AgentLogger::Init(AgentOptions::log_file, AgentOptions::log_max_bytes,
+        AgentOptions::log_max_files)) {
+    fprintf(stderr, "Failed to open the JCoz log.  Continuing without it...\n");
+  }
+
+  if (!AgentOptions::ring_file.empty()
+      && !ResultRing::Open(AgentOptions::ring_file, AgentOptions::ring_records)) {
+    fprintf(stderr, "Failed to create the JCoz result ring.  Continuing without it...\n");
+  }
+
   if ((err = (vm->GetEnv(reinterpret_cast<void **>(&jvmti), JVMTI_VERSION))) != JNI_OK ) {
     return 1;
   }
@@ -428,16 +747,73 @@ AGENTEXPORT jint JNICALL Agent_OnLoad(JavaVM *vm, char *options,
   Asgct::SetAsgct(Accessors::GetJvmFunction<ASGCTType>("AsyncGetCallTrace"));
 
   prof = new Profiler(jvmti);
-  auto logger = prof->getLogger();
 
   prof->setJVMTI(jvmti);
   prof->init();
+  return 0;
+}
+
+AGENTEXPORT jint JNICALL Agent_OnLoad(JavaVM *vm, char *options,
+    void *reserved) {
+  IMPLICITLY_USE(reserved);
+  jint err = InitAgent(vm, options);
+  if (prof != NULL) {
+    JCOZ_INFO("Successfully loaded agent.");
+  }
+  return err;
+}
+
+// Loads the agent into a JVM that is already running, e.g. through
+// VirtualMachine.loadAgentPath.  VMInit has long passed, so what it does
+// for Agent_OnLoad happens here, and the threads and classes that
+// ThreadStart and ClassPrepare have missed are picked up.
+AGENTEXPORT jint JNICALL Agent_OnAttach(JavaVM *vm, char *options,
+    void *reserved) {
+  IMPLICITLY_USE(reserved);
+  if (prof != NULL) {
+    // A second attach finds the library, and the profiler, in place.
+    JCOZ_INFO("Agent is already loaded.");
+    return 0;
+  }
+
+  jint err = InitAgent(vm, options);
+  if (prof == NULL) {
+    return err != 0 ? err : 1;
+  }
+
+  JNIEnv *jni_env;
+  if (vm->GetEnv(reinterpret_cast<void **>(&jni_env), JNI_VERSION_1_6) != JNI_OK) {
+    return 1;
+  }
+
+  jvmtiEnv *jvmti = prof->getJVMTI();
+  if (!AgentOptions::agent_jar.empty()) {
+    JCOZ_INFO("Adding {} to the system class path", AgentOptions::agent_jar);
+    JVMTI_ERROR_1(
+        jvmti->AddToSystemClassLoaderSearch(AgentOptions::agent_jar.c_str()),
+        1);
+  }
+
+  CreateJMethodIDsForLoadedClasses(jvmti);
+
+  if (!RegisterProfilerClass(jni_env)) {
+    if (!AgentOptions::Headless()) {
+      return 1;
+    }
+    JCOZ_WARN("Continuing headless without the JCoz MBean");
+  }
+  Profiler::adoptRunningThreads(vm, jni_env);
+  if (AgentOptions::Headless()) {
+    StartHeadless(jni_env);
+  }
 
-  logger->info("Successfully loaded agent.");
+  JCOZ_INFO("Successfully attached agent.");
   return 0;
 }
 
 AGENTEXPORT void JNICALL Agent_OnUnload(JavaVM *vm) {
   IMPLICITLY_USE(vm);
+  ResultRing::Close();
+  AgentLogger::Shutdown();
   Accessors::Destroy();
 }
@@ -0,0 +1,124 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "framescan.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#include <algorithm>
+
+// A JVMPI_CallFrame is 16 bytes on 64-bit targets: the bci, four bytes
+// of padding, then the jmethodID in the high half.  The vector scans
+// below rely on that.
+#if defined(__x86_64__)
+#define JCOZ_VECTOR_SCAN 1
+#endif
+
+static int FindMethodScalar(const JVMPI_CallFrame *frames, int num_frames,
+    jmethodID method, int start) {
+  for (int i = start; i < num_frames; i++) {
+    if (frames[i].method_id == method) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+#ifdef JCOZ_VECTOR_SCAN
+
+// Two frames per step.  SSE2 has no 64-bit compare, so compare 32-bit
+// halves and require both to match.
+static int FindMethodSse2(const JVMPI_CallFrame *frames, int num_frames,
+    jmethodID method, int start) {
+  const __m128i target = _mm_set1_epi64x((long long) (uintptr_t) method);
+  int i = start;
+  for (; i + 2 <= num_frames; i += 2) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&frames[i]));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&frames[i + 1]));
+    __m128i ids = _mm_unpackhi_epi64(a, b);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi32(ids, target));
+    if ((mask & 0x00ff) == 0x00ff) {
+      return i;
+    }
+    if ((mask & 0xff00) == 0xff00) {
+      return i + 1;
+    }
+  }
+  return FindMethodScalar(frames, num_frames, method, i);
+}
+
+// Four frames per step.  Within each 128-bit lane unpackhi pairs up the
+// ids of frames i and i + 2, and of i + 1 and i + 3, so mask bits 0-3
+// stand for frames i, i + 2, i + 1, i + 3.
+__attribute__((target("avx2")))
+static int FindMethodAvx2(const JVMPI_CallFrame *frames, int num_frames,
+    jmethodID method, int start) {
+  const __m256i target = _mm256_set1_epi64x((long long) (uintptr_t) method);
+  int i = start;
+  for (; i + 4 <= num_frames; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&frames[i]));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&frames[i + 2]));
+    __m256i ids = _mm256_unpackhi_epi64(a, b);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(ids, target)));
+    if (mask != 0) {
+      int in_order = (mask & 0x9) | ((mask & 0x2) << 1) | ((mask & 0x4) >> 1);
+      return i + __builtin_ctz(in_order);
+    }
+  }
+  return FindMethodSse2(frames, num_frames, method, i);
+}
+
+#endif  // JCOZ_VECTOR_SCAN
+
+FrameScan::FindMethodFn FrameScan::find_method_ = &FindMethodScalar;
+const char *FrameScan::isa_ = "scalar";
+
+void FrameScan::Init() {
+#ifdef JCOZ_VECTOR_SCAN
+  static_assert(sizeof(JVMPI_CallFrame) == 16, "vector scan needs 16-byte frames");
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    find_method_ = &FindMethodAvx2;
+    isa_ = "avx2";
+  } else {
+    find_method_ = &FindMethodSse2;
+    isa_ = "sse2";
+  }
+#endif
+}
+
+static bool RangeBefore(const LocationRange &a, const LocationRange &b) {
+  return a.first < b.first;
+}
+
+int FrameScan::NormalizeRanges(LocationRange *ranges, int num_ranges) {
+  if (num_ranges == 0) {
+    return 0;
+  }
+  std::sort(ranges, ranges + num_ranges, RangeBefore);
+  int merged = 0;
+  for (int i = 1; i < num_ranges; i++) {
+    if (ranges[i].first <= ranges[merged].second) {
+      ranges[merged].second = std::max(ranges[merged].second, ranges[i].second);
+    } else {
+      ranges[++merged] = ranges[i];
+    }
+  }
+  return merged + 1;
+}
@@ -0,0 +1,127 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <utility>
+
+#include <jvmti.h>
+
+#include "globals.h"
+#include "stacktraces.h"
+
+#ifndef FRAMESCAN_H
+#define FRAMESCAN_H
+
+// Size of the in-scope method filter.  With two hash functions this
+// keeps false positives under 10% for about ten thousand methods.
+static const int kMethodFilterBits = 1 << 16;
+static const int kMethodFilterWords = kMethodFilterBits / 64;
+
+// A Bloom filter over in-scope jmethodIDs, so the signal handler can
+// throw out most frames without the lock or the hash set.  Adds and
+// lookups are lock-free; a lookup racing an Add may miss the method,
+// which costs one sample.
+class MethodFilter {
+  public:
+    void Add(jmethodID method) {
+      uint64_t hash = Hash(method);
+      SetBit(hash >> 48);
+      SetBit((hash >> 16) & 0xffff);
+    }
+
+    bool MayContain(jmethodID method) const {
+      uint64_t hash = Hash(method);
+      return GetBit(hash >> 48) && GetBit((hash >> 16) & 0xffff);
+    }
+
+    void Clear() {
+      for (int i = 0; i < kMethodFilterWords; i++) {
+        words_[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    static uint64_t Hash(jmethodID method) {
+      return (uint64_t) (uintptr_t) method * 0x9E3779B97F4A7C15ULL;
+    }
+
+    void SetBit(uint64_t bit) {
+      words_[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+    }
+
+    bool GetBit(uint64_t bit) const {
+      return (words_[bit / 64].load(std::memory_order_relaxed) >> (bit % 64)) & 1;
+    }
+
+    std::atomic<uint64_t> words_[kMethodFilterWords];
+};
+
+typedef std::pair<jint, jint> LocationRange;
+
+class FrameScan {
+  public:
+    // Picks the widest method scan the CPU supports.  Call once before
+    // the first signal.
+    static void Init();
+
+    // Index of the first frame at or after start whose method is
+    // method, or -1.
+    static int FindMethod(const JVMPI_CallFrame *frames, int num_frames,
+        jmethodID method, int start) {
+      return find_method_(frames, num_frames, method, start);
+    }
+
+    // Sorts ranges and merges any that touch, in place.  Returns the
+    // new number of ranges.
+    static int NormalizeRanges(LocationRange *ranges, int num_ranges);
+
+    // Whether bci falls in one of ranges, which must be normalized.
+    // Ranges are [first, second).
+    static bool InRanges(const LocationRange *ranges, int num_ranges, jint bci) {
+      int lo = 0;
+      int hi = num_ranges;
+      // Find the last range starting at or before bci.
+      while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ranges[mid].first <= bci) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      return lo > 0 && bci < ranges[lo - 1].second;
+    }
+
+    // Name of the method scan in use, for the log.
+    static const char *Isa() { return isa_; }
+
+  private:
+    typedef int (*FindMethodFn)(const JVMPI_CallFrame *, int, jmethodID, int);
+
+    static FindMethodFn find_method_;
+
+    static const char *isa_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(FrameScan);
+};
+
+#endif  // FRAMESCAN_H
@@ -0,0 +1,47 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "gc.h"
+
+#include "stats.h"
+
+std::atomic<uint64_t> GcPauses::pause_start_ns_(0);
+std::atomic<uint64_t> GcPauses::total_ns_(0);
+std::atomic<unsigned long> GcPauses::count_(0);
+
+void GcPauses::OnStart() {
+  pause_start_ns_.store(ProfilerStats::Now(), std::memory_order_release);
+}
+
+void GcPauses::OnFinish() {
+  uint64_t start = pause_start_ns_.exchange(0, std::memory_order_acq_rel);
+  if (start == 0) {
+    // The agent was attached during this pause.
+    return;
+  }
+  total_ns_.fetch_add(ProfilerStats::Now() - start, std::memory_order_release);
+  count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t GcPauses::TotalNs() {
+  uint64_t total = total_ns_.load(std::memory_order_acquire);
+  uint64_t start = pause_start_ns_.load(std::memory_order_acquire);
+  uint64_t now = ProfilerStats::Now();
+  // A pause that ends between the two loads is counted in neither until
+  // the next call.
+  return start != 0 && now > start ? total + (now - start) : total;
+}
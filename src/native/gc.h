@@ -0,0 +1,59 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "globals.h"
+
+#ifndef GC_H
+#define GC_H
+
+// Adds up stop-the-world garbage collection pauses, so that an
+// experiment can tell how much of its wall time the collector took.
+// GarbageCollectionStart and GarbageCollectionFinish are sent by the VM
+// thread at a safepoint, where nothing but the JVMTI environment may be
+// used, so the callbacks only read the clock and store.
+class GcPauses {
+  public:
+    static void OnStart();
+
+    static void OnFinish();
+
+    // Nanoseconds spent in pauses so far, including the one in progress.
+    static uint64_t TotalNs();
+
+    // Pauses finished so far.
+    static unsigned long Count() {
+      return count_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // When the current pause began, or 0 outside a pause.
+    static std::atomic<uint64_t> pause_start_ns_;
+
+    static std::atomic<uint64_t> total_ns_;
+
+    static std::atomic<unsigned long> count_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(GcPauses);
+};
+
+#endif  // GC_H
@@ -239,15 +239,15 @@ inline intptr_t NoBarrier_AtomicIncrement(volatile intptr_t* ptr,
 
 // Things that should probably be user-configurable
 
-// Number of times per second that we profile
-static const int kNumInterrupts = 100;
-
 // Maximum number of stack traces
 static const int kMaxStackTraces = 3000;
 
 // Maximum number of frames to store from the stack traces sampled.
 static const int kMaxFramesToCapture = 128;
 
+// Maximum number of live application threads we will profile at once.
+static const int kMaxUserThreads = 16384;
+
 // Location where the data are dumped.
 static const char kDefaultOutFile[] = "traces.txt";
 
@@ -0,0 +1,183 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "governor.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+#include "logger.h"
+#include "options.h"
+#include "stats.h"
+#include "userthreads.h"
+
+std::atomic<long> OverheadGovernor::period_ns_(OverheadGovernor::kMinPeriodNs);
+std::atomic<int> OverheadGovernor::threads_per_tick_(kMaxUserThreads);
+uint64_t OverheadGovernor::last_update_ns_ = 0;
+uint64_t OverheadGovernor::last_cost_ns_ = 0;
+double OverheadGovernor::last_overhead_ = 0;
+
+// Reads "<quota> <period>" (cgroup v2 cpu.max) or a lone number (the
+// cgroup v1 files).  Returns false if the file is missing or says "max".
+static bool ReadQuotaFile(const std::string &path, long *first, long *second) {
+  FILE *file = fopen(path.c_str(), "r");
+  if (file == NULL) {
+    return false;
+  }
+  char buf[64];
+  bool ok = fgets(buf, sizeof(buf), file) != NULL;
+  fclose(file);
+  if (!ok || strncmp(buf, "max", 3) == 0) {
+    return false;
+  }
+  char *end;
+  *first = strtol(buf, &end, 10);
+  if (second != NULL) {
+    *second = strtol(end, NULL, 10);
+  }
+  return true;
+}
+
+// The v2 cgroup of this process, e.g. "/system.slice/app.service", or
+// empty if it is not in one.
+static std::string CgroupV2Path() {
+  FILE *file = fopen("/proc/self/cgroup", "r");
+  if (file == NULL) {
+    return "";
+  }
+  char line[512];
+  std::string path;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    if (strncmp(line, "0::", 3) == 0) {
+      path = line + 3;
+      path.erase(path.find_last_not_of("\n") + 1);
+      break;
+    }
+  }
+  fclose(file);
+  return path == "/" ? "" : path;
+}
+
+// CPUs allowed by the cgroup quota, or 0 if there is no quota.
+static double CgroupCpus() {
+  long quota, period;
+  std::string v2 = CgroupV2Path();
+  // Inside a container the process's own cgroup is mounted at the root.
+  if ((!v2.empty() && ReadQuotaFile("/sys/fs/cgroup" + v2 + "/cpu.max", &quota, &period))
+      || ReadQuotaFile("/sys/fs/cgroup/cpu.max", &quota, &period)) {
+    return period > 0 ? (double) quota / period : 0;
+  }
+  const char *v1_dirs[] = {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"};
+  for (int i = 0; i < 2; i++) {
+    std::string dir = v1_dirs[i];
+    if (ReadQuotaFile(dir + "/cpu.cfs_quota_us", &quota, NULL)
+        && ReadQuotaFile(dir + "/cpu.cfs_period_us", &period, NULL)) {
+      // A quota of -1 means none.
+      return quota > 0 && period > 0 ? (double) quota / period : 0;
+    }
+  }
+  return 0;
+}
+
+double OverheadGovernor::AvailableCpus() {
+  double cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t mask;
+  if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+    cpus = CPU_COUNT(&mask);
+  }
+  double quota = CgroupCpus();
+  if (quota > 0 && quota < cpus) {
+    cpus = quota;
+  }
+  return std::max(cpus, 0.01);
+}
+
+uint64_t OverheadGovernor::MeasuredCost() {
+  // Handler time excludes sleeping off delays, which is the experiment
+  // rather than overhead; the agent cycle is the time spent signaling.
+  // What the kernel spends delivering each signal, building the frame
+  // before the handler and unwinding it in sigreturn after, happens
+  // outside both clocks and is left out.  It is a few microseconds a
+  // signal at most, but it makes this an underestimate; the gap between
+  // sending and handler entry would not measure it either, as that is
+  // mostly the target waiting to be scheduled.
+  uint64_t stats[kStatsLength];
+  ProfilerStats::Snapshot(stats);
+  return stats[kStatsHandlerLatency + kHistogramBuckets + 1]
+    + stats[kStatsAgentCycle + kHistogramBuckets + 1];
+}
+
+void OverheadGovernor::Reset() {
+  period_ns_.store(kMinPeriodNs, std::memory_order_relaxed);
+  threads_per_tick_.store(kMaxUserThreads, std::memory_order_relaxed);
+  last_update_ns_ = ProfilerStats::Now();
+  last_cost_ns_ = MeasuredCost();
+  last_overhead_ = 0;
+}
+
+void OverheadGovernor::Update() {
+  if (AgentOptions::max_overhead <= 0) {
+    return;
+  }
+  uint64_t now = ProfilerStats::Now();
+  if (now - last_update_ns_ < kUpdateIntervalNs) {
+    return;
+  }
+  uint64_t cost = MeasuredCost();
+  double cpus = AvailableCpus();
+  double overhead = 100.0 * (cost - last_cost_ns_) / ((now - last_update_ns_) * cpus);
+  last_update_ns_ = now;
+  last_cost_ns_ = cost;
+  last_overhead_ = overhead;
+
+  // Cost is close to proportional to the signal rate, so scale by how
+  // far off we are, at most doubling or halving at a time.
+  double ratio = overhead / AgentOptions::max_overhead;
+  long period = PeriodNs();
+  int threads = ThreadsPerTick();
+  if (ratio > 1) {
+    double factor = std::min(ratio, 2.0);
+    if (period < kMaxPeriodNs) {
+      period = std::min(kMaxPeriodNs, (long) (period * factor));
+    } else {
+      int high_water = UserThreadSlab::HighWater();
+      threads = std::max(1, (int) (std::min(threads, high_water) / factor));
+    }
+  } else if (ratio < 0.5) {
+    // Back off below half the budget only, so we do not oscillate.
+    double factor = ratio > 0 ? std::min(0.5 / ratio, 2.0) : 2.0;
+    if (threads < kMaxUserThreads) {
+      threads = threads * factor >= UserThreadSlab::HighWater()
+        ? kMaxUserThreads : (int) (threads * factor) + 1;
+    } else {
+      period = std::max(kMinPeriodNs, (long) (period / factor));
+    }
+  }
+
+  if (period != PeriodNs() || threads != ThreadsPerTick()) {
+    JCOZ_INFO("Overhead {:.2f}% of {:.2f} CPUs; sampling every {} us, {} threads per tick",
+        overhead, cpus, period / 1000,
+        threads == kMaxUserThreads ? UserThreadSlab::HighWater() : threads);
+    period_ns_.store(period, std::memory_order_relaxed);
+    threads_per_tick_.store(threads, std::memory_order_relaxed);
+  }
+}
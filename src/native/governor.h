@@ -0,0 +1,90 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "globals.h"
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+// Keeps the cost of sampling under AgentOptions::max_overhead percent of
+// the CPU the JVM may use.  Cost is what the signal handlers and the
+// agent's signaling loop measure in ProfilerStats, which leaves out the
+// kernel's own cost of delivering each signal; the CPU budget is the
+// cgroup CPU quota, or the CPUs we may run on if there is none.
+//
+// Over budget, the governor first stretches the sampling period, then
+// signals fewer threads per tick outside experiments.  Under budget it
+// undoes both, never sampling faster than kMinPeriodNs.  Only the agent
+// thread calls Update, and only between experiments, so an experiment
+// runs at one period from start to end.
+class OverheadGovernor {
+  public:
+    // The fixed period the agent used to have.
+    static const long kMinPeriodNs = 1000000L;
+
+    static const long kMaxPeriodNs = 50000000L;
+
+    // Starts again from kMinPeriodNs with every thread signaled.
+    static void Reset();
+
+    // Re-measures the overhead and adjusts; does nothing unless
+    // kUpdateIntervalNs has passed since the last adjustment.
+    static void Update();
+
+    static long PeriodNs() {
+      return period_ns_.load(std::memory_order_relaxed);
+    }
+
+    // Threads to signal per tick outside experiments.
+    static int ThreadsPerTick() {
+      return threads_per_tick_.load(std::memory_order_relaxed);
+    }
+
+    // Overhead measured by the last Update, as a percentage.
+    static double LastOverhead() { return last_overhead_; }
+
+    // CPUs the process may use: the cgroup quota if there is one, or the
+    // size of the affinity mask.
+    static double AvailableCpus();
+
+  private:
+    static const uint64_t kUpdateIntervalNs = 1000000000ULL;
+
+    // Nanoseconds of sampling cost recorded so far.
+    static uint64_t MeasuredCost();
+
+    static std::atomic<long> period_ns_;
+
+    static std::atomic<int> threads_per_tick_;
+
+    static uint64_t last_update_ns_;
+
+    static uint64_t last_cost_ns_;
+
+    static double last_overhead_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(OverheadGovernor);
+};
+
+#endif  // GOVERNOR_H
@@ -0,0 +1,83 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "jit.h"
+
+#include <algorithm>
+
+#include "options.h"
+#include "stats.h"
+
+std::atomic<unsigned long> JitActivity::events_(0);
+std::atomic<jmethodID> JitActivity::watched_(NULL);
+std::atomic<unsigned long> JitActivity::watched_events_(0);
+uint64_t JitActivity::last_update_ns_ = 0;
+unsigned long JitActivity::last_events_ = 0;
+double JitActivity::rate_ = 0;
+bool JitActivity::measured_ = false;
+double JitActivity::threshold_ = 0;
+
+void JitActivity::Count(jmethodID method) {
+  events_.fetch_add(1, std::memory_order_relaxed);
+  if (method != NULL && method == watched_.load(std::memory_order_relaxed)) {
+    watched_events_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void JitActivity::OnCompiledMethodLoad(jmethodID method) {
+  Count(method);
+}
+
+void JitActivity::OnCompiledMethodUnload(jmethodID method) {
+  Count(method);
+}
+
+void JitActivity::Reset() {
+  watched_ = NULL;
+  watched_events_ = 0;
+  last_update_ns_ = ProfilerStats::Now();
+  last_events_ = Events();
+  rate_ = 0;
+  measured_ = false;
+  threshold_ = AgentOptions::jit_settle;
+}
+
+void JitActivity::Update() {
+  uint64_t now = ProfilerStats::Now();
+  if (now - last_update_ns_
+      < (measured_ ? kUpdateIntervalNs : kFirstUpdateIntervalNs)) {
+    return;
+  }
+  unsigned long events = Events();
+  rate_ = (events - last_events_) * 1e9 / (now - last_update_ns_);
+  last_events_ = events;
+  last_update_ns_ = now;
+  measured_ = true;
+}
+
+bool JitActivity::Busy() {
+  return AgentOptions::jit_settle > 0 && (!measured_ || rate_ > threshold_);
+}
+
+void JitActivity::Tolerate() {
+  threshold_ = std::max(threshold_, 2 * rate_);
+}
+
+void JitActivity::Watch(jmethodID method) {
+  watched_.store(method, std::memory_order_relaxed);
+  watched_events_.store(0, std::memory_order_relaxed);
+}
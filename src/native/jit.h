@@ -0,0 +1,111 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jvmti.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+
+#include "globals.h"
+
+#ifndef JIT_H
+#define JIT_H
+
+// Counts JIT compiler activity, so that experiments neither start while
+// the compilers are busy nor keep results from a window in which the
+// code under test was recompiled.  A method is loaded when it is
+// compiled, at each tier, and unloaded some time after it is deoptimized
+// or replaced, so either event on the experiment's method means its
+// speed changed partway through.
+//
+// The On* callbacks run on compiler and VM threads; everything else is
+// for the agent thread.
+class JitActivity {
+  public:
+    static void OnCompiledMethodLoad(jmethodID method);
+
+    static void OnCompiledMethodUnload(jmethodID method);
+
+    // Forgets the rate and the watched method.
+    static void Reset();
+
+    // Loads and unloads so far.
+    static unsigned long Events() {
+      return events_.load(std::memory_order_relaxed);
+    }
+
+    // Re-measures the rate; does nothing unless kUpdateIntervalNs has
+    // passed since the last measurement, or kFirstUpdateIntervalNs since
+    // Reset.
+    static void Update();
+
+    // Loads and unloads a second, as of the last Update.
+    static double Rate() { return rate_; }
+
+    // Loads and unloads a second above which the JIT is busy: at first
+    // AgentOptions::jit_settle, then raised by Tolerate.
+    static double Threshold() { return threshold_; }
+
+    // True until the rate has been measured once since Reset, then while
+    // the rate is above Threshold.  Always false if jit_settle is 0.
+    static bool Busy();
+
+    // Raises Threshold to twice the current rate, for programs that keep
+    // compiling long after startup, so only a burst above their normal
+    // level counts as busy from now on.
+    static void Tolerate();
+
+    // Counts loads and unloads of method from now on, until the next
+    // Watch.  NULL watches nothing.
+    static void Watch(jmethodID method);
+
+    // Loads and unloads of the watched method since Watch.
+    static unsigned long WatchedEvents() {
+      return watched_events_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static const uint64_t kUpdateIntervalNs = 1000000000ULL;
+
+    // Short, so that a program the JIT has finished with is not held up
+    // for a full interval at startup.
+    static const uint64_t kFirstUpdateIntervalNs = 100000000ULL;
+
+    static void Count(jmethodID method);
+
+    static std::atomic<unsigned long> events_;
+
+    static std::atomic<jmethodID> watched_;
+
+    static std::atomic<unsigned long> watched_events_;
+
+    static uint64_t last_update_ns_;
+
+    static unsigned long last_events_;
+
+    static double rate_;
+
+    static bool measured_;
+
+    static double threshold_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(JitActivity);
+};
+
+#endif  // JIT_H
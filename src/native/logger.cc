@@ -0,0 +1,297 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "logger.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+// How often the writer wakes up on its own to drain the rings.
+#define WRITER_PERIOD_MS 50
+
+static const int kRingFree = 0;
+static const int kRingOwned = 1;
+static const int kRingOrphaned = 2;
+
+LogRing *AgentLogger::rings_ = NULL;
+std::atomic<bool> AgentLogger::running_(false);
+std::atomic<uint64_t> AgentLogger::dropped_(0);
+
+// Writer state; only touched by the writer thread once it is running.
+static FILE *log_file = NULL;
+static std::string log_path;
+static long log_bytes = 0;
+static long log_max_bytes = 0;
+static int log_max_files = 0;
+static uint64_t reported_dropped = 0;
+static std::vector<LogRecord> pending;
+
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wakeup = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writer_done = PTHREAD_COND_INITIALIZER;
+static uint64_t flush_requested = 0;
+static uint64_t flush_completed = 0;
+static bool writer_stop = false;
+
+static const char *level_names[] = {"debug", "info", "warning", "error"};
+
+// Hands a ring back to the pool when its owning thread exits.  The
+// writer drains whatever is left before reusing it.
+class RingHolder {
+  public:
+    RingHolder() : ring(NULL) {}
+
+    ~RingHolder() {
+      if (ring != NULL) {
+        ring->state.store(kRingOrphaned, std::memory_order_release);
+      }
+    }
+
+    LogRing *ring;
+};
+
+static thread_local RingHolder ring_holder;
+
+LogRing *AgentLogger::CurrentRing() {
+  LogRing *ring = ring_holder.ring;
+  if (ring != NULL) {
+    return ring;
+  }
+
+  for (int i = 0; i < kLogRings; i++) {
+    int expected = kRingFree;
+    if (rings_[i].state.compare_exchange_strong(expected, kRingOwned,
+          std::memory_order_acq_rel, std::memory_order_relaxed)) {
+      ring_holder.ring = &rings_[i];
+      return ring_holder.ring;
+    }
+  }
+  return NULL;
+}
+
+void AgentLogger::Append(LogLevel level, const char *message, size_t length) {
+  LogRing *ring = CurrentRing();
+  if (ring == NULL) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  uint32_t head = ring->head.load(std::memory_order_acquire);
+  if (tail - head >= (uint32_t) kLogRingRecords) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  LogRecord &record = ring->records[tail % kLogRingRecords];
+  record.timestamp_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+  record.level = level;
+  record.length = (int32_t) length;
+  memcpy(record.message, message, length);
+  ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+static bool RecordOlder(const LogRecord &a, const LogRecord &b) {
+  return a.timestamp_ns < b.timestamp_ns;
+}
+
+void AgentLogger::WriteRecord(const LogRecord &record) {
+  time_t seconds = (time_t) (record.timestamp_ns / 1000000000ULL);
+  int millis = (int) ((record.timestamp_ns / 1000000ULL) % 1000);
+  struct tm local;
+  localtime_r(&seconds, &local);
+
+  char stamp[32];
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+  int written = fprintf(log_file, "[%s.%03d] [%s] %.*s\n", stamp, millis,
+      level_names[record.level], record.length, record.message);
+  if (written > 0) {
+    log_bytes += written;
+  }
+  if (log_bytes >= log_max_bytes) {
+    Rotate();
+  }
+}
+
+// Shifts log.txt -> log.txt.1 -> ... -> log.txt.<max_files>, dropping
+// the oldest, and starts a new log.txt.
+void AgentLogger::Rotate() {
+  fclose(log_file);
+  log_file = NULL;
+
+  if (log_max_files > 0) {
+    std::string oldest = log_path + "." + std::to_string(log_max_files);
+    remove(oldest.c_str());
+    for (int i = log_max_files - 1; i >= 1; i--) {
+      std::string from = log_path + "." + std::to_string(i);
+      std::string to = log_path + "." + std::to_string(i + 1);
+      rename(from.c_str(), to.c_str());
+    }
+    std::string first = log_path + ".1";
+    rename(log_path.c_str(), first.c_str());
+  }
+
+  log_file = fopen(log_path.c_str(), "w");
+  if (log_file == NULL) {
+    // Nowhere left to write; keep draining so producers do not stall.
+    log_file = fopen("/dev/null", "w");
+  }
+  log_bytes = 0;
+}
+
+void AgentLogger::DrainRings(bool flush) {
+  pending.clear();
+  for (int i = 0; i < kLogRings; i++) {
+    LogRing &ring = rings_[i];
+    int state = ring.state.load(std::memory_order_acquire);
+    if (state == kRingFree) {
+      continue;
+    }
+
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    uint32_t tail = ring.tail.load(std::memory_order_acquire);
+    for (; head != tail; head++) {
+      pending.push_back(ring.records[head % kLogRingRecords]);
+    }
+    ring.head.store(head, std::memory_order_release);
+
+    if (state == kRingOrphaned) {
+      ring.head.store(0, std::memory_order_relaxed);
+      ring.tail.store(0, std::memory_order_relaxed);
+      ring.state.store(kRingFree, std::memory_order_release);
+    }
+  }
+
+  std::stable_sort(pending.begin(), pending.end(), RecordOlder);
+  for (size_t i = 0; i < pending.size(); i++) {
+    WriteRecord(pending[i]);
+  }
+
+  uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reported_dropped) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    LogRecord record;
+    record.timestamp_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record.level = kLogWarn;
+    record.length = snprintf(record.message, sizeof(record.message),
+        "dropped %llu log messages",
+        (unsigned long long) (dropped - reported_dropped));
+    WriteRecord(record);
+    reported_dropped = dropped;
+  }
+
+  if (flush || !pending.empty()) {
+    fflush(log_file);
+  }
+}
+
+void *AgentLogger::RunWriter(void *arg) {
+  IMPLICITLY_USE(arg);
+  pthread_mutex_lock(&writer_mutex);
+  while (true) {
+    uint64_t requested = flush_requested;
+    bool stop = writer_stop;
+    pthread_mutex_unlock(&writer_mutex);
+
+    DrainRings(requested != flush_completed || stop);
+
+    pthread_mutex_lock(&writer_mutex);
+    flush_completed = requested;
+    pthread_cond_broadcast(&writer_done);
+    if (stop) {
+      break;
+    }
+    if (flush_requested == flush_completed && !writer_stop) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += WRITER_PERIOD_MS * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&writer_wakeup, &writer_mutex, &deadline);
+    }
+  }
+  pthread_mutex_unlock(&writer_mutex);
+  return NULL;
+}
+
+bool AgentLogger::Init(const std::string &path, long max_bytes, int max_files) {
+  if (running_) {
+    return true;
+  }
+
+  log_file = fopen(path.c_str(), "a");
+  if (log_file == NULL) {
+    fprintf(stderr, "JCoz: could not open log file %s: %s\n", path.c_str(),
+        strerror(errno));
+    return false;
+  }
+  fseek(log_file, 0, SEEK_END);
+  log_bytes = ftell(log_file);
+  log_path = path;
+  log_max_bytes = max_bytes;
+  log_max_files = max_files;
+
+  rings_ = static_cast<LogRing *>(calloc(kLogRings, sizeof(LogRing)));
+  pending.reserve(kLogRings * kLogRingRecords);
+  if (rings_ == NULL || pthread_create(&writer_thread, NULL, &RunWriter, NULL) != 0) {
+    fprintf(stderr, "JCoz: could not start the log writer\n");
+    fclose(log_file);
+    log_file = NULL;
+    return false;
+  }
+
+  running_.store(true, std::memory_order_release);
+  return true;
+}
+
+void AgentLogger::Flush() {
+  if (!running_.load(std::memory_order_acquire)) {
+    return;
+  }
+  pthread_mutex_lock(&writer_mutex);
+  uint64_t target = ++flush_requested;
+  pthread_cond_signal(&writer_wakeup);
+  while (flush_completed < target && !writer_stop) {
+    pthread_cond_wait(&writer_done, &writer_mutex);
+  }
+  pthread_mutex_unlock(&writer_mutex);
+}
+
+void AgentLogger::Shutdown() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  pthread_mutex_lock(&writer_mutex);
+  writer_stop = true;
+  pthread_cond_signal(&writer_wakeup);
+  pthread_mutex_unlock(&writer_mutex);
+  pthread_join(writer_thread, NULL);
+  fclose(log_file);
+  log_file = NULL;
+}
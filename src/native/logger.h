@@ -0,0 +1,148 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+#include "globals.h"
+#include "spdlog/fmt/fmt.h"
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+enum LogLevel {
+  kLogDebug = 0,
+  kLogInfo = 1,
+  kLogWarn = 2,
+  kLogError = 3,
+};
+
+// Lowest level compiled into the agent.  Calls below it expand to
+// nothing, arguments included.  Set through LOG_LEVEL in the Makefile.
+#ifndef JCOZ_LOG_LEVEL
+#define JCOZ_LOG_LEVEL 1
+#endif
+
+#if JCOZ_LOG_LEVEL <= 0
+#define JCOZ_DEBUG(...) AgentLogger::Log(kLogDebug, __VA_ARGS__)
+#else
+#define JCOZ_DEBUG(...) ((void) 0)
+#endif
+
+#if JCOZ_LOG_LEVEL <= 1
+#define JCOZ_INFO(...) AgentLogger::Log(kLogInfo, __VA_ARGS__)
+#else
+#define JCOZ_INFO(...) ((void) 0)
+#endif
+
+#if JCOZ_LOG_LEVEL <= 2
+#define JCOZ_WARN(...) AgentLogger::Log(kLogWarn, __VA_ARGS__)
+#else
+#define JCOZ_WARN(...) ((void) 0)
+#endif
+
+#define JCOZ_ERROR(...) AgentLogger::Log(kLogError, __VA_ARGS__)
+
+// Longest message we keep; anything longer is truncated.
+static const int kLogMessageBytes = 240;
+
+// Messages buffered per thread before the writer drains them.
+static const int kLogRingRecords = 256;
+
+// Threads that may hold a log buffer at once.  Threads beyond this have
+// their messages dropped, which keeps the logger's memory bounded at
+// kLogRings * kLogRingRecords * sizeof(LogRecord).
+static const int kLogRings = 32;
+
+struct LogRecord {
+  uint64_t timestamp_ns;
+  int32_t level;
+  int32_t length;
+  char message[kLogMessageBytes];
+};
+
+// A single-producer, single-consumer buffer of log records.  The owning
+// thread is the only producer; the writer thread is the only consumer.
+struct LogRing {
+  std::atomic<uint32_t> head;  // next record the writer will read
+  std::atomic<uint32_t> tail;  // next record the owner will write
+  std::atomic<int> state;
+  LogRecord records[kLogRingRecords];
+};
+
+// The agent's logger.  Callers format into their own thread's LogRing
+// and never block or touch the file; a background thread drains the
+// rings in timestamp order, writes them out and rotates the file.
+class AgentLogger {
+  public:
+    // Opens the log and starts the writer thread.  Messages logged
+    // before Init are dropped.
+    static bool Init(const std::string &path, long max_bytes, int max_files);
+
+    // Blocks until every message logged before the call is written.
+    static void Flush();
+
+    // Flushes and stops the writer thread.
+    static void Shutdown();
+
+    template <typename... Args>
+    static void Log(LogLevel level, const char *format, const Args &... args) {
+      if (!running_.load(std::memory_order_acquire)) {
+        return;
+      }
+      char buf[kLogMessageBytes];
+      size_t length;
+      try {
+        length = fmt::format_to_n(buf, sizeof(buf), fmt::runtime(format), args...).size;
+      } catch (const fmt::format_error &) {
+        length = snprintf(buf, sizeof(buf), "bad log format: %s", format);
+      }
+      Append(level, buf, length < sizeof(buf) ? length : sizeof(buf));
+    }
+
+    // Number of messages lost because a buffer was full or none was free.
+    static uint64_t Dropped() {
+      return dropped_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static void Append(LogLevel level, const char *message, size_t length);
+
+    static LogRing *CurrentRing();
+
+    static void *RunWriter(void *arg);
+
+    static void DrainRings(bool flush);
+
+    static void WriteRecord(const LogRecord &record);
+
+    static void Rotate();
+
+    static LogRing *rings_;
+
+    static std::atomic<bool> running_;
+
+    static std::atomic<uint64_t> dropped_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(AgentLogger);
+};
+
+#endif  // LOGGER_H
@@ -0,0 +1,314 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+
+std::string AgentOptions::log_file = "log.txt";
+long AgentOptions::log_max_bytes = 10L * 1024 * 1024;
+int AgentOptions::log_max_files = 3;
+int AgentOptions::stack_depth = kMaxFramesToCapture;
+std::string AgentOptions::trace_file;
+std::string AgentOptions::timeline_file;
+int AgentOptions::timeline_events = 16384;
+std::string AgentOptions::agent_jar;
+int AgentOptions::max_overhead = 5;
+int AgentOptions::target_rse = 5;
+int AgentOptions::jit_settle = 10;
+long AgentOptions::warmup_ms = 30000;
+int AgentOptions::explore_floor = 10;
+long AgentOptions::sample_half_life_s = 60;
+int AgentOptions::duty_cycle = 100;
+long AgentOptions::duty_period_s = 600;
+long AgentOptions::min_progress_per_min = 1;
+std::string AgentOptions::profile_file;
+long AgentOptions::profile_flush_s = 0;
+std::string AgentOptions::ring_file;
+long AgentOptions::ring_records = 4096;
+long AgentOptions::seed = 0;
+std::string AgentOptions::record_file;
+std::string AgentOptions::replay_file;
+std::string AgentOptions::scope;
+std::string AgentOptions::progress_class;
+int AgentOptions::progress_line = -1;
+bool AgentOptions::end_to_end = false;
+bool AgentOptions::slow_experiments = false;
+
+// Where a headless agent writes its profile if no profile is given.
+static const char kDefaultProfileFile[] = "profile.coz";
+
+// Each thread keeps a buffer of this many frames.
+static const long kMaxStackDepth = 4096;
+
+// Keeps a thread's timeline buffer under 40 MB.
+static const long kMaxTimelineEvents = 1L << 20;
+
+// Keeps the result ring under 256 MB.
+static const long kMaxRingRecords = 1L << 19;
+
+// Java names may be given with either separator; the agent matches
+// class signatures, which use '/'.
+static std::string SlashSeparated(const std::string &name) {
+  std::string slashed(name);
+  for (size_t i = 0; i < slashed.size(); i++) {
+    if (slashed[i] == '.') {
+      slashed[i] = '/';
+    }
+  }
+  return slashed;
+}
+
+static bool ParseFlag(const std::string &key, const std::string &value,
+    bool *out) {
+  if (!value.empty()) {
+    fprintf(stderr, "JCoz: option %s takes no value\n", key.c_str());
+    return false;
+  }
+  *out = true;
+  return true;
+}
+
+static bool ParseLong(const std::string &key, const std::string &value,
+    long min, long *out) {
+  char *end;
+  errno = 0;
+  long parsed = strtol(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || errno != 0 || parsed < min) {
+    fprintf(stderr, "JCoz: invalid value '%s' for option %s\n",
+        value.c_str(), key.c_str());
+    return false;
+  }
+  *out = parsed;
+  return true;
+}
+
+bool AgentOptions::ParseOption(const std::string &key, const std::string &value) {
+  long parsed;
+  if (key == "logfile") {
+    if (value.empty()) {
+      fprintf(stderr, "JCoz: option logfile needs a path\n");
+      return false;
+    }
+    log_file = value;
+  } else if (key == "log-size") {
+    if (!ParseLong(key, value, 1, &parsed)) {
+      return false;
+    }
+    log_max_bytes = parsed;
+  } else if (key == "log-files") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    log_max_files = (int) parsed;
+  } else if (key == "depth") {
+    if (!ParseLong(key, value, 1, &parsed)) {
+      return false;
+    }
+    if (parsed > kMaxStackDepth) {
+      fprintf(stderr, "JCoz: depth may be at most %ld\n", kMaxStackDepth);
+      return false;
+    }
+    stack_depth = (int) parsed;
+  } else if (key == "traces") {
+    trace_file = value;
+  } else if (key == "timeline") {
+    timeline_file = value;
+  } else if (key == "timeline-events") {
+    if (!ParseLong(key, value, 1, &parsed)) {
+      return false;
+    }
+    if (parsed > kMaxTimelineEvents) {
+      fprintf(stderr, "JCoz: timeline-events may be at most %ld\n",
+          kMaxTimelineEvents);
+      return false;
+    }
+    timeline_events = (int) parsed;
+  } else if (key == "jar") {
+    agent_jar = value;
+  } else if (key == "overhead") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    if (parsed > 100) {
+      fprintf(stderr, "JCoz: overhead is a percentage, at most 100\n");
+      return false;
+    }
+    max_overhead = (int) parsed;
+  } else if (key == "target-rse") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    target_rse = (int) parsed;
+  } else if (key == "jit-settle") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    jit_settle = (int) parsed;
+  } else if (key == "warmup") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    warmup_ms = parsed;
+  } else if (key == "explore") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    if (parsed > 100) {
+      fprintf(stderr, "JCoz: explore is a percentage, at most 100\n");
+      return false;
+    }
+    explore_floor = (int) parsed;
+  } else if (key == "sample-half-life") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    sample_half_life_s = parsed;
+  } else if (key == "duty") {
+    if (!ParseLong(key, value, 1, &parsed)) {
+      return false;
+    }
+    if (parsed > 100) {
+      fprintf(stderr, "JCoz: duty is a percentage, at most 100\n");
+      return false;
+    }
+    duty_cycle = (int) parsed;
+  } else if (key == "duty-period") {
+    if (!ParseLong(key, value, 1, &parsed)) {
+      return false;
+    }
+    duty_period_s = parsed;
+  } else if (key == "min-progress") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    min_progress_per_min = parsed;
+  } else if (key == "profile") {
+    profile_file = value;
+  } else if (key == "profile-flush") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    profile_flush_s = parsed;
+  } else if (key == "ring") {
+    ring_file = value;
+  } else if (key == "ring-records") {
+    if (!ParseLong(key, value, 1, &parsed)) {
+      return false;
+    }
+    if (parsed > kMaxRingRecords) {
+      fprintf(stderr, "JCoz: ring-records may be at most %ld\n",
+          kMaxRingRecords);
+      return false;
+    }
+    ring_records = parsed;
+  } else if (key == "seed") {
+    if (!ParseLong(key, value, 0, &parsed)) {
+      return false;
+    }
+    seed = parsed;
+  } else if (key == "record") {
+    record_file = value;
+  } else if (key == "replay") {
+    if (value.empty()) {
+      fprintf(stderr, "JCoz: option replay needs a path\n");
+      return false;
+    }
+    replay_file = value;
+  } else if (key == "pkg") {
+    if (value.empty()) {
+      fprintf(stderr, "JCoz: option pkg needs a package\n");
+      return false;
+    }
+    scope = SlashSeparated(value);
+  } else if (key == "progress-point") {
+    size_t colon = value.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+      fprintf(stderr, "JCoz: progress-point must be <class>:<line>\n");
+      return false;
+    }
+    if (!ParseLong(key, value.substr(colon + 1), 1, &parsed)) {
+      return false;
+    }
+    progress_class = SlashSeparated(value.substr(0, colon));
+    progress_line = (int) parsed;
+  } else if (key == "end-to-end") {
+    return ParseFlag(key, value, &end_to_end);
+  } else if (key == "slow-exp") {
+    return ParseFlag(key, value, &slow_experiments);
+  } else {
+    fprintf(stderr, "JCoz: unknown agent option %s\n", key.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool AgentOptions::Parse(const char *options) {
+  if (options == NULL) {
+    return true;
+  }
+
+  bool ok = true;
+  std::string opts(options);
+  size_t start = 0;
+  while (start <= opts.size()) {
+    size_t end = opts.find(',', start);
+    if (end == std::string::npos) {
+      end = opts.size();
+    }
+    std::string option = opts.substr(start, end - start);
+    start = end + 1;
+    if (option.empty()) {
+      continue;
+    }
+
+    size_t equals = option.find('=');
+    std::string key = option.substr(0, equals);
+    std::string value =
+      equals == std::string::npos ? "" : option.substr(equals + 1);
+    ok = ParseOption(key, value) && ok;
+  }
+  return ok && Validate();
+}
+
+bool AgentOptions::Validate() {
+  if (duty_cycle < 100
+      && duty_period_s * 1000 * duty_cycle / 100 < kMinDutyOnMs) {
+    fprintf(stderr, "JCoz: duty of duty-period must be at least %ld ms, "
+        "the length of one experiment\n", kMinDutyOnMs);
+    return false;
+  }
+  bool has_point = !progress_class.empty();
+  if (!Headless()) {
+    if (has_point || end_to_end) {
+      fprintf(stderr, "JCoz: progress-point and end-to-end need pkg\n");
+      return false;
+    }
+    return true;
+  }
+  if (has_point == end_to_end) {
+    fprintf(stderr, "JCoz: pkg needs one of progress-point and end-to-end\n");
+    return false;
+  }
+  if (profile_file.empty()) {
+    profile_file = kDefaultProfileFile;
+  }
+  return true;
+}
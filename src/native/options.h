@@ -0,0 +1,180 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+
+#include "globals.h"
+
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Options passed to the agent as
+//   -agentpath:<path_to_agent>=key=value,key,...
+// Every option has a default, so an empty options string is fine.
+class AgentOptions {
+  public:
+    // Parses the options string.  Returns false and complains on stderr
+    // if an option is unknown or has a malformed value.
+    static bool Parse(const char *options);
+
+    // Agent log file.
+    static std::string log_file;
+
+    // Rotate the log once it grows past this many bytes.
+    static long log_max_bytes;
+
+    // Number of rotated logs (log.txt.1, log.txt.2, ...) to keep.
+    static int log_max_files;
+
+    // Most frames AsyncGetCallTrace walks per sample.  In-scope frames
+    // below this depth are never seen.
+    static int stack_depth;
+
+    // Where the collapsed stacks sampled outside experiments are written
+    // when profiling ends.  Empty, the default, turns the trace table
+    // off.
+    static std::string trace_file;
+
+    // Where a timeline of experiments, delays, progress points, GC, JIT
+    // and thread events is written as Chrome trace JSON when profiling
+    // stops.  Empty, the default, records nothing.
+    static std::string timeline_file;
+
+    // Events each profiled thread may log to the timeline; later ones
+    // are dropped.
+    static int timeline_events;
+
+    // Jar holding jcoz.agent.JCozProfiler, appended to the system class
+    // path when the agent is attached to a JVM that was started without
+    // it.
+    static std::string agent_jar;
+
+    // Most of the available CPU, as a percentage, that sampling may
+    // cost before the sampling rate is lowered.  0 samples at a fixed
+    // 1 ms whatever it costs.
+    static int max_overhead;
+
+    // An experiment ends once the standard error of its progress rate
+    // is this percentage of the rate.  0 runs every experiment for as
+    // long as it may.
+    static int target_rse;
+
+    // The JIT counts as busy while it compiles or unloads more than this
+    // many methods a second.  Experiments wait while it is busy, and a
+    // locally chosen experiment is thrown away if it was busy during the
+    // experiment or recompiled the experiment's method.  0 ignores the
+    // JIT.
+    static int jit_settle;
+
+    // Longest wait, in milliseconds, for the JIT to settle before an
+    // experiment.  After that the JIT's rate counts as normal.  0 never
+    // waits.
+    static long warmup_ms;
+
+    // Percentage of experiment line draws spread evenly over every
+    // in-scope line sampled so far, whatever its count, so that lines
+    // which are rarely sampled are still tried.
+    static int explore_floor;
+
+    // Seconds for a line's sample count to halve.  0 keeps every
+    // sample at full weight.
+    static long sample_half_life_s;
+
+    // Percentage of wall time spent profiling.  Below 100 the agent
+    // alternates between profiling and doing nothing at all, one
+    // duty_period_s cycle at a time.
+    static int duty_cycle;
+
+    // Length in seconds of one profiling plus one idle period.
+    static long duty_period_s;
+
+    // Shortest profiling period duty cycling accepts: one experiment of
+    // the shortest length, which a shorter period would never fit.
+    static const long kMinDutyOnMs = 5000;
+
+    // When duty cycling, a profiling period is skipped if the progress
+    // point was hit fewer than this many times a minute while idle.
+    static long min_progress_per_min;
+
+    // Every experiment is appended here in coz format, so the file builds
+    // up a profile across profiling periods and restarts.  Empty for no
+    // file.
+    static std::string profile_file;
+
+    // Seconds between flushes of profile_file.  0 opens the file, appends
+    // and closes it again for every experiment; above 0 it stays open and
+    // buffered, and is flushed this often and when profiling stops.
+    static long profile_flush_s;
+
+    // Every experiment is also published to a memory-mapped ring at this
+    // path (see ringformat.h) for local readers such as jcoz-tail.  With
+    // a ring, a profile no longer ends when nobody fetches results over
+    // JMX.  Empty for no ring.
+    static std::string ring_file;
+
+    // Experiments the ring holds before it wraps, rounded up to a power
+    // of two.
+    static long ring_records;
+
+    // Seed for the agent's random choices: candidate line draws, speedups
+    // and sampling jitter.  0 seeds from the clock.  Which lines are
+    // sampled still depends on timing, so for the same experiments in
+    // two runs record the schedule and replay it.
+    static long seed;
+
+    // Every experiment that runs, kept or discarded, is appended here as
+    // a schedule entry: class, line, speedup and duration.  Empty for no
+    // file.
+    static std::string record_file;
+
+    // A schedule written by record_file.  When set, the agent runs its
+    // experiments once, in order, each for its recorded duration,
+    // instead of choosing its own.
+    static std::string replay_file;
+
+    // Package to profile, with '/' separators.  Setting it runs the agent
+    // headless: profiling starts when the VM does, with the progress
+    // point below, and results go to profile_file (and the ring) rather
+    // than over JMX.
+    static std::string scope;
+
+    // Class, with '/' separators, and line of the headless progress point.
+    static std::string progress_class;
+
+    static int progress_line;
+
+    // Headless, with no progress point: each run is one experiment, and
+    // the point is the end of the program.
+    static bool end_to_end;
+
+    // Start experiments short and double their length, up to the
+    // longest allowed, while they see too few progress points.
+    static bool slow_experiments;
+
+    // Whether profiling starts at VM init rather than over JMX.
+    static bool Headless() { return !scope.empty(); }
+
+  private:
+    static bool ParseOption(const std::string &key, const std::string &value);
+
+    // Checks the options that only make sense together.
+    static bool Validate();
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(AgentOptions);
+};
+
+#endif  // OPTIONS_H
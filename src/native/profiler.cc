@@ -21,9 +21,11 @@
 
 #include "profiler.h"
 
+#include <dirent.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <vector>
 #include <set>
@@ -41,6 +43,12 @@
 #include <sstream>
 
 #include "display.h"
+#include "gc.h"
+#include "governor.h"
+#include "jit.h"
+#include "ring.h"
+#include "scheduler.h"
+#include "timeline.h"
 #include "globals.h"
 
 #ifdef __APPLE__
@@ -50,27 +58,72 @@ pthread_key_t Accessors::key_;
 __thread JNIEnv * Accessors::env_;
 #endif
 
-#define SIGNAL_FREQ 1000000L
 #define MIN_EXP_TIME 5000
 
-#define NUM_CALL_FRAMES 200
+static_assert(MIN_EXP_TIME == AgentOptions::kMinDutyOnMs,
+    "a duty cycle's profiling period must fit the shortest experiment");
+
+// Experiments are cut into batches this long to estimate how precise
+// their progress rate is, and last at least kMinBatches of them.
+static const uint64_t kBatchNs = 200000000ULL;
+static const long kMinBatches = 10;
+
+// An experiment more than this share of whose delay-free time was spent
+// in GC pauses says more about the collector than about its line.
+static const double kGcDominatedShare = 0.5;
+
+// The longest an experiment runs without reaching the target error.
+static const unsigned long kMaxExperimentMs = 60000;
+
+// With slow-exp, experiments that see fewer progress points than this
+// make the next one twice as long, and ones that see more than twice as
+// many make it half as long.
+static const unsigned long kTargetDelta = 5;
+
+// Stdio buffer for a profile kept open between experiments; a record is
+// about 150 bytes.
+static const size_t kProfileBufferBytes = 64 * 1024;
+
+// Lines drawn from the sample histogram for each round's candidates.
+static const int kCandidateDraws = 100;
+
+// How long a replayed experiment is retried while its class has no
+// in-scope method with the line, e.g. because it is not loaded yet.
+static const long kReplayWaitMs = 30000;
+
+// Longest the agent sleeps at a time while idle between duty periods.
+static const long kIdleSleepNs = 100000000L;
+
+// How often a sample scans its whole stack for in-scope frames.
+static const unsigned kDepthProbeInterval = 8;
 
 typedef std::chrono::duration<int, std::milli> milliseconds_type;
 typedef std::chrono::duration<long, std::nano> nanoseconds_type;
 
+static long wall_clock_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static long monotonic_ms() {
+  return (long) (ProfilerStats::Now() / 1000000);
+}
+
 ASGCTType Asgct::asgct_;
 
 thread_local struct UserThread *curr_ut;
 
 // Initialize static Profiler variables here
 std::unordered_set<void *> Profiler::in_scope_ids;
+MethodFilter Profiler::in_scope_filter;
+std::atomic<int> Profiler::scope_depth(0);
+AsyncSafeTraceMultiset Profiler::traces;
 volatile bool Profiler::in_experiment = false;
 volatile pthread_t Profiler::in_scope_lock = 0;
-volatile int Profiler::frame_lock = 0;
-volatile int Profiler::user_threads_lock = 0;
-std::vector<JVMPI_CallFrame> Profiler::call_frames;
+FrameCounts Profiler::frame_counts;
+LineHistogram Profiler::line_histogram;
 struct Experiment Profiler::current_experiment;
-std::unordered_set<struct UserThread *> Profiler::user_threads;
+volatile jthreadGroup Profiler::main_thread_group = NULL;
 jvmtiEnv *Profiler::jvmti;
 std::atomic<long> Profiler::global_delay(0);
 std::atomic_ulong Profiler::points_hit(0);
@@ -78,13 +131,15 @@ std::atomic_bool Profiler::_running(false);
 volatile bool Profiler::end_to_end = false;
 pthread_t Profiler::agent_pthread;
 std::atomic_bool Profiler::profile_done(false);
-unsigned long Profiler::experiment_time = MIN_EXP_TIME;
+unsigned long Profiler::experiment_time = kMaxExperimentMs;
+FILE *Profiler::profile_out = NULL;
+long Profiler::profile_flushed_ms = 0;
+std::atomic_ulong Profiler::experiment_count(0);
+std::atomic_long Profiler::virtual_thread_count(0);
 jobject Profiler::mbean;
 jmethodID Profiler::mbean_cache_method_id;
 JNIEnv * Profiler::jni_;
-
-// How long should we wait before starting an experiment
-unsigned long Profiler::warmup_time = 5000000;
+JavaVM * Profiler::adopting_vm = NULL;
 bool Profiler::prof_ready = false;
 
 // Progress point stuff
@@ -92,39 +147,41 @@ std::string Profiler::package;
 struct ProgressPoint* Profiler::progress_point = nullptr;
 std::string Profiler::progress_class;
 
+// Experiments queued by a coordinator
+std::deque<ScheduledExperiment> Profiler::schedule;
+pthread_mutex_t Profiler::schedule_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::atomic_bool Profiler::coordinated(false);
 
-static std::atomic<int> call_index(0);
-static JVMPI_CallFrame static_call_frames[NUM_CALL_FRAMES];
+// Experiments replayed from a recorded schedule
+std::vector<ScheduledExperiment> Profiler::replay;
+size_t Profiler::replay_next = 0;
+unsigned int Profiler::seed = 0;
 
-bool Profiler::fix_exp = false;
+std::atomic_ulong Profiler::progress_seen(0);
 
 nanoseconds_type startup_time;
 
-// Logger
-std::shared_ptr<spdlog::logger> Profiler::logger = spdlog::basic_logger_mt("basic_logger", "log.txt");
-
 /**
  * Wrapper function for sleeping
  */
-inline long jcoz_sleep(long nanoseconds) {
+long jcoz_sleep(long nanoseconds) {
 
-  if( nanoseconds == 0L ) {
+  if( nanoseconds <= 0L ) {
     return 0L;
   }
 
+  // nanosleep rejects tv_nsec >= 1s with EINVAL, so split it up.
   struct timespec temp_rem, temp_req;
   memset(&temp_rem, 0, sizeof(struct timespec));
-  memset(&temp_req, 0, sizeof(struct timespec));
-  temp_req.tv_nsec = nanoseconds;
+  temp_req.tv_sec = nanoseconds / 1000000000L;
+  temp_req.tv_nsec = nanoseconds % 1000000000L;
 
   auto start = std::chrono::high_resolution_clock::now();
 
-  int err = -1;
-  do {
-    err = nanosleep(&temp_req, &temp_rem);
-    temp_req.tv_nsec = temp_rem.tv_nsec;
-
-  } while (err == -1);
+  // Only a signal cuts the sleep short; resume with what is left.
+  while (nanosleep(&temp_req, &temp_rem) == -1 && errno == EINTR) {
+    temp_req = temp_rem;
+  }
 
   auto end = std::chrono::high_resolution_clock::now();
   nanoseconds_type total_sleep = (end - start);
@@ -155,76 +212,111 @@ void Profiler::setProgressPoint(std::string class_name, jint line_no){
   this->progress_point->lineno = line_no;
 }
 
+void Profiler::setEndToEnd(bool end_to_end) {
+  this->end_to_end = end_to_end;
+}
+
 void Profiler::signal_user_threads() {
-  while (!__sync_bool_compare_and_swap(&user_threads_lock, 0, 1))
-    ;
-  std::atomic_thread_fence(std::memory_order_acquire);
-  for (auto i = user_threads.begin(); i != user_threads.end(); i++) {
-    pthread_kill((*i)->thread, SIGPROF);
-  }
-  user_threads_lock = 0;
-  std::atomic_thread_fence(std::memory_order_release);
+  uint64_t start = ProfilerStats::Now();
+  // Experiments signal everyone, as every thread has delays to pay.
+  UserThreadSlab::SignalAll(SIGPROF,
+      in_experiment ? kMaxUserThreads : OverheadGovernor::ThreadsPerTick());
+  ProfilerStats::Agent()->agent_cycle.Record(ProfilerStats::Now() - start);
 }
 
 void Profiler::print_usage() {
-  std::cout
-    << "usage: java -agentpath:<absolute_path_to_agent>="
-    << "pkg=<package_name>_"
-    << "progress-point=<class:line_no>_"
-    << "end-to-end (optional)_"
-    << "warmup=<warmup_time_ms> (optional - default 5000 ms)"
-    << "slow-exp (optional - perform exponential slowdown of experiment time with low delta)"
+  std::cerr
+    << "usage: java -agentpath:<absolute_path_to_agent>=<option>,<option>,...\n"
+    << "headless profiling, started with the VM:\n"
+    << "  pkg=<package_name>\n"
+    << "  progress-point=<class:line_no> or end-to-end\n"
+    << "  profile=<path> (optional - default profile.coz)\n"
+    << "  profile-flush=<seconds> (optional - default 0, write every experiment through)\n"
+    << "  warmup=<ms> (optional - default 30000 ms, longest wait for the JIT to settle before an experiment, 0 never waits)\n"
+    << "  slow-exp (optional - lengthen experiments that see few progress points)\n"
+    << "see the README for the other options"
     << std::endl;
 }
 
-/**
- * Return random number from 0 to 1.0 in
- * increments of .05
- */
-float Profiler::calculate_random_speedup() {
-
-  int randVal = rand() % 40;
-
-  if (randVal < 10) {
-    return 0;
-  } else {
-    randVal = rand() % 20;
-
-    // Number from 0 to 1.0, increments of .05
-    unsigned int zeroToHundred = (randVal + 1) * 5;
-
-    return (float) zeroToHundred / 100.f;
+// The source line of bytecode index bci, or -1 if there is no table.
+static jint lineForLocation(jvmtiLineNumberEntry *entries, jint num_entries,
+    jint bci) {
+  jint line = -1;
+  for (int i = 0; i < num_entries && entries[i].start_location <= bci; i++) {
+    line = entries[i].line_number;
   }
+  return line;
 }
 
-void Profiler::runExperiment(JNIEnv * jni_env) {
-  logger->info("Running experiment");
+/**
+ * Run an experiment on current_experiment's line.  It ends once the
+ * progress rate is known to AgentOptions::target_rse, or after
+ * duration_ms.  A scheduled experiment has to end with the other JVMs
+ * running it, so it always runs for duration_ms.
+ */
+void Profiler::runExperiment(JNIEnv * jni_env, float speedup,
+    long duration_ms, bool scheduled) {
+  JCOZ_DEBUG("Running experiment");
+  experiment_count++;
   in_experiment = true;
   points_hit = 0;
 
-  current_experiment.speedup = calculate_random_speedup();
+  // Each sample stands for one period of a thread's time.
+  long period = OverheadGovernor::PeriodNs();
+  current_experiment.sample_period = period;
+  current_experiment.speedup = speedup;
+  if (!scheduled) {
+    current_experiment.window_ms = 0;
+  }
   current_experiment.delay =
-    (long) (current_experiment.speedup * SIGNAL_FREQ);
+    (long) (current_experiment.speedup * period);
+
+  unsigned long jit_events = JitActivity::Events();
+  JitActivity::Watch(current_experiment.method_id);
+  uint64_t gc_start_ns = GcPauses::TotalNs();
+  int speedup_percent = (int) lround(speedup * 100);
+  Timeline::RecordShared(Timeline::Agent(), kTimelineExperimentStart,
+      current_experiment.method_id, current_experiment.lineno, speedup_percent);
 
-  milliseconds_type duration(experiment_time);
+  milliseconds_type duration(duration_ms);
   auto start = std::chrono::high_resolution_clock::now();
   auto end = start + duration;
+  double target_rse = AgentOptions::target_rse / 100.0;
+  BatchMeans batches;
+  uint64_t batch_start = ProfilerStats::Now();
+  unsigned long batch_start_hits = 0;
   while (_running
-      && ((end_to_end && (points_hit == 0))
+      && ((!scheduled && end_to_end && (points_hit == 0))
         || (std::chrono::high_resolution_clock::now() < end))) {
-    jcoz_sleep(SIGNAL_FREQ);
+    jcoz_sleep(period);
 
     signal_user_threads();
+
+    uint64_t now = ProfilerStats::Now();
+    if (now - batch_start >= kBatchNs) {
+      unsigned long hits = points_hit;
+      batches.Add((double) (hits - batch_start_hits));
+      batch_start_hits = hits;
+      batch_start = now;
+      if (!scheduled && target_rse > 0 && batches.batches >= kMinBatches
+          && batches.RelativeStdError() <= target_rse) {
+        break;
+      }
+    }
   }
+  current_experiment.rse = batches.RelativeStdError();
+  Timeline::RecordShared(Timeline::Agent(), kTimelineExperimentEnd,
+      current_experiment.method_id, current_experiment.lineno, speedup_percent);
 
-  jcoz_sleep(SIGNAL_FREQ);
+  jcoz_sleep(period);
   in_experiment = false;
   signal_user_threads();
-  jcoz_sleep(SIGNAL_FREQ);
+  jcoz_sleep(period);
 
   //TODO this is to avoid calling up to a synchronized java method, resulting in a deadlock,
   // this might still be a race condition with Stop()
-  if(!_running){
+  // An end-to-end experiment ends with the run, and is only complete now.
+  if(!_running && !end_to_end){
     delete[] current_experiment.location_ranges;
     return;
   }
@@ -234,170 +326,631 @@ void Profiler::runExperiment(JNIEnv * jni_env) {
   current_experiment.points_hit = points_hit;
   points_hit = 0;
   current_experiment.duration = (expEnd - start).count();
+  current_experiment.gc_pause = (long) (GcPauses::TotalNs() - gc_start_ns);
   global_delay = 0;
 
+  if (AgentOptions::slow_experiments && !scheduled) {
+    if (current_experiment.points_hit < kTargetDelta) {
+      experiment_time = std::min(experiment_time * 2, kMaxExperimentMs);
+    } else if (current_experiment.points_hit > 2 * kTargetDelta
+        && experiment_time >= 2 * MIN_EXP_TIME) {
+      experiment_time /= 2;
+    }
+  }
+
+  // The experiment measured code that changed speed underneath it.
+  unsigned long watched_events = JitActivity::WatchedEvents();
+  JitActivity::Watch(NULL);
+  double jit_rate = (JitActivity::Events() - jit_events) * 1e9
+    / current_experiment.duration;
+  if (AgentOptions::jit_settle > 0
+      && (watched_events > 0 || jit_rate > JitActivity::Threshold())) {
+    if (!scheduled) {
+      JCOZ_INFO("Discarded experiment on line {}: {} recompiles of its method, {:.1f} compiles/s",
+          current_experiment.lineno, watched_events, jit_rate);
+      // It still ran, so a replay has to run it too.
+      char *sig = AgentOptions::record_file.empty() ? NULL
+        : getClassFromMethodIDLocation(current_experiment.method_id);
+      if (sig != NULL) {
+        cleanSignature(sig);
+        appendToRecord(sig, "discarded");
+        jvmti->Deallocate((unsigned char *) sig);
+      }
+      delete[] current_experiment.location_ranges;
+      return;
+    }
+    // Leaving one replica out of a coordinated experiment would skew
+    // the pooled rate, and leaving one out of a replay would misalign it
+    // with the recorded run, so report it anyway.
+    JCOZ_WARN("Scheduled experiment on line {} ran while the JIT was busy: {} recompiles of its method, {:.1f} compiles/s",
+        current_experiment.lineno, watched_events, jit_rate);
+  }
+
+  // GC pauses stop every thread whatever the line, so they are left out
+  // of the time the scheduler sees.  The output keeps them, for the
+  // analysis to drop if it wants.
+  long run_time = current_experiment.duration - current_experiment.delay;
+  bool gc_dominated = current_experiment.gc_pause > kGcDominatedShare * run_time;
+  if (!gc_dominated) {
+    ExperimentScheduler::Record(current_experiment.method_id,
+        current_experiment.lineno, current_experiment.speedup,
+        current_experiment.points_hit, run_time - current_experiment.gc_pause);
+  }
+
   char *sig = getClassFromMethodIDLocation(current_experiment.method_id);
   // throw out bad samples
   if( sig == NULL ) return;
   cleanSignature(sig);
 
-  jstring javaSig = jni_env->NewStringUTF(sig);
-  jni_env->CallVoidMethod(Profiler::mbean, Profiler::mbean_cache_method_id, javaSig, current_experiment.lineno,
-      +current_experiment.speedup, (current_experiment.duration - current_experiment.delay),
-      current_experiment.points_hit);
-  jni_env->DeleteLocalRef(javaSig);
+  // Headless runs have no MBean, and once stopping the MBean may be
+  // waiting for us under its lock.
+  if (Profiler::mbean != NULL && _running) {
+    jstring javaSig = jni_env->NewStringUTF(sig);
+    jni_env->CallVoidMethod(Profiler::mbean, Profiler::mbean_cache_method_id, javaSig, current_experiment.lineno,
+        +current_experiment.speedup, (current_experiment.duration - current_experiment.delay),
+        current_experiment.points_hit, current_experiment.sample_period,
+        current_experiment.gc_pause, current_experiment.window_ms);
+    jni_env->DeleteLocalRef(javaSig);
+  }
+  if (!AgentOptions::profile_file.empty()) {
+    appendToProfile(sig);
+  }
+  if (!AgentOptions::record_file.empty()) {
+    appendToRecord(sig, NULL);
+  }
+  ResultRing::Publish(sig, progressPointName().c_str(),
+      current_experiment.lineno, current_experiment.speedup,
+      current_experiment.duration - current_experiment.delay,
+      current_experiment.points_hit, current_experiment.sample_period,
+      current_experiment.gc_pause, gc_dominated);
 
   // printf("Total experiment delay: %ld, total duration: %ld\n", current_experiment.delay, current_experiment.duration);
 
-  // Maybe update the experiment length
-  if (!fix_exp) {
-    if( current_experiment.points_hit <= 5 ) {
-      experiment_time *= 2;
-    } else if( (experiment_time > MIN_EXP_TIME) && (current_experiment.points_hit >= 20) ) {
-      experiment_time /= 2;
-    }
-  }
-
   // Log the run experiment results
-  logger->info(
-      "Ran experiment: [class: {class}:{line_no}] [speedup: {speedup}] [points hit: {points_hit}] [delay: {delay}] [duration: {duration}] [new exp time: {exp_time}]",
-      fmt::arg("exp_time", experiment_time), fmt::arg("speedup", current_experiment.speedup), fmt::arg("points_hit", current_experiment.points_hit),
+  JCOZ_INFO(
+      "Ran experiment: [class: {class}:{line_no}] [speedup: {speedup}] [points hit: {points_hit}] [delay: {delay}] [duration: {duration}] [period: {period}] [rse: {rse:.3f}] [gc pause: {gc_pause}]",
+      fmt::arg("rse", current_experiment.rse), fmt::arg("speedup", current_experiment.speedup), fmt::arg("points_hit", current_experiment.points_hit),
       fmt::arg("delay", current_experiment.delay), fmt::arg("duration", current_experiment.duration), fmt::arg("class", sig),
-      fmt::arg("line_no", current_experiment.lineno));
-  logger->flush();
+      fmt::arg("line_no", current_experiment.lineno),
+      fmt::arg("period", current_experiment.sample_period),
+      fmt::arg("gc_pause", current_experiment.gc_pause));
+  if (gc_dominated) {
+    JCOZ_WARN("Experiment on {}:{} was dominated by GC pauses and is left out of the estimates",
+        sig, current_experiment.lineno);
+  }
+  double impact, std_error;
+  if (ExperimentScheduler::Estimate(current_experiment.method_id,
+        current_experiment.lineno, &impact, &std_error)) {
+    JCOZ_INFO("Impact of {}:{} is now {:.3f} +/- {:.3f}", sig,
+        current_experiment.lineno, impact, std_error);
+  }
+  AgentLogger::Flush();
 
   delete[] current_experiment.location_ranges;
   free(sig);
 
-  logger->info("Finished experiment, flushed logs, and delete current location ranges.");
+  JCOZ_DEBUG("Finished experiment, flushed logs, and delete current location ranges.");
+}
+
+void Profiler::appendToProfile(const char *sig) {
+  // Unless it is kept open, the file is opened per experiment, which is
+  // at most every few seconds, so it can be moved away at any time.
+  bool keep_open = AgentOptions::profile_flush_s > 0;
+  FILE *file = keep_open ? profile_out : NULL;
+  if (file == NULL) {
+    file = fopen(AgentOptions::profile_file.c_str(), "a");
+    if (file == NULL) {
+      JCOZ_ERROR("Could not open profile {}: {}", AgentOptions::profile_file,
+          strerror(errno));
+      return;
+    }
+    if (keep_open) {
+      setvbuf(file, NULL, _IOFBF, kProfileBufferBytes);
+      profile_out = file;
+      profile_flushed_ms = monotonic_ms();
+    }
+  }
+  std::string record = fmt::format(
+      "experiment\tselected={}:{}\tspeedup={}\tduration={}\tperiod={}\tgc-pause={}\n"
+      "progress-point\tname={}\ttype=source\tdelta={}\n",
+      sig, current_experiment.lineno, current_experiment.speedup,
+      current_experiment.duration - current_experiment.delay,
+      current_experiment.sample_period, current_experiment.gc_pause,
+      progressPointName(), current_experiment.points_hit);
+  fwrite(record.data(), 1, record.size(), file);
+  if (!keep_open) {
+    fclose(file);
+  } else {
+    flushProfileIfDue();
+  }
+}
+
+std::string Profiler::progressPointName() {
+  if (end_to_end) {
+    return "end-to-end";
+  }
+  // In the dotted form experiments are reported in.
+  std::string point = progress_class + ":" + std::to_string(progress_point->lineno);
+  std::replace(point.begin(), point.end(), '/', '.');
+  return point;
+}
+
+void Profiler::flushProfileIfDue() {
+  if (profile_out != NULL && monotonic_ms() - profile_flushed_ms
+      >= AgentOptions::profile_flush_s * 1000) {
+    flushProfile();
+  }
+}
+
+void Profiler::flushProfile() {
+  if (profile_out != NULL) {
+    fflush(profile_out);
+    profile_flushed_ms = monotonic_ms();
+  }
+}
+
+void Profiler::closeProfile() {
+  if (profile_out != NULL) {
+    fclose(profile_out);
+    profile_out = NULL;
+  }
+}
+
+/**
+ * Point current_experiment at every bytecode range of the given line.
+ */
+void Profiler::setExperimentRanges(jvmtiLineNumberEntry *entries,
+    jint num_entries, jint line) {
+  std::vector<std::pair<jint, jint>> location_ranges;
+  for (int i = 0; i < num_entries; i++) {
+    if (entries[i].line_number == line) {
+      if (i < num_entries - 1) {
+        location_ranges.push_back(
+            std::pair<jint, jint>(entries[i].start_location,
+              entries[i + 1].start_location));
+      } else {
+        location_ranges.push_back(
+            std::pair<jint, jint>(entries[i].start_location,
+              INT_MAX));
+      }
+    }
+  }
+
+  // The handler binary searches these, so sort and merge them now.
+  current_experiment.lineno = line;
+  current_experiment.location_ranges =
+    new std::pair<jint, jint>[location_ranges.size()];
+  for (int i = 0; i < location_ranges.size(); i++) {
+    current_experiment.location_ranges[i] = location_ranges[i];
+  }
+  current_experiment.num_ranges = FrameScan::NormalizeRanges(
+      current_experiment.location_ranges, location_ranges.size());
+}
+
+void Profiler::appendToRecord(const char *sig, const char *note) {
+  FILE *file = fopen(AgentOptions::record_file.c_str(), "a");
+  if (file == NULL) {
+    JCOZ_ERROR("Could not open schedule record {}: {}",
+        AgentOptions::record_file, strerror(errno));
+    return;
+  }
+  // Whole milliseconds, as scheduled experiments are timed.
+  std::string record = fmt::format("{}\t{}\t{}\t{}{}{}\n", sig,
+      current_experiment.lineno, current_experiment.speedup,
+      (current_experiment.duration + 500000) / 1000000,
+      note != NULL ? "\t" : "", note != NULL ? note : "");
+  fwrite(record.data(), 1, record.size(), file);
+  fclose(file);
+}
+
+/**
+ * Read a schedule written by appendToRecord: one experiment a line, as
+ * class, line, speedup and duration in milliseconds separated by tabs,
+ * then an optional note.  Lines starting with '#' are comments.
+ */
+bool Profiler::loadReplay() {
+  FILE *file = fopen(AgentOptions::replay_file.c_str(), "r");
+  if (file == NULL) {
+    JCOZ_ERROR("Could not open schedule {}: {}", AgentOptions::replay_file,
+        strerror(errno));
+    return false;
+  }
+  replay.clear();
+  replay_next = 0;
+  char line[1024];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    lineno++;
+    if (line[0] == '#' || line[0] == '\n') {
+      continue;
+    }
+    char *tab = strchr(line, '\t');
+    ScheduledExperiment scheduled;
+    if (tab == NULL || sscanf(tab + 1, "%d\t%f\t%ld", &scheduled.lineno,
+          &scheduled.speedup, &scheduled.duration_ms) != 3
+        || scheduled.speedup < 0 || scheduled.speedup > 1
+        || scheduled.duration_ms <= 0) {
+      JCOZ_WARN("Ignoring malformed line {} of schedule {}", lineno,
+          AgentOptions::replay_file);
+      continue;
+    }
+    scheduled.class_sig.assign(line, tab - line);
+    scheduled.start_ms = 0;
+    replay.push_back(scheduled);
+  }
+  fclose(file);
+  if (replay.empty()) {
+    JCOZ_ERROR("Schedule {} holds no experiments", AgentOptions::replay_file);
+    return false;
+  }
+  JCOZ_INFO("Replaying {} experiments from {}", replay.size(),
+      AgentOptions::replay_file);
+  return true;
+}
+
+void Profiler::scheduleExperiment(const ScheduledExperiment &scheduled) {
+  pthread_mutex_lock(&schedule_mutex);
+  schedule.push_back(scheduled);
+  coordinated = true;
+  pthread_mutex_unlock(&schedule_mutex);
+}
+
+void Profiler::clearSchedule() {
+  pthread_mutex_lock(&schedule_mutex);
+  schedule.clear();
+  coordinated = false;
+  pthread_mutex_unlock(&schedule_mutex);
+}
+
+bool Profiler::nextScheduledExperiment(ScheduledExperiment *scheduled) {
+  pthread_mutex_lock(&schedule_mutex);
+  bool found = !schedule.empty();
+  if (found) {
+    *scheduled = schedule.front();
+    schedule.pop_front();
+  }
+  pthread_mutex_unlock(&schedule_mutex);
+  return found;
+}
+
+/**
+ * Find an in-scope method of the scheduled class with code on the
+ * scheduled line, and make it the current experiment.
+ */
+bool Profiler::findScheduledLine(const ScheduledExperiment &scheduled) {
+  std::vector<jmethodID> methods;
+  spin_lock(&in_scope_lock, pthread_self(), ProfilerStats::Agent());
+  std::atomic_thread_fence(std::memory_order_acquire);
+  for (auto id : in_scope_ids) {
+    methods.push_back((jmethodID) id);
+  }
+  in_scope_lock = 0;
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (size_t m = 0; m < methods.size(); m++) {
+    char *sig = getClassFromMethodIDLocation(methods[m]);
+    if (sig == NULL) {
+      continue;
+    }
+    cleanSignature(sig);
+    bool same_class = scheduled.class_sig == sig;
+    jvmti->Deallocate((unsigned char *) sig);
+    if (!same_class) {
+      continue;
+    }
+
+    jint num_entries;
+    JvmtiScopedPtr<jvmtiLineNumberEntry> entries(jvmti);
+    if (jvmti->GetLineNumberTable(methods[m], &num_entries, entries.GetRef())
+        != JVMTI_ERROR_NONE) {
+      entries.AbandonBecauseOfError();
+      continue;
+    }
+    for (int i = 0; i < num_entries; i++) {
+      if (entries.Get()[i].line_number == scheduled.lineno) {
+        current_experiment.method_id = methods[m];
+        setExperimentRanges(entries.Get(), num_entries, scheduled.lineno);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Profiler::idleUntilNextWindow(long *window_end_ms) {
+  long period_ms = AgentOptions::duty_period_s * 1000;
+  long on_ms = period_ms * AgentOptions::duty_cycle / 100;
+  long off_ms = period_ms - on_ms;
+  // Nothing is appended while idle, so do not sit on what was.
+  flushProfile();
+
+  while (_running) {
+    // No signals, so no samples and no delays, until the period ends.
+    unsigned long seen = progress_seen;
+    long idle_start_ms = monotonic_ms();
+    long idle_ms;
+    while (_running && (idle_ms = monotonic_ms() - idle_start_ms) < off_ms) {
+      jcoz_sleep(std::min(kIdleSleepNs, (off_ms - idle_ms) * 1000000L));
+    }
+    if (!_running) {
+      break;
+    }
+
+    unsigned long hits = progress_seen - seen;
+    double minutes = (monotonic_ms() - idle_start_ms) / 60000.0;
+    // Without a breakpoint (end-to-end mode) there is nothing to count.
+    if (progress_point->method_id == nullptr
+        || hits >= AgentOptions::min_progress_per_min * minutes) {
+      *window_end_ms = monotonic_ms() + on_ms;
+      JCOZ_INFO("Profiling for {} ms after {} progress points in {} ms idle",
+          on_ms, hits, off_ms);
+      return true;
+    }
+    JCOZ_INFO("Only {} progress points in {} ms idle, skipping a profiling period",
+        hits, off_ms);
+  }
+  return false;
+}
+
+bool Profiler::runScheduledExperiment(JNIEnv *jni_env,
+    const ScheduledExperiment &scheduled) {
+  long end_ms = scheduled.start_ms + scheduled.duration_ms;
+  long now_ms = wall_clock_ms();
+  if (end_ms <= now_ms) {
+    JCOZ_WARN("Skipping experiment on {}:{}, its window closed {} ms ago",
+        scheduled.class_sig, scheduled.lineno, now_ms - end_ms);
+    return true;
+  }
+  if (!findScheduledLine(scheduled)) {
+    return false;
+  }
+
+  // Keep sampling until the window opens.
+  long period = OverheadGovernor::PeriodNs();
+  while (_running && now_ms < scheduled.start_ms) {
+    jcoz_sleep(std::min(period, (scheduled.start_ms - now_ms) * 1000000L));
+    signal_user_threads();
+    now_ms = wall_clock_ms();
+  }
+  if (!_running) {
+    delete[] current_experiment.location_ranges;
+    return true;
+  }
+
+  current_experiment.window_ms = scheduled.start_ms;
+  runExperiment(jni_env, scheduled.speedup, end_ms - now_ms, true);
+  return true;
 }
 
 void JNICALL
 Profiler::runAgentThread(jvmtiEnv *jvmti_env, JNIEnv *jni_env, void *args) {
-  srand(time(NULL));
+  // Only this thread draws random numbers, so a fixed seed fixes every
+  // draw given the same samples.
+  seed = AgentOptions::seed != 0 ? (unsigned int) AgentOptions::seed
+    : (unsigned int) time(NULL);
+  srand(seed);
+  JCOZ_INFO("Random seed {}", seed);
+  experiment_time = AgentOptions::slow_experiments ? MIN_EXP_TIME
+    : kMaxExperimentMs;
+  if (!AgentOptions::record_file.empty()) {
+    FILE *file = fopen(AgentOptions::record_file.c_str(), "a");
+    if (file != NULL) {
+      fprintf(file, "# seed=%u\n", seed);
+      fclose(file);
+    }
+  }
+  bool replaying = !AgentOptions::replay_file.empty() && loadReplay();
   global_delay = 0;
   startup_time = std::chrono::high_resolution_clock::now().time_since_epoch();
   agent_pthread = pthread_self();
-  while (!__sync_bool_compare_and_swap(&user_threads_lock, 0, 1))
-    ;
-  std::atomic_thread_fence(std::memory_order_acquire);
-  user_threads.erase(curr_ut);
-  curr_ut = NULL;
-  user_threads_lock = 0;
-  std::atomic_thread_fence(std::memory_order_release);
-  //	usleep(warmup_time);
+  if (curr_ut != NULL) {
+    UserThreadSlab::Release(curr_ut);
+    curr_ut = NULL;
+  }
+  // Code measured while it is still being compiled speeds up under the
+  // experiment for reasons of its own.
+  JitActivity::Reset();
   prof_ready = true;
 
+  // When duty cycling, start idle so the first period is checked for
+  // progress like every other.
+  bool duty_cycled = AgentOptions::duty_cycle < 100;
+  long window_end_ms = duty_cycled ? 0 : LONG_MAX;
+  long last_decay_ms = monotonic_ms();
+  // When experiments started waiting for the JIT, or -1.
+  long jit_wait_start_ms = -1;
+  // When the next replayed experiment was first found to have no
+  // in-scope method, or -1; and whether the whole replay has run.
+  long replay_wait_start_ms = -1;
+  bool replay_done = false;
+
   while (_running) {
-    logger->info("Starting new agent thread _running loop...");
-    // 15 * SIGNAL_FREQ with randomization should give us roughly
-    // the same number of iterations as doing 10 * SIGNAL_FREQ without
+    JCOZ_DEBUG("Starting new agent thread _running loop...");
+    OverheadGovernor::Update();
+    JitActivity::Update();
+    // Experiments can be far apart, e.g. with slow-exp, so the profile
+    // is flushed on time rather than only when one is appended.
+    flushProfileIfDue();
+    long period = OverheadGovernor::PeriodNs();
+    if (duty_cycled && !coordinated
+        && monotonic_ms() + MIN_EXP_TIME > window_end_ms) {
+      if (!idleUntilNextWindow(&window_end_ms)) {
+        break;
+      }
+    }
+    // 15 * period with randomization should give us roughly
+    // the same number of iterations as doing 10 * period without
     // randomization.
-    long total_needed_time = 15 * SIGNAL_FREQ;
+    long total_needed_time = 15 * period;
     long total_accrued_time = 0;
     while (total_accrued_time < total_needed_time) {
       // Sleep some randomized time to avoid bias in the profiler.
-      long curr_sleep = 2 * SIGNAL_FREQ - (rand() % SIGNAL_FREQ);
+      long curr_sleep = 2 * period - (rand() % period);
       jcoz_sleep(curr_sleep);
       signal_user_threads();
       total_accrued_time += curr_sleep;
-      logger->debug("Slept for {sleep_time} time. {remaining_time} Remaining.",
+      JCOZ_DEBUG("Slept for {sleep_time} time. {remaining_time} Remaining.",
           fmt::arg("sleep_time", curr_sleep),
           fmt::arg("remaining_time", total_needed_time - total_accrued_time));
     }
 
-    while (!__sync_bool_compare_and_swap(&frame_lock, 0, 1))
-      ;
-    std::atomic_thread_fence(std::memory_order_acquire);
-    for (int i = 0; (i < call_index) && (i < NUM_CALL_FRAMES); i++) {
-      call_frames.push_back(static_call_frames[i]);
-    }
-    if (call_frames.size() > 0) {
-      logger->debug("Had {} call frames. Checking for in scope call frame...", call_frames.size());
-      call_index = 0;
-      std::random_shuffle(call_frames.begin(), call_frames.end());
-      JVMPI_CallFrame exp_frame;
-      jint num_entries;
-      jvmtiLineNumberEntry *entries = NULL;
-      for( int i = 0; i < call_frames.size(); i++ ) {
-        exp_frame = call_frames.at(i);
-        jvmtiError lineNumberError = jvmti->GetLineNumberTable(exp_frame.method_id, &num_entries, &entries);
-        if( lineNumberError == JVMTI_ERROR_NONE ) {
-          break;
-        } else {
-          jvmti->Deallocate((unsigned char *)entries);
-        }
+    if (coordinated) {
+      ScheduledExperiment scheduled;
+      if (nextScheduledExperiment(&scheduled)
+          && !runScheduledExperiment(jni_env, scheduled)) {
+        JCOZ_WARN("Skipping experiment on {}:{}, no in-scope method has that line",
+            scheduled.class_sig, scheduled.lineno);
       }
+      continue;
+    }
 
-      // If we don't find anything in scope, try again
-      if( entries == NULL ) {
-        // TODO(dcv): Should we clear the call frames here?
-        logger->info("No in scope frames found. Trying again.");
-        frame_lock = 0;
-        std::atomic_thread_fence(std::memory_order_release);
+    // A burst of compiles, at startup, after a deoptimization or on a
+    // new code path, would change the program's speed under the
+    // experiment.  The samples still count towards choosing lines.  A
+    // program that is never quiet for AgentOptions::warmup_ms compiles
+    // this much as a matter of course, so its rate becomes the norm.
+    if (AgentOptions::warmup_ms > 0 && JitActivity::Busy()) {
+      long now_ms = monotonic_ms();
+      if (jit_wait_start_ms < 0) {
+        jit_wait_start_ms = now_ms;
+      }
+      if (now_ms - jit_wait_start_ms < AgentOptions::warmup_ms) {
+        JCOZ_DEBUG("JIT busy ({:.1f} compiles/s), holding off experiments",
+            JitActivity::Rate());
         continue;
       }
-
-      logger->debug("Found in scope frames. Choosing a frame and running experiment...");
-      current_experiment.method_id = exp_frame.method_id;
-      jint start_line;
-      jint end_line; //exclusive
-      jint line = -1;
-      std::vector<std::pair<jint, jint>> location_ranges;
-      for (int i = 1; i < num_entries; i++) {
-        if (line == -1
-            && entries[i].start_location > exp_frame.lineno) {
-          line = entries[i - 1].line_number;
-          current_experiment.lineno = line;
-          break;
-        }
+      JitActivity::Tolerate();
+      JCOZ_WARN("JIT still busy after {} ms ({:.1f} compiles/s), now busy above {:.1f} compiles/s",
+          now_ms - jit_wait_start_ms, JitActivity::Rate(),
+          JitActivity::Threshold());
+    }
+    jit_wait_start_ms = -1;
+
+    // Replayed experiments run for their recorded time, like scheduled
+    // ones, so two runs spend the same time on the same lines, in the
+    // same order.  An entry whose class is not in scope yet is retried
+    // rather than skipped, for a while, so the rest stay in step.
+    if (replaying) {
+      if (replay_next == replay.size()) {
+        JCOZ_INFO("Replayed all {} experiments, running no more",
+            replay.size());
+        replaying = false;
+        replay_done = true;
+        continue;
+      }
+      ScheduledExperiment scheduled = replay[replay_next];
+      scheduled.start_ms = wall_clock_ms();
+      if (runScheduledExperiment(jni_env, scheduled)) {
+        replay_next++;
+        replay_wait_start_ms = -1;
+        continue;
       }
-      for (int i = 1; i < num_entries; i++) {
-        if (entries[i].line_number == line) {
-          if (i < num_entries - 1) {
-            location_ranges.push_back(
-                std::pair<jint, jint>(entries[i].start_location,
-                  entries[i + 1].start_location));
-          } else {
-            location_ranges.push_back(
-                std::pair<jint, jint>(entries[i].start_location,
-                  LONG_MAX));
-          }
+      long now_ms = monotonic_ms();
+      if (replay_wait_start_ms < 0) {
+        replay_wait_start_ms = now_ms;
+      }
+      if (now_ms - replay_wait_start_ms >= kReplayWaitMs) {
+        JCOZ_WARN("Skipping replayed experiment {} on {}:{}, no in-scope method has had that line for {} ms",
+            replay_next + 1, scheduled.class_sig, scheduled.lineno,
+            now_ms - replay_wait_start_ms);
+        if (!AgentOptions::record_file.empty()) {
+          current_experiment.lineno = scheduled.lineno;
+          current_experiment.speedup = scheduled.speedup;
+          current_experiment.duration = scheduled.duration_ms * 1000000L;
+          appendToRecord(scheduled.class_sig.c_str(), "skipped");
         }
+        replay_next++;
+        replay_wait_start_ms = -1;
       }
+      continue;
+    }
+    if (replay_done) {
+      continue;
+    }
 
-      current_experiment.num_ranges = location_ranges.size();
-      current_experiment.location_ranges =
-        new std::pair<jint, jint>[location_ranges.size()];
-      for (int i = 0; i < location_ranges.size(); i++) {
-        current_experiment.location_ranges[i] = location_ranges[i];
+    // Lines are drawn from every sample so far rather than only this
+    // round's, with older samples fading out.  This round's frames are
+    // resolved to lines, fetching each method's line table once.
+    long now_ms = monotonic_ms();
+    if (AgentOptions::sample_half_life_s > 0) {
+      line_histogram.Decay(pow(0.5, (now_ms - last_decay_ms)
+            / (1000.0 * AgentOptions::sample_half_life_s)));
+    }
+    last_decay_ms = now_ms;
+    std::unordered_map<void *, std::pair<jint, jvmtiLineNumberEntry *>> tables;
+    auto lineTable = [&](jmethodID method_id) {
+      auto table = tables.find((void *) method_id);
+      if (table == tables.end()) {
+        jint num_entries = 0;
+        jvmtiLineNumberEntry *entries = NULL;
+        if (jvmti->GetLineNumberTable(method_id, &num_entries, &entries)
+            != JVMTI_ERROR_NONE) {
+          num_entries = 0;
+          entries = NULL;
+        }
+        table = tables.emplace((void *) method_id,
+            std::make_pair(num_entries, entries)).first;
       }
-      call_index = 0;
-      frame_lock = 0;
-      std::atomic_thread_fence(std::memory_order_release);
+      return table->second;
+    };
+    std::vector<std::pair<JVMPI_CallFrame, long> > frames;
+    frame_counts.Drain(&frames);
+    for (size_t i = 0; i < frames.size(); i++) {
+      JVMPI_CallFrame &frame = frames[i].first;
+      std::pair<jint, jvmtiLineNumberEntry *> table = lineTable(frame.method_id);
+      jint line = lineForLocation(table.second, table.first, frame.lineno);
+      if (line >= 0) {
+        SampledLine sampled = {frame.method_id, line};
+        line_histogram.Add(sampled, frames[i].second);
+      }
+    }
 
-      runExperiment(jni_env);
-      while (!__sync_bool_compare_and_swap(&frame_lock, 0, 1))
-        ;
-      std::atomic_thread_fence(std::memory_order_acquire);
-      call_frames.clear();
-      memset(static_call_frames, 0, NUM_CALL_FRAMES * sizeof(JVMPI_CallFrame));
-      frame_lock = 0;
-      std::atomic_thread_fence(std::memory_order_release);
-      jvmti->Deallocate((unsigned char *)entries);
-      logger->debug("Finished clearing frames and deallocating entries...");
+    std::vector<SampledLine> lines;
+    line_histogram.Draw(kCandidateDraws, AgentOptions::explore_floor / 100.0,
+        &lines);
+    JCOZ_DEBUG("Drew {} of {} sampled lines.", lines.size(),
+        line_histogram.Size());
+    std::vector<ExperimentScheduler::Candidate> candidates;
+    for (size_t i = 0; i < lines.size(); i++) {
+      ExperimentScheduler::Candidate candidate =
+        {lines[i].method_id, lines[i].lineno};
+      candidates.push_back(candidate);
+    }
+
+    ExperimentScheduler::Choice choice = ExperimentScheduler::Choose(candidates);
+    if (choice.candidate >= 0) {
+      const ExperimentScheduler::Candidate &chosen = candidates[choice.candidate];
+      std::pair<jint, jvmtiLineNumberEntry *> table =
+        lineTable(chosen.method_id);
+      if (table.second != NULL) {
+        current_experiment.method_id = chosen.method_id;
+        current_experiment.lineno = chosen.lineno;
+        setExperimentRanges(table.second, table.first, chosen.lineno);
+
+        // Experiments end with the profiling period.
+        long duration_ms = std::min((long) experiment_time,
+            window_end_ms - monotonic_ms());
+        runExperiment(jni_env, choice.speedup, duration_ms, false);
+      } else {
+        // The method's class has been unloaded since it was sampled.
+        JCOZ_DEBUG("No line table for the chosen line. Trying again.");
+      }
     } else {
-      logger->info("No frames found in agent thread. Trying sampling loop again...");
-      frame_lock = 0;
-      std::atomic_thread_fence(std::memory_order_release);
+      JCOZ_DEBUG("No in scope lines found. Trying sampling loop again...");
+    }
+
+    for (auto &table : tables) {
+      if (table.second.second != NULL) {
+        jvmti->Deallocate((unsigned char *) table.second.second);
+      }
     }
   }
 
-  logger->info("Profiler done running...");
+  JCOZ_INFO("Profiler done running...");
   profile_done = true;
 }
 
-bool Profiler::thread_in_main(jthread thread) {
+bool Profiler::thread_in_main(JNIEnv *jni_env, jthread thread) {
   jvmtiThreadInfo info;
   jvmtiError err = jvmti->GetThreadInfo(thread, &info);
   if (err != JVMTI_ERROR_NONE) {
@@ -407,103 +960,321 @@ bool Profiler::thread_in_main(jthread thread) {
       exit(1);
     }
   }
+  jvmti->Deallocate((unsigned char *) info.name);
+  if (info.context_class_loader != NULL) {
+    jni_env->DeleteLocalRef(info.context_class_loader);
+  }
+
+  // Once we have seen the main group we can compare references instead
+  // of asking the VM for the group name of every new thread.
+  jthreadGroup main_group = main_thread_group;
+  if (main_group != NULL) {
+    bool in_main = jni_env->IsSameObject(info.thread_group, main_group);
+    jni_env->DeleteLocalRef(info.thread_group);
+    return in_main;
+  }
 
   jvmtiThreadGroupInfo thread_grp;
   err = jvmti->GetThreadGroupInfo(info.thread_group, &thread_grp);
   if (err != JVMTI_ERROR_NONE) {
+    jni_env->DeleteLocalRef(info.thread_group);
     if (err == JVMTI_ERROR_WRONG_PHASE) {
       return false;
     } else {
       exit(1);
     }
   }
+  if (thread_grp.parent != NULL) {
+    jni_env->DeleteLocalRef(thread_grp.parent);
+  }
 
-  return !strcmp(thread_grp.name, "main");
+  bool in_main = !strcmp(thread_grp.name, "main");
+  jvmti->Deallocate((unsigned char *) thread_grp.name);
+  if (in_main) {
+    jthreadGroup global_group = (jthreadGroup) jni_env->NewGlobalRef(info.thread_group);
+    if (!__sync_bool_compare_and_swap(&main_thread_group, NULL, global_group)) {
+      jni_env->DeleteGlobalRef(global_group);
+    }
+  }
+  jni_env->DeleteLocalRef(info.thread_group);
+  return in_main;
 }
 
-void Profiler::addUserThread(jthread thread) {
-  if (thread_in_main(thread)) {
-    logger->debug("Adding user thread");
-    curr_ut = new struct UserThread();
-    curr_ut->thread = pthread_self();
-    curr_ut->local_delay = global_delay;
-    curr_ut->java_thread = thread;
-    curr_ut->points_hit = 0;
+void Profiler::addUserThread(JNIEnv *jni_env, jthread thread) {
+  curr_ut = NULL;
+  if (thread_in_main(jni_env, thread)) {
+    struct UserThread *ut = UserThreadSlab::Acquire();
+    if (ut == NULL) {
+      // Every slot is taken; this thread simply goes unprofiled.
+      return;
+    }
+    ut->local_delay = global_delay;
+    curr_ut = ut;
+    if (ut->timeline != NULL) {
+      ut->timeline->Record(kTimelineThreadStart, ut->tid, NULL, 0, 0);
+    }
+  }
+}
 
-    // user threads lock
-    while (!__sync_bool_compare_and_swap(&user_threads_lock, 0, 1))
-      ;
-    std::atomic_thread_fence(std::memory_order_acquire);
-    user_threads.insert(curr_ut);
-    user_threads_lock = 0;
-    std::atomic_thread_fence(std::memory_order_release);
+// Kernel thread ids of the threads with the given Thread.getId()s, 0
+// where one is not known, from JCozProfiler.nativeThreadIds.  Empty if
+// that could not be called.
+static std::vector<pid_t> nativeThreadIds(JNIEnv *jni_env,
+    const std::vector<jlong> &ids) {
+  std::vector<pid_t> tids;
+  jclass cls = jni_env->FindClass("jcoz/agent/JCozProfiler");
+  jmethodID mid = cls == NULL ? NULL
+    : jni_env->GetStaticMethodID(cls, "nativeThreadIds", "([J)[I");
+  jlongArray java_ids = mid == NULL ? NULL : jni_env->NewLongArray(ids.size());
+  if (java_ids == NULL) {
+    jni_env->ExceptionClear();
+    return tids;
+  }
+  if (!ids.empty()) {
+    jni_env->SetLongArrayRegion(java_ids, 0, ids.size(), &ids[0]);
+  }
+  jintArray result = (jintArray) jni_env->CallStaticObjectMethod(cls, mid,
+      java_ids);
+  if (jni_env->ExceptionCheck() || result == NULL) {
+    jni_env->ExceptionDescribe();
+    jni_env->ExceptionClear();
   } else {
-    curr_ut = NULL;
+    tids.resize(jni_env->GetArrayLength(result));
+    if (!tids.empty()) {
+      jni_env->GetIntArrayRegion(result, 0, tids.size(),
+          reinterpret_cast<jint *>(&tids[0]));
+    }
+    jni_env->DeleteLocalRef(result);
   }
+  jni_env->DeleteLocalRef(java_ids);
+  return tids;
 }
 
-void Profiler::removeUserThread(jthread thread) {
-  if (curr_ut != NULL) {
-    logger->debug("Removing user thread");
-    points_hit += curr_ut->points_hit;
-    curr_ut->points_hit = 0;
+void Profiler::adoptRunningThreads(JavaVM *vm, JNIEnv *jni_env) {
+  adopting_vm = vm;
+
+  // Threads that start from here on get a slot from ThreadStart, which
+  // only profiles the main thread group.  Running threads get the same
+  // filter here, on the attach thread, so compiler threads and the
+  // JDK's own system threads are never adopted.
+  jint num_threads = 0;
+  jthread *threads = NULL;
+  if (jvmti->GetAllThreads(&num_threads, &threads) != JVMTI_ERROR_NONE) {
+    JCOZ_WARN("Cannot list running threads, only new threads will be profiled");
+    return;
+  }
+  jclass thread_class = jni_env->FindClass("java/lang/Thread");
+  jmethodID get_id = thread_class == NULL ? NULL
+    : jni_env->GetMethodID(thread_class, "getId", "()J");
+  std::vector<jlong> ids;
+  for (jint i = 0; i < num_threads; i++) {
+    if (get_id != NULL && thread_in_main(jni_env, threads[i])) {
+      ids.push_back(jni_env->CallLongMethod(threads[i], get_id));
+    }
+    jni_env->DeleteLocalRef(threads[i]);
+  }
+  jvmti->Deallocate((unsigned char *) threads);
+  if (get_id == NULL) {
+    jni_env->ExceptionClear();
+  }
+
+  // JVMTI does not give a thread's kernel id, which is all SIGPROF can
+  // be aimed at.  The calling thread is the JVM's attach listener,
+  // which is not in the main group.
+  std::vector<pid_t> tids = nativeThreadIds(jni_env, ids);
+  if (tids.size() != ids.size()) {
+    JCOZ_WARN("Cannot find the kernel ids of running threads, only new threads will be profiled");
+    return;
+  }
+  int adopted = 0;
+  for (size_t i = 0; i < tids.size(); i++) {
+    if (tids[i] > 0 && UserThreadSlab::Adopt(tids[i])) {
+      adopted++;
+    }
+  }
+  JCOZ_INFO("Adopted {} of {} running threads in the main group", adopted,
+      ids.size());
+}
+
+struct UserThread *Profiler::bindAdoptedThread() {
+  if (adopting_vm == NULL) {
+    return NULL;
+  }
+  struct UserThread *ut = UserThreadSlab::Bind();
+  if (ut == NULL) {
+    return NULL;
+  }
 
-    long sleep_time = global_delay - curr_ut->local_delay;
+  // Only main group threads were adopted, and each is bound once.
+  // GetEnv with a JNI version only reads the VM's thread-local thread
+  // pointer, so it is safe here; a thread it finds no JNIEnv for is let
+  // go.
+  JNIEnv *env = NULL;
+  if (adopting_vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6)
+      != JNI_OK || env == NULL) {
+    UserThreadSlab::Release(ut);
+    return NULL;
+  }
+  Accessors::SetCurrentJniEnv(env);
+  ut->local_delay = global_delay;
+  curr_ut = ut;
+  return ut;
+}
+
+void Profiler::payDelayDebt(struct UserThread *ut) {
+  points_hit += ut->points_hit;
+  ut->points_hit = 0;
+
+  // Delay debt only means something while an experiment is running:
+  // runExperiment resets global_delay and Handle resets local_delay
+  // in between.  Inside an experiment the debt still has to be paid
+  // here, before anything that joins on this thread can observe it
+  // finishing early.
+  if (in_experiment) {
+    long sleep_time = global_delay - ut->local_delay;
     if( sleep_time > 0 ) {
-      jcoz_sleep(std::max(0L, sleep_time));
+      uint64_t delay_start = ProfilerStats::Now();
+      long actual = jcoz_sleep(sleep_time);
+      if (ut->timeline != NULL) {
+        ut->timeline->Record(delay_start, kTimelineDelay, ut->tid, NULL, 0,
+            actual);
+      }
+      ut->stats.delay_overshoot.Record(
+          actual > sleep_time ? actual - sleep_time : 0);
     } else {
       global_delay += std::labs(sleep_time);
     }
+  }
+}
 
-    // user threads lock
-    while (!__sync_bool_compare_and_swap(&user_threads_lock, 0, 1))
-      ;
-    std::atomic_thread_fence(std::memory_order_acquire);
-    user_threads.erase(curr_ut);
-    user_threads_lock = 0;
-    std::atomic_thread_fence(std::memory_order_release);
+void Profiler::removeUserThread(jthread thread) {
+  if (curr_ut != NULL) {
+    payDelayDebt(curr_ut);
 
-    delete curr_ut;
+    if (curr_ut->timeline != NULL) {
+      curr_ut->timeline->Record(kTimelineThreadEnd, curr_ut->tid, NULL, 0, 0);
+    }
+    UserThreadSlab::Release(curr_ut);
+    curr_ut = NULL;
   }
 }
 
-bool inline Profiler::inExperiment(JVMPI_CallFrame &curr_frame) {
-  if (curr_frame.method_id != current_experiment.method_id) {
-    return false;
+struct UserThread *Profiler::carrierSlot() {
+  // Carriers are the JDK's own threads, outside the main group, so
+  // ThreadStart gave them no slot.
+  if (curr_ut == NULL) {
+    curr_ut = UserThreadSlab::Acquire();
+  }
+  if (curr_ut != NULL) {
+    curr_ut->carrier = true;
+  }
+  return curr_ut;
+}
+
+void Profiler::startVirtualThread(jvmtiEnv *jvmti_env, jthread vthread) {
+  struct VirtualThread *vt = new VirtualThread();
+  vt->id = ++virtual_thread_count;
+  vt->debt = 0;
+  vt->experiment = experiment_count;
+  if (jvmti_env->SetThreadLocalStorage(vthread, vt) != JVMTI_ERROR_NONE) {
+    delete vt;
+    return;
   }
+  mountVirtualThread(jvmti_env, vthread);
+}
 
-  for (int i = 0; i < current_experiment.num_ranges; i++) {
-    if (curr_frame.lineno >= current_experiment.location_ranges[i].first
-        && curr_frame.lineno
-        < current_experiment.location_ranges[i].second) {
-      return true;
+void Profiler::endVirtualThread(jvmtiEnv *jvmti_env, jthread vthread) {
+  struct UserThread *ut = curr_ut;
+  if (ut != NULL && ut->vthread != NULL) {
+    payDelayDebt(ut);
+  }
+  unmountVirtualThread(jvmti_env, vthread);
+
+  struct VirtualThread *vt = NULL;
+  if (jvmti_env->GetThreadLocalStorage(vthread, (void **) &vt)
+      == JVMTI_ERROR_NONE && vt != NULL) {
+    jvmti_env->SetThreadLocalStorage(vthread, NULL);
+    delete vt;
+  }
+}
+
+void Profiler::mountVirtualThread(jvmtiEnv *jvmti_env, jthread vthread) {
+  struct VirtualThread *vt = NULL;
+  if (jvmti_env->GetThreadLocalStorage(vthread, (void **) &vt)
+      != JVMTI_ERROR_NONE) {
+    return;
+  }
+  if (vt == NULL) {
+    // Started before the agent was attached.
+    vt = new VirtualThread();
+    vt->id = ++virtual_thread_count;
+    vt->debt = 0;
+    vt->experiment = experiment_count;
+    if (jvmti_env->SetThreadLocalStorage(vthread, vt) != JVMTI_ERROR_NONE) {
+      delete vt;
+      return;
     }
   }
-  return false;
+  struct UserThread *ut = carrierSlot();
+  if (ut == NULL) {
+    return;
+  }
+
+  // Delays inserted while it was unmounted are not owed, as for a
+  // blocked thread, but what it owed when it unmounted still is.
+  long debt = in_experiment && vt->experiment == experiment_count ? vt->debt : 0;
+  ut->local_delay = global_delay - debt;
+  ut->num_signals_received = 0;
+  // The handler reads local_delay once it sees vthread set.
+  std::atomic_signal_fence(std::memory_order_release);
+  ut->vthread = vt;
+  if (ut->timeline != NULL) {
+    ut->timeline->Record(kTimelineMount, ut->tid, NULL, 0, vt->id);
+  }
 }
 
-bool inline Profiler::frameInScope(JVMPI_CallFrame &curr_frame) {
-  return in_scope_ids.count((void *) curr_frame.method_id) > 0;
+void Profiler::unmountVirtualThread(jvmtiEnv *jvmti_env, jthread vthread) {
+  IMPLICITLY_USE(jvmti_env);
+  IMPLICITLY_USE(vthread);
+  struct UserThread *ut = curr_ut;
+  if (ut == NULL || ut->vthread == NULL) {
+    return;
+  }
+  struct VirtualThread *vt = ut->vthread;
+  // Taken before vthread is cleared, after which the handler treats the
+  // carrier as idle and forgives its debt.
+  long debt = in_experiment ? global_delay - ut->local_delay : 0;
+  std::atomic_signal_fence(std::memory_order_acq_rel);
+  ut->vthread = NULL;
+  vt->debt = debt;
+  vt->experiment = experiment_count;
+  // The carrier goes back to running the scheduler, which owes nothing.
+  ut->local_delay = global_delay;
+  if (ut->timeline != NULL) {
+    ut->timeline->Record(kTimelineUnmount, ut->tid, NULL, 0, vt->id);
+  }
 }
 
 void Profiler::addInScopeMethods(jint method_count, jmethodID *methods) {
-  logger->info("Adding {:d} in scope methods\n", method_count);
+  JCOZ_DEBUG("Adding {:d} in scope methods", method_count);
   while (!__sync_bool_compare_and_swap(&in_scope_lock, 0, pthread_self()))
     ;
   std::atomic_thread_fence(std::memory_order_acquire);
   for (int i = 0; i < method_count; i++) {
     void *method = (void *)methods[i];
-    logger->info("Adding in scope method {}\n", method);
+    JCOZ_DEBUG("Adding in scope method {}", method);
     in_scope_ids.insert(method);
+    in_scope_filter.Add(methods[i]);
   }
   in_scope_lock = 0;
   std::atomic_thread_fence(std::memory_order_release);
 }
 
 void Profiler::clearInScopeMethods(){
-  logger->info("Clearing current in scope methods.");
+  JCOZ_INFO("Clearing current in scope methods.");
   while (!__sync_bool_compare_and_swap(&in_scope_lock, 0, pthread_self()));
   in_scope_ids.clear();
+  in_scope_filter.Clear();
   in_scope_lock = 0;
 }
 
@@ -531,7 +1302,7 @@ void Profiler::addProgressPoint(jint method_count, jmethodID *methods) {
         progress_point->method_id = methods[i];
         progress_point->location = curr_entry.start_location;
         jvmti->SetBreakpoint(progress_point->method_id, progress_point->location);
-        logger->info("Progress point set");
+        JCOZ_INFO("Progress point set");
         return;
       }
     }
@@ -553,7 +1324,7 @@ void Profiler::setMBeanObject(jobject mbean){
     fprintf(stderr, "could not get mbean class\n");
     fflush(stderr);
   }
-  mbean_cache_method_id = jni_->GetMethodID(mbeanClass, "cacheOutput", "(Ljava/lang/String;IFJJ)V");
+  mbean_cache_method_id = jni_->GetMethodID(mbeanClass, "cacheOutput", "(Ljava/lang/String;IFJJJJJ)V");
   if (Profiler::mbean_cache_method_id == nullptr){
     fprintf(stderr, "could not get method id\n");
     fflush(stderr);
@@ -565,7 +1336,10 @@ jobject Profiler::getMBeanObject(){
 }
 
 void Profiler::clearMBeanObject(){
-  jni_->DeleteGlobalRef(Profiler::mbean);
+  if (Profiler::mbean != NULL) {
+    jni_->DeleteGlobalRef(Profiler::mbean);
+    Profiler::mbean = NULL;
+  }
 }
 
 void Profiler::setJNI(JNIEnv* jni){
@@ -573,99 +1347,166 @@ void Profiler::setJNI(JNIEnv* jni){
 }
 
 void Profiler::Handle(int signum, siginfo_t *info, void *context) {
-  if( !prof_ready ) {
-    return;
-  }
   IMPLICITLY_USE(signum);
   IMPLICITLY_USE(info);
 
+  struct UserThread *ut = curr_ut;
+  if (ut == NULL) {
+    ut = bindAdoptedThread();
+  }
+  struct ThreadStats *stats =
+    ut != NULL ? &ut->stats : ProfilerStats::Shared();
+  uint64_t start = ProfilerStats::Now();
+  uint64_t slept = HandleSample(ut, stats, context);
+  // Time spent sleeping off delays is the experiment, not overhead.
+  uint64_t elapsed = ProfilerStats::Now() - start;
+  stats->handler_latency.Record(elapsed > slept ? elapsed - slept : 0);
+}
+
+// Takes one sample for the current thread and returns the number of
+// nanoseconds it spent sleeping to insert delays.
+uint64_t Profiler::HandleSample(struct UserThread *ut,
+    struct ThreadStats *stats, void *context) {
+  stats->samples.Add(1);
+  if( !prof_ready ) {
+    stats->samples_dropped.Add(1);
+    return 0;
+  }
+
   JNIEnv *env = Accessors::CurrentJniEnv();
-  if (env == NULL) {
+  if (env == NULL || ut == NULL || ut->frames == NULL) {
+    stats->samples_dropped.Add(1);
+    return 0;
+  }
 
-    return;
+  // Between virtual threads a carrier only runs the scheduler, which
+  // is never in scope and owes no delays.
+  if (ut->carrier && ut->vthread == NULL) {
+    ut->local_delay = global_delay;
+    return 0;
+  }
+
+  // The frames are only read up to num_frames, so the buffer is reused
+  // as is.  During an experiment we only need to reach the experiment's
+  // line, and no in-scope frame has been seen below scope_depth.
+  bool experiment = in_experiment;
+  int depth = AgentOptions::stack_depth;
+  if (experiment) {
+    int needed = scope_depth.load(std::memory_order_relaxed);
+    if (needed > 0 && needed < depth) {
+      depth = needed;
+    }
   }
 
   JVMPI_CallTrace trace;
-  JVMPI_CallFrame frames[kMaxFramesToCapture];
-  // We have to set every byte to 0 instead of just initializing the
-  // individual fields, because the structs might be padded, and we
-  // use memcmp on it later.  We can't use memset, because it isn't
-  // async-safe.
-  char *base = reinterpret_cast<char *>(frames);
-  for (char *p = base;
-      p < base + sizeof(JVMPI_CallFrame) * kMaxFramesToCapture; p++) {
-    *p = 0;
-  }
-
-  trace.frames = frames;
+  trace.frames = ut->frames;
   trace.env_id = env;
 
   ASGCTType asgct = Asgct::GetAsgct();
-  (*asgct)(&trace, kMaxFramesToCapture, context);
+  (*asgct)(&trace, depth, context);
 
+  ProfilerStats::RecordCallTrace(stats, trace.num_frames);
   if (trace.num_frames < 0) {
     int idx = -trace.num_frames;
     if (idx > kNumCallTraceErrors) {
-      return;
+      stats->samples_dropped.Add(1);
+      return 0;
     }
   }
 
-  if (!in_experiment) {
+  uint64_t slept = 0;
+  if (!experiment) {
 
-    // lock in scope
-    curr_ut->local_delay = 0;
-    bool has_lock = in_scope_lock == pthread_self();
-    if (!has_lock) {
-      while (!__sync_bool_compare_and_swap(&in_scope_lock, 0,
-            pthread_self()))
-        ;
+    ut->local_delay = 0;
+    // Samples outside experiments walk the full depth, so they are the
+    // ones worth keeping for the hot-path profile.
+    if (!AgentOptions::trace_file.empty() && trace.num_frames > 0) {
+      traces.Add(trace);
     }
-    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // Only frames that pass the filter need the lock and the hash set;
+    // most samples have none and never touch either.  Every
+    // kDepthProbeInterval samples, keep going with the filter alone
+    // after recording the first in-scope frame, to find how deep
+    // in-scope frames go.
+    bool probe_depth = (ut->samples_taken++ % kDepthProbeInterval) == 0;
+    bool has_lock = in_scope_lock == pthread_self();
+    bool took_lock = false;
+    bool recorded = false;
+    int recorded_at = -1;
+    int deepest = -1;
     for (int i = 0; i < trace.num_frames; i++) {
       JVMPI_CallFrame &curr_frame = trace.frames[i];
-      if (frameInScope(curr_frame)) {
-        // lock frame lock
-        while (!__sync_bool_compare_and_swap(&frame_lock, 0, 1))
-          ;
+      if (!in_scope_filter.MayContain(curr_frame.method_id)) {
+        continue;
+      }
+      deepest = i;
+      if (recorded) {
+        if (!probe_depth) {
+          break;
+        }
+        continue;
+      }
+      if (!has_lock && !took_lock) {
+        spin_lock(&in_scope_lock, pthread_self(), stats);
         std::atomic_thread_fence(std::memory_order_acquire);
-        int index = call_index.fetch_add(1);
-        if (index < NUM_CALL_FRAMES) {
-          static_call_frames[index] = curr_frame;
+        took_lock = true;
+      }
+      if (frameInScope(curr_frame)) {
+        if (!frame_counts.Add(curr_frame)) {
+          stats->samples_dropped.Add(1);
         }
-        frame_lock = 0;
-        std::atomic_thread_fence(std::memory_order_release);
-        break;
+        recorded = true;
+        recorded_at = i;
       }
     }
-    if (!has_lock) {
+    if (took_lock) {
       in_scope_lock = 0;
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    // A recorded frame may become an experiment's line, so experiments
+    // must always reach as deep as it was; probes look further.
+    int needed = probe_depth ? deepest : recorded_at;
+    if (needed >= 0) {
+      raiseScopeDepth(needed + 1);
     }
-    std::atomic_thread_fence(std::memory_order_release);
   } else {
 
-    curr_ut->num_signals_received++;
-    for (int i = 0; i < trace.num_frames; i++) {
-      JVMPI_CallFrame &curr_frame = trace.frames[i];
-      if (inExperiment(curr_frame)) {
-        curr_ut->local_delay += current_experiment.delay;
-        break;
-      }
+    ut->num_signals_received++;
+    if (traceInExperiment(trace)) {
+      ut->local_delay += current_experiment.delay;
     }
 
-    if( curr_ut->num_signals_received == 10 ) {
-      long sleep_diff = global_delay - curr_ut->local_delay;
+    if( ut->num_signals_received == 10 ) {
+      long sleep_diff = global_delay - ut->local_delay;
       if( sleep_diff > 0 ) {
-        curr_ut->local_delay += jcoz_sleep(sleep_diff);
+        uint64_t delay_start = ProfilerStats::Now();
+        long actual = jcoz_sleep(sleep_diff);
+        if (ut->timeline != NULL) {
+          ut->timeline->Record(delay_start, kTimelineDelay, ut->tid, NULL, 0,
+              actual);
+        }
+        ut->local_delay += actual;
+        slept = actual;
+        stats->delay_overshoot.Record(actual > sleep_diff ? actual - sleep_diff : 0);
       } else {
         global_delay += std::labs(sleep_diff);
       }
 
-      curr_ut->num_signals_received = 0;
+      ut->num_signals_received = 0;
     }
 
-    points_hit += curr_ut->points_hit;
-    curr_ut->points_hit = 0;
+    points_hit += ut->points_hit;
+    ut->points_hit = 0;
   }
+  return slept;
+}
+
+void Profiler::raiseScopeDepth(int depth) {
+  int current = scope_depth.load(std::memory_order_relaxed);
+  while (current < depth
+      && !scope_depth.compare_exchange_weak(current, depth, std::memory_order_relaxed))
+    ;
 }
 
 struct sigaction SignalHandler::SetAction(
@@ -690,10 +1531,28 @@ void Profiler::Start() {
   // old_action_ is stored, but never used.  This is in case of future
   // refactorings that need it.
 
-  logger->info("Starting profiler...");
+  JCOZ_INFO("Starting profiler...");
+  FrameScan::Init();
+  scope_depth = 0;
+  traces.Clear();
+  frame_counts.Clear();
+  line_histogram.Clear();
+  // Each profiling run gets a timeline of its own.
+  Timeline::Init();
+  if (Timeline::Agent() != NULL) {
+    Timeline::Agent()->Clear();
+    Timeline::Shared()->Clear();
+    int high_water = UserThreadSlab::HighWater();
+    for (int i = 0; i < high_water; i++) {
+      if (UserThreadSlab::Slot(i)->timeline != NULL) {
+        UserThreadSlab::Slot(i)->timeline->Clear();
+      }
+    }
+  }
+  OverheadGovernor::Reset();
+  ExperimentScheduler::Reset();
+  JCOZ_INFO("Using the {} stack scan", FrameScan::Isa());
   old_action_ = handler_.SetAction(&Profiler::Handle);
-  std::srand(unsigned(std::time(0)));
-  call_frames.reserve(2000);
   _running = true;
 }
 
@@ -759,7 +1618,7 @@ void Profiler::cleanSignature(char *sig) {
 
 void Profiler::clearProgressPoint() {
   if( !end_to_end && (progress_point->method_id != nullptr) ) {
-    logger->info("Clearing breakpoint");
+    JCOZ_INFO("Clearing breakpoint");
     jvmti->ClearBreakpoint(progress_point->method_id, progress_point->location);
     progress_point->method_id = nullptr;
   }
@@ -769,7 +1628,7 @@ void Profiler::Stop() {
 
   // Wait until we get to the end of the run
   // and then flush the profile output
-  logger->info("Stopping profiler");
+  JCOZ_INFO("Stopping profiler");
   if(_running){
     if (end_to_end) {
       points_hit++;
@@ -777,16 +1636,73 @@ void Profiler::Stop() {
 
     _running = false;
 
-    logger->info("Waiting for profiler to finish current cycle...");
+    JCOZ_INFO("Waiting for profiler to finish current cycle...");
     while (!profile_done)
       ;
 
-    logger->info("Profiler finished current cycle...");
+    JCOZ_INFO("Profiler finished current cycle...");
+    closeProfile();
+    dumpTraces();
+    dumpTimeline();
   }
 
   clearInScopeMethods();
+  clearSchedule();
   signal(SIGPROF, SIG_IGN);
-  logger->flush();
+  AgentLogger::Flush();
+}
+
+void Profiler::dumpTraces() {
+  if (AgentOptions::trace_file.empty()) {
+    return;
+  }
+
+  FILE *file = fopen(AgentOptions::trace_file.c_str(), "w");
+  if (file == NULL) {
+    JCOZ_ERROR("Could not open trace file {}: {}", AgentOptions::trace_file,
+        strerror(errno));
+    return;
+  }
+  StackTracesPrinter printer(file, jvmti);
+  printer.PrintCollapsedStacks(traces.GetTraces(), traces.MaxEntries());
+  fclose(file);
+
+  if (traces.Dropped() > 0) {
+    JCOZ_WARN("Trace table out of room: {} samples left out of {}", traces.Dropped(),
+        AgentOptions::trace_file);
+  }
+  JCOZ_INFO("Wrote collapsed stacks to {}", AgentOptions::trace_file);
+}
+
+void Profiler::dumpTimeline() {
+  if (AgentOptions::timeline_file.empty()) {
+    return;
+  }
+
+  std::vector<const TimelineBuffer *> buffers;
+  long dropped = 0;
+  buffers.push_back(Timeline::Agent());
+  buffers.push_back(Timeline::Shared());
+  int high_water = UserThreadSlab::HighWater();
+  for (int i = 0; i < high_water; i++) {
+    if (UserThreadSlab::Slot(i)->timeline != NULL) {
+      buffers.push_back(UserThreadSlab::Slot(i)->timeline);
+    }
+  }
+  for (size_t i = 0; i < buffers.size(); i++) {
+    dropped += buffers[i]->Dropped();
+  }
+
+  if (!Timeline::Write(AgentOptions::timeline_file.c_str(), jvmti, buffers)) {
+    JCOZ_ERROR("Could not write timeline {}: {}", AgentOptions::timeline_file,
+        strerror(errno));
+    return;
+  }
+  if (dropped > 0) {
+    JCOZ_WARN("Timeline buffers full: {} events left out of {}", dropped,
+        AgentOptions::timeline_file);
+  }
+  JCOZ_INFO("Wrote timeline to {}", AgentOptions::timeline_file);
 }
 
 void Profiler::setJVMTI(jvmtiEnv *jvmti_env) {
@@ -801,6 +1717,12 @@ Profiler::HandleBreakpoint(
     jmethodID method_id,
     jlocation location
     ) {
-  curr_ut->points_hit += in_experiment;
+  progress_seen.fetch_add(1, std::memory_order_relaxed);
+  if (curr_ut != NULL) {
+    curr_ut->points_hit += in_experiment;
+    if (curr_ut->timeline != NULL) {
+      curr_ut->timeline->Record(kTimelineProgress, curr_ut->tid, NULL, 0, 0);
+    }
+  }
 }
 
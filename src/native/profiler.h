@@ -19,22 +19,26 @@
  * a copy of the license that was included with that original work.
  */
 
+#include <math.h>
 #include <signal.h>
 #include <jvmti.h>
+#include <algorithm>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
 #include <atomic>
+#include <deque>
 #include <pthread.h>
 #include <fstream>
 #include <iostream>
 
+#include "framescan.h"
 #include "globals.h"
+#include "logger.h"
+#include "options.h"
 #include "stacktraces.h"
-#include "spdlog/spdlog.h"
-#ifdef SPDLOG_VERSION
-#include "spdlog/sinks/basic_file_sink.h"
-#endif
+#include "stats.h"
+#include "userthreads.h"
 
 #ifndef PROFILER_H
 #define PROFILER_H
@@ -44,18 +48,58 @@ struct Experiment {
   float speedup;
   long delay;
   long duration = 0;
+  // Sampling period the experiment ran at; delays scale with it.
+  long sample_period = 0;
+  // Relative standard error of the progress rate when it ended.
+  double rse = HUGE_VAL;
+  // Nanoseconds of the experiment spent in garbage collection pauses.
+  long gc_pause = 0;
+  // Wall-clock start of the window a scheduled experiment ran in, which
+  // tells a coordinator's replicas' reports of it apart; 0 otherwise.
+  long window_ms = 0;
   jmethodID method_id;
   jint lineno;
   std::pair<jint,jint> *location_ranges;
   int num_ranges;
 };
 
-struct UserThread {
-  pthread_t thread;
-  long local_delay = 0;
-  long points_hit = 0;
-  unsigned int num_signals_received = 0;
-  jthread java_thread;
+// Progress-point hits per fixed-length batch of an experiment.  Hits
+// in neighbouring instants are correlated, but means of long enough
+// batches are close to independent, so the spread of the batch means
+// gives the standard error of the experiment's progress rate.
+struct BatchMeans {
+  long batches = 0;
+  double sum = 0;
+  double sum_sq = 0;
+
+  void Add(double hits) {
+    batches++;
+    sum += hits;
+    sum_sq += hits * hits;
+  }
+
+  // Standard error of the mean over the mean; infinite until there are
+  // two batches and a hit.
+  double RelativeStdError() const {
+    if (batches < 2 || sum <= 0) {
+      return HUGE_VAL;
+    }
+    double mean = sum / batches;
+    double variance = (sum_sq - batches * mean * mean) / (batches - 1);
+    return sqrt(std::max(variance, 0.0) / batches) / mean;
+  }
+};
+
+// An experiment that a coordinator runs on several JVMs at once, or one
+// replayed from a recorded schedule.  The class signature is in the form
+// experiments are reported in, and start_ms is wall-clock time since the
+// epoch.
+struct ScheduledExperiment {
+  std::string class_sig;
+  jint lineno;
+  float speedup;
+  long start_ms;
+  long duration_ms;
 };
 
 struct ProgressPoint {
@@ -64,6 +108,27 @@ struct ProgressPoint {
   jlocation location;
 };
 
+/**
+ * Sleep for the given number of nanoseconds, resuming after signals.
+ * Returns the time actually slept.
+ */
+long jcoz_sleep(long nanoseconds);
+
+/**
+ * Spin until *lock goes from 0 to value.  Time spent waiting is
+ * charged to stats; the uncontended path does not read the clock.
+ */
+template <typename T>
+static inline void spin_lock(volatile T *lock, T value, struct ThreadStats *stats) {
+  if (__sync_bool_compare_and_swap(lock, (T) 0, value)) {
+    return;
+  }
+  uint64_t start = ProfilerStats::Now();
+  while (!__sync_bool_compare_and_swap(lock, (T) 0, value))
+    ;
+  stats->spin_wait_ns.Add(ProfilerStats::Now() - start);
+}
+
 class SignalHandler {
   public:
     SignalHandler() {}
@@ -74,11 +139,6 @@ class SignalHandler {
     DISALLOW_COPY_AND_ASSIGN(SignalHandler);
 };
 
-struct TraceData {
-  intptr_t count;
-  JVMPI_CallTrace trace;
-};
-
 class Profiler {
   public:
     explicit Profiler(jvmtiEnv *jvmti) : jvmti_(jvmti) {}
@@ -91,7 +151,8 @@ class Profiler {
 
     static std::string &getProgressClass() { return progress_class; }
 
-    static std::shared_ptr<spdlog::logger> &getLogger() { return logger; };
+    // Lists the agent options on stderr.
+    static void print_usage();
 
     static std::unordered_set<void *> &getInScopeMethods() { return in_scope_ids; }
 
@@ -99,14 +160,31 @@ class Profiler {
 
     static bool inExperiment() { return in_experiment; }
 
-    static std::unordered_set<struct UserThread*> &getUserThreads() { return user_threads; }
-
     static void runAgentThread(jvmtiEnv *jvmti_env, JNIEnv *jni_env, void *args);
 
-    static void addUserThread(jthread thread);
+    static void addUserThread(JNIEnv *jni_env, jthread thread);
 
     static void removeUserThread(jthread thread);
 
+    // Virtual threads, each called on the carrier the virtual thread is
+    // mounted on.  Start and end stand for the first mount and the last
+    // unmount.  A virtual thread's delay debt moves with it from carrier
+    // to carrier, and samples taken on a carrier are of the virtual
+    // thread mounted there.
+    static void startVirtualThread(jvmtiEnv *jvmti_env, jthread vthread);
+
+    static void endVirtualThread(jvmtiEnv *jvmti_env, jthread vthread);
+
+    static void mountVirtualThread(jvmtiEnv *jvmti_env, jthread vthread);
+
+    static void unmountVirtualThread(jvmtiEnv *jvmti_env, jthread vthread);
+
+    // For an agent attached to a running JVM: gives every thread of the
+    // main group that is already running a slot it binds on its first
+    // SIGPROF, as ThreadStart would have.  vm is used from the signal
+    // handler to find the thread's JNIEnv.
+    static void adoptRunningThreads(JavaVM *vm, JNIEnv *jni_env);
+
     void setJVMTI(jvmtiEnv *jvmti);
 
     jvmtiEnv * getJVMTI();
@@ -131,6 +209,10 @@ class Profiler {
 
     void setProgressPoint(std::string class_name, jint line_no);
 
+    // With no progress point, each profiling run is one experiment and
+    // Stop counts as the one progress point.
+    void setEndToEnd(bool end_to_end);
+
     void setMBeanObject(jobject mbean);
 
     jobject getMBeanObject();
@@ -141,6 +223,13 @@ class Profiler {
 
     static void clearInScopeMethods();
 
+    // Queues an experiment to run at a fixed time.  From the first call
+    // until clearSchedule, the agent thread runs only scheduled
+    // experiments and stops picking its own.
+    static void scheduleExperiment(const ScheduledExperiment &scheduled);
+
+    static void clearSchedule();
+
     static bool isRunning();
 
     void init();
@@ -157,8 +246,59 @@ class Profiler {
 
     static void Handle(int signum, siginfo_t *info, void *context);
 
-    static bool inline inExperiment(JVMPI_CallFrame &curr_frame);
-    static bool inline frameInScope(JVMPI_CallFrame &curr_frame);
+    static uint64_t HandleSample(struct UserThread *ut,
+        struct ThreadStats *stats, void *context);
+
+    // Binds the calling thread's adopted slot, if it has one and is a
+    // Java thread.  Async-signal-safe.
+    static struct UserThread *bindAdoptedThread();
+
+    // Sleeps off the delays ut owes before its thread, platform or
+    // virtual, ends.
+    static void payDelayDebt(struct UserThread *ut);
+
+    // The calling carrier's slot, claimed on its first mount.  NULL if
+    // every slot is taken.
+    static struct UserThread *carrierSlot();
+
+    // Experiments run so far, to tell whose delays a debt is.
+    static std::atomic_ulong experiment_count;
+
+    // Virtual threads seen so far.
+    static std::atomic_long virtual_thread_count;
+
+    // Set once running threads have been adopted.
+    static JavaVM *adopting_vm;
+
+    static bool inExperiment(JVMPI_CallFrame &curr_frame) {
+      return curr_frame.method_id == current_experiment.method_id
+        && FrameScan::InRanges(current_experiment.location_ranges,
+            current_experiment.num_ranges, curr_frame.lineno);
+    }
+
+    // Whether any frame of the trace is on the experiment's line.
+    static bool traceInExperiment(const JVMPI_CallTrace &trace) {
+      jmethodID method = current_experiment.method_id;
+      int i = FrameScan::FindMethod(trace.frames, trace.num_frames, method, 0);
+      while (i >= 0) {
+        if (FrameScan::InRanges(current_experiment.location_ranges,
+              current_experiment.num_ranges, trace.frames[i].lineno)) {
+          return true;
+        }
+        i = FrameScan::FindMethod(trace.frames, trace.num_frames, method, i + 1);
+      }
+      return false;
+    }
+
+    // Call with in_scope_lock held; rule frames out with
+    // in_scope_filter first.
+    static bool frameInScope(JVMPI_CallFrame &curr_frame) {
+      return in_scope_ids.count((void *) curr_frame.method_id) > 0;
+    }
+
+    // The native microbenchmarks in bench/ time the private hot paths.
+    friend class ProfilerBench;
+
     DISALLOW_COPY_AND_ASSIGN(Profiler);
 
     static jobject mbean;
@@ -167,21 +307,41 @@ class Profiler {
 
     static std::unordered_set<void *> in_scope_ids;
 
-    static struct Experiment current_experiment;
+    static MethodFilter in_scope_filter;
+
+    // One past the deepest frame index at which an in-scope frame has
+    // been recorded in the histogram or seen by a depth probe.
+    // Experiments only walk this far, which reaches every candidate at
+    // the depth it was sampled at.
+    static std::atomic<int> scope_depth;
+
+    static void raiseScopeDepth(int depth);
 
-    static std::vector<JVMPI_CallFrame> call_frames;
+    // Every stack sampled outside an experiment, for the hot-path
+    // profile written by dumpTraces.
+    static AsyncSafeTraceMultiset traces;
 
-    static volatile int frame_lock;
+    static void dumpTraces();
 
-    static volatile int user_threads_lock;
+    // Writes AgentOptions::timeline_file from every timeline buffer.
+    static void dumpTimeline();
+
+    static struct Experiment current_experiment;
+
+    // The first in-scope frame of every sample taken outside an
+    // experiment, until the agent thread resolves it to a line.
+    static FrameCounts frame_counts;
+
+    // The sampled lines, from which experiment lines are drawn.
+    static LineHistogram line_histogram;
 
     static volatile bool in_experiment;
 
     static std::atomic_ulong points_hit;
 
-    static std::unordered_set<struct UserThread*> user_threads;
+    static bool thread_in_main(JNIEnv *jni_env, jthread thread);
 
-    static bool thread_in_main(jthread thread);
+    static volatile jthreadGroup main_thread_group;
 
     static jvmtiEnv *jvmti;
 
@@ -189,9 +349,36 @@ class Profiler {
 
     static std::atomic_bool _running;
 
-    static void runExperiment(JNIEnv * jnienv);
+    static void runExperiment(JNIEnv * jnienv, float speedup,
+        long duration_ms, bool scheduled);
+
+    static void setExperimentRanges(jvmtiLineNumberEntry *entries,
+        jint num_entries, jint line);
+
+    static std::deque<ScheduledExperiment> schedule;
+
+    static pthread_mutex_t schedule_mutex;
+
+    static std::atomic_bool coordinated;
+
+    // The schedule read from AgentOptions::replay_file, and the entry to
+    // run next.
+    static std::vector<ScheduledExperiment> replay;
+
+    static size_t replay_next;
+
+    // Reads AgentOptions::replay_file into replay.  Returns false if it
+    // cannot be read or holds no experiments.
+    static bool loadReplay();
+
+    static bool nextScheduledExperiment(ScheduledExperiment *scheduled);
+
+    static bool findScheduledLine(const ScheduledExperiment &scheduled);
 
-    static float calculate_random_speedup();
+    // Runs scheduled at its time.  Returns false, having run nothing, if
+    // no in-scope method has its line.
+    static bool runScheduledExperiment(JNIEnv *jni_env,
+        const ScheduledExperiment &scheduled);
 
     static void signal_user_threads();
 
@@ -209,21 +396,52 @@ class Profiler {
 
     static std::string package;
 
-    static void print_usage();
-
     static struct ProgressPoint *progress_point;
 
     static std::string progress_class;
 
     static unsigned long experiment_time;
 
-    static unsigned long warmup_time;
-
     static bool prof_ready;
 
-    static bool fix_exp;
+    // Progress point hits whether or not an experiment is running, for
+    // telling quiet periods apart when duty cycling.
+    static std::atomic_ulong progress_seen;
+
+    // Sits out the idle part of a duty cycle and sets *window_end_ms to
+    // the end of the profiling period that follows.  Returns false if
+    // profiling stopped meanwhile.
+    static bool idleUntilNextWindow(long *window_end_ms);
+
+    // The progress point as coz records name it: class:line in dotted
+    // form, or end-to-end.
+    static std::string progressPointName();
+
+    // Appends the experiment just finished to AgentOptions::profile_file.
+    static void appendToProfile(const char *sig);
+
+    // Flushes, or flushes and closes, the profile kept open between
+    // experiments.
+    static void flushProfile();
+
+    // Flushes the profile kept open if AgentOptions::profile_flush_s
+    // have passed since it last was.
+    static void flushProfileIfDue();
+
+    static void closeProfile();
+
+    // AgentOptions::profile_file, when it is kept open between
+    // experiments, and when it was last flushed.
+    static FILE *profile_out;
+
+    static long profile_flushed_ms;
+
+    // Appends the experiment just finished to AgentOptions::record_file,
+    // with note, if not NULL, as a last column.
+    static void appendToRecord(const char *sig, const char *note);
 
-    static std::shared_ptr<spdlog::logger> logger;
+    // What rand() was seeded with for this run.
+    static unsigned int seed;
 };
 
 #endif  // PROFILER_H
@@ -0,0 +1,123 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+struct RingHeader *ResultRing::header_ = NULL;
+struct RingRecord *ResultRing::records_ = NULL;
+size_t ResultRing::length_ = 0;
+
+static uint64_t WallClockNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool ResultRing::Open(const std::string &path, long records) {
+  uint64_t capacity = 1;
+  while (capacity < (uint64_t) records) {
+    capacity <<= 1;
+  }
+  size_t length = sizeof(RingHeader) + capacity * sizeof(RingRecord);
+
+  // A new inode rather than truncating the old one, which would fault
+  // readers that map it.
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    JCOZ_ERROR("Could not replace result ring {}: {}", path, strerror(errno));
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    JCOZ_ERROR("Could not create result ring {}: {}", path, strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, length) != 0) {
+    JCOZ_ERROR("Could not size result ring {}: {}", path, strerror(errno));
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    JCOZ_ERROR("Could not map result ring {}: {}", path, strerror(errno));
+    return false;
+  }
+
+  // The file starts out zeroed, so every record reads as unwritten.
+  struct RingHeader *header = static_cast<struct RingHeader *>(map);
+  header->version = kRingVersion;
+  header->record_size = sizeof(RingRecord);
+  header->capacity = capacity;
+  header->published.store(0, std::memory_order_relaxed);
+  header->pid = (uint32_t) getpid();
+  header->created_ns = WallClockNs();
+  // Readers check the magic last.
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = kRingMagic;
+
+  header_ = header;
+  records_ = reinterpret_cast<struct RingRecord *>(header + 1);
+  length_ = length;
+  JCOZ_INFO("Publishing experiments to result ring {} ({} records)", path,
+      capacity);
+  return true;
+}
+
+void ResultRing::Close() {
+  if (header_ == NULL) {
+    return;
+  }
+  munmap(header_, length_);
+  header_ = NULL;
+  records_ = NULL;
+}
+
+void ResultRing::Publish(const char *sig, const char *point, int32_t lineno,
+    float speedup,
+    int64_t duration_ns, int64_t points_hit, int64_t sample_period_ns,
+    int64_t gc_pause_ns, bool gc_dominated) {
+  if (header_ == NULL) {
+    return;
+  }
+  uint64_t n = header_->published.load(std::memory_order_relaxed);
+  struct RingRecord *record = &records_[n & (header_->capacity - 1)];
+  record->seq.store(0, std::memory_order_relaxed);
+  // Keeps the field stores below from moving above the seq store.
+  std::atomic_thread_fence(std::memory_order_release);
+  record->end_ns = WallClockNs();
+  record->duration_ns = duration_ns;
+  record->points_hit = points_hit;
+  record->sample_period_ns = sample_period_ns;
+  record->gc_pause_ns = gc_pause_ns;
+  record->speedup = speedup;
+  record->lineno = lineno;
+  record->flags = gc_dominated ? kRingGcDominated : 0;
+  strncpy(record->class_sig, sig, kRingClassSigLength - 1);
+  record->class_sig[kRingClassSigLength - 1] = '\0';
+  strncpy(record->progress_point, point, kRingPointLength - 1);
+  record->progress_point[kRingPointLength - 1] = '\0';
+  record->seq.store(n + 1, std::memory_order_release);
+  header_->published.store(n + 1, std::memory_order_release);
+}
@@ -0,0 +1,60 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+
+#include "globals.h"
+#include "ringformat.h"
+
+#ifndef RING_H
+#define RING_H
+
+// Publishes every experiment into a memory-mapped file, laid out as in
+// ringformat.h, so that local readers can follow results without JMX
+// and without the agent waiting on them.  The ring outlives profiling
+// sessions: it is created when the agent loads and written until the
+// JVM exits.
+class ResultRing {
+  public:
+    // Replaces whatever is at path with an empty ring of at least
+    // records records.  Readers that still map an older file keep it.
+    static bool Open(const std::string &path, long records);
+
+    static void Close();
+
+    static bool Enabled() { return header_ != NULL; }
+
+    // Called by the agent thread only.  sig and point are cut to fit.
+    static void Publish(const char *sig, const char *point, int32_t lineno,
+        float speedup,
+        int64_t duration_ns, int64_t points_hit, int64_t sample_period_ns,
+        int64_t gc_pause_ns, bool gc_dominated);
+
+  private:
+    static struct RingHeader *header_;
+
+    static struct RingRecord *records_;
+
+    static size_t length_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(ResultRing);
+};
+
+#endif  // RING_H
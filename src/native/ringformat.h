@@ -0,0 +1,101 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#ifndef RINGFORMAT_H
+#define RINGFORMAT_H
+
+// Layout of the result ring file (ring=<path>), shared by the agent and
+// readers such as jcoz-tail.  Everything is in the byte order of the
+// host; the file is only meant to be read on the machine that wrote it.
+//
+// The file is a RingHeader followed by capacity RingRecords.  The agent
+// publishes experiment n (counting from 0, across profiling sessions)
+// into record n % capacity:
+//   1. record.seq = 0, marking it as being written,
+//   2. the other fields,
+//   3. record.seq = n + 1 (release),
+//   4. header.published = n + 1 (release).
+// A reader that wants record n reads seq (acquire), copies the record,
+// and reads seq again.  The copy is good if both reads gave n + 1.  If
+// they gave more, the writer has lapped the reader, which lost every
+// record up to published - capacity.
+//
+// There is one writer, the agent thread, and any number of readers.
+// Readers never write to the file.
+
+// "JCOZRING" read as a little-endian integer.
+static const uint64_t kRingMagic = 0x474e49525a4f434aULL;
+static const uint32_t kRingVersion = 2;
+
+// Longest class signature kept, including the terminating NUL.  Longer
+// ones are cut short.
+static const int kRingClassSigLength = 192;
+
+// Likewise for the progress point's name.
+static const int kRingPointLength = 256;
+
+// RingRecord.flags: GC pauses took more than kGcDominatedShare of the
+// experiment, so the estimates leave it out.
+static const uint32_t kRingGcDominated = 1;
+
+struct RingHeader {
+  uint64_t magic;
+  uint32_t version;
+  // sizeof(RingRecord), so that readers can check they agree.
+  uint32_t record_size;
+  // Records in the ring, a power of two.
+  uint64_t capacity;
+  // Experiments published since the file was created.
+  std::atomic<uint64_t> published;
+  // Process that writes the ring.
+  uint32_t pid;
+  uint32_t reserved;
+  // Wall-clock time the file was created, in ns since the epoch.
+  uint64_t created_ns;
+  uint64_t padding[2];
+};
+
+// The fields of appendToProfile's coz record, plus when the experiment
+// ended.
+struct RingRecord {
+  std::atomic<uint64_t> seq;
+  // Wall-clock time the experiment ended, in ns since the epoch.
+  uint64_t end_ns;
+  // Duration less the delays inserted, in ns.
+  int64_t duration_ns;
+  int64_t points_hit;
+  int64_t sample_period_ns;
+  int64_t gc_pause_ns;
+  float speedup;
+  int32_t lineno;
+  uint32_t flags;
+  uint32_t reserved;
+  char class_sig[kRingClassSigLength];
+  // The progress point as Profiler::appendToProfile names it, class:line
+  // or end-to-end.  Kept per record as it can change between sessions.
+  char progress_point[kRingPointLength];
+};
+
+static_assert(sizeof(RingHeader) == 64, "RingHeader layout changed");
+static_assert(sizeof(RingRecord) == 512, "RingRecord layout changed");
+
+#endif  // RINGFORMAT_H
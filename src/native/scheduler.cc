@@ -0,0 +1,191 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "scheduler.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <functional>
+
+std::unordered_map<ExperimentScheduler::LineKey, ExperimentScheduler::LineResults,
+  ExperimentScheduler::LineKeyHash> ExperimentScheduler::lines_;
+
+// Width, in standard errors, of the intervals lines are compared by.
+static const double kConfidenceZ = 2.0;
+
+// How many of the most important lines the scheduler tries to pin down.
+static const size_t kTopLines = 5;
+
+void ExperimentScheduler::Reset() {
+  lines_.clear();
+}
+
+void ExperimentScheduler::Record(jmethodID method_id, jint lineno,
+    float speedup, long points_hit, long duration_ns) {
+  if (duration_ns <= 0) {
+    return;
+  }
+  int level = (int) lround(speedup * kSpeedupLevels);
+  LineKey key = {method_id, lineno};
+  LineResults &results = lines_[key];
+  level = std::max(0, std::min(level, (int) kSpeedupLevels));
+  results.hits[level] += points_hit;
+  results.nanos[level] += duration_ns;
+}
+
+bool ExperimentScheduler::EstimateLine(const LineResults &results,
+    double *impact, double *std_error) {
+  long baseline_hits = results.hits[0];
+  if (baseline_hits < kMinLineBaselineHits) {
+    return false;
+  }
+  double baseline_rate = baseline_hits / results.nanos[0];
+  double weighted_sy = 0;
+  double weighted_ss = 0;
+  for (int level = 1; level <= kSpeedupLevels; level++) {
+    if (results.nanos[level] <= 0) {
+      continue;
+    }
+    // A level without hits still says the rate is low; count it as
+    // half a hit so it has a finite variance.
+    double hits = std::max((double) results.hits[level], 0.5);
+    // Time per point at this level over time per point at the baseline.
+    double ratio = baseline_rate / (hits / results.nanos[level]);
+    double variance = ratio * ratio * (1 / hits + 1.0 / baseline_hits);
+    double s = (double) level / kSpeedupLevels;
+    weighted_sy += s * (1 - ratio) / variance;
+    weighted_ss += s * s / variance;
+  }
+  if (weighted_ss <= 0) {
+    return false;
+  }
+  *impact = weighted_sy / weighted_ss;
+  *std_error = sqrt(1 / weighted_ss);
+  return true;
+}
+
+bool ExperimentScheduler::NeedsBaseline(const LineResults &results) {
+  long levels = 0;
+  long level_hits = 0;
+  for (int level = 1; level <= kSpeedupLevels; level++) {
+    if (results.nanos[level] > 0) {
+      levels++;
+      level_hits += results.hits[level];
+    }
+  }
+  return results.hits[0] < kMinLineBaselineHits
+    || (levels > 0
+        && results.hits[0] < sqrt((double) levels) * level_hits / levels);
+}
+
+bool ExperimentScheduler::Estimate(jmethodID method_id, jint lineno,
+    double *impact, double *std_error) {
+  LineKey key = {method_id, lineno};
+  auto results = lines_.find(key);
+  return results != lines_.end()
+    && EstimateLine(results->second, impact, std_error);
+}
+
+ExperimentScheduler::Choice ExperimentScheduler::Choose(
+    const std::vector<Candidate> &candidates) {
+  Choice choice = {-1, 0};
+  if (candidates.empty()) {
+    return choice;
+  }
+
+  // Fold the samples into lines, keeping the first index of each and
+  // how often it was sampled.
+  std::unordered_map<LineKey, std::pair<int, int>, LineKeyHash> sampled;
+  for (int i = 0; i < (int) candidates.size(); i++) {
+    LineKey key = {candidates[i].method_id, candidates[i].lineno};
+    auto entry = sampled.emplace(key, std::make_pair(i, 0)).first;
+    entry->second.second++;
+  }
+
+  const LineResults *chosen = NULL;
+  int chosen_samples = 0;
+  double chosen_error = -1;
+  bool chosen_unexplored = false;
+  // A line is out of the running once its upper bound is below the
+  // lower bounds of kTopLines others.
+  std::vector<double> lower_bounds;
+  for (auto &line : sampled) {
+    double impact, std_error;
+    auto results = lines_.find(line.first);
+    if (results != lines_.end()
+        && EstimateLine(results->second, &impact, &std_error)) {
+      lower_bounds.push_back(impact - kConfidenceZ * std_error);
+    }
+  }
+  double best_lower = -HUGE_VAL;
+  if (lower_bounds.size() >= kTopLines) {
+    std::nth_element(lower_bounds.begin(), lower_bounds.begin() + kTopLines - 1,
+        lower_bounds.end(), std::greater<double>());
+    best_lower = lower_bounds[kTopLines - 1];
+  }
+  for (auto &line : sampled) {
+    double impact, std_error;
+    auto results = lines_.find(line.first);
+    bool explored = results != lines_.end()
+      && EstimateLine(results->second, &impact, &std_error);
+    int samples = line.second.second;
+    bool better;
+    if (!explored) {
+      // The most sampled unexplored line first.
+      better = !chosen_unexplored || samples > chosen_samples;
+      chosen_unexplored = true;
+    } else if (chosen_unexplored
+        || impact + kConfidenceZ * std_error < best_lower) {
+      // Ruled out, or an unexplored line is waiting.
+      continue;
+    } else {
+      better = std_error > chosen_error
+        || (std_error == chosen_error && samples > chosen_samples);
+    }
+    if (better) {
+      choice.candidate = line.second.first;
+      chosen = results != lines_.end() ? &results->second : NULL;
+      chosen_samples = samples;
+      chosen_error = explored ? std_error : HUGE_VAL;
+    }
+  }
+
+  if (chosen == NULL || NeedsBaseline(*chosen)) {
+    choice.speedup = 0;
+    return choice;
+  }
+
+  // The level with the fewest hits, so the curve fills in evenly; ties
+  // go to a random one of them.
+  int level = 1;
+  int ties = 0;
+  for (int l = 1; l <= kSpeedupLevels; l++) {
+    long hits = chosen->hits[l];
+    long best = chosen->hits[level];
+    if (hits < best) {
+      level = l;
+      ties = 1;
+    } else if (hits == best && rand() % ++ties == 0) {
+      level = l;
+    }
+  }
+  choice.speedup = (float) level / kSpeedupLevels;
+  return choice;
+}
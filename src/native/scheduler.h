@@ -0,0 +1,122 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <jvmti.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "globals.h"
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Chooses the line and speedup of each experiment from the results so
+// far.  Only the agent thread uses it.
+//
+// A line's impact is estimated as jcoz-analyze and the Java client do:
+// the slope, through the origin, of program speedup against line
+// speedup, where program speedup at line speedup s is one less the time
+// per progress point at s over the time per point at the line's own 0%
+// experiments.  Here each speedup level is weighted by its Poisson
+// variance, so every line with results has an estimate and a standard
+// error.  A line has no estimate until its baseline has
+// kMinLineBaselineHits.
+//
+// Among the candidate lines, drawn from the decayed sample counts,
+// lines without an estimate come first.  After that, experiments go to
+// the widest interval among the lines that may still be among the few
+// most important: those whose upper bound is not below the lower bounds
+// of that many other lines.  The speedup is the level the line has the
+// fewest progress points at.  A line's baseline is compared with each
+// of its speedup levels, so it is given sqrt(levels) times the hits of
+// an average level, and never fewer than kMinLineBaselineHits.
+class ExperimentScheduler {
+  public:
+    // A line drawn from the samples; a hot line may be drawn several
+    // times.
+    struct Candidate {
+      jmethodID method_id;
+      jint lineno;
+    };
+
+    struct Choice {
+      // Index into the candidates, or -1 if there were none.
+      int candidate;
+      float speedup;
+    };
+
+    // Speedups are multiples of 1 / kSpeedupLevels.
+    static const int kSpeedupLevels = 20;
+
+    // The baseline hits a line needs before the Java client and
+    // jcoz-analyze will report it; both want more than 5.
+    static const long kMinLineBaselineHits = 6;
+
+    // Forgets every result.
+    static void Reset();
+
+    static Choice Choose(const std::vector<Candidate> &candidates);
+
+    // Adds the outcome of an experiment; duration_ns excludes delays.
+    static void Record(jmethodID method_id, jint lineno, float speedup,
+        long points_hit, long duration_ns);
+
+    // The impact of a line and its standard error.  Returns false if the
+    // line has no results at a nonzero speedup, or too small a baseline
+    // of its own.
+    static bool Estimate(jmethodID method_id, jint lineno, double *impact,
+        double *std_error);
+
+  private:
+    struct LineKey {
+      jmethodID method_id;
+      jint lineno;
+
+      bool operator==(const LineKey &other) const {
+        return method_id == other.method_id && lineno == other.lineno;
+      }
+    };
+
+    struct LineKeyHash {
+      size_t operator()(const LineKey &key) const {
+        return std::hash<void *>()((void *) key.method_id) * 31 + key.lineno;
+      }
+    };
+
+    // Progress points and delay-free nanoseconds at each speedup level;
+    // level 0 is the line's own baseline.
+    struct LineResults {
+      long hits[kSpeedupLevels + 1] = {};
+      double nanos[kSpeedupLevels + 1] = {};
+    };
+
+    static bool EstimateLine(const LineResults &results, double *impact,
+        double *std_error);
+
+    // Whether the line's next experiment should be a baseline run.
+    static bool NeedsBaseline(const LineResults &results);
+
+    static std::unordered_map<LineKey, LineResults, LineKeyHash> lines_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(ExperimentScheduler);
+};
+
+#endif  // SCHEDULER_H
@@ -0,0 +1,213 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * This file has been modified from lightweight-java-profiler
+ * (https://github.com/dcapwell/lightweight-java-profiler). See APACHE_LICENSE for
+ * a copy of the license that was included with that original work.
+ */
+
+#include "stacktraces.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+// Count of a slot whose frames are still being copied in.
+static const intptr_t kTraceSlotFilling = -1;
+
+// Slots a handler looks at before giving up on a trace or frame.  Bounds the
+// work per sample once the table fills up, at the price of dropping the
+// odd trace a little before it is completely full.
+static const int kMaxTraceProbes = 16;
+
+static uint64_t CalculateHash(const JVMPI_CallFrame *frames, int num_frames) {
+  // FNV-1a, one step per frame.  jmethodIDs are pointers whose high
+  // half hardly varies, so the bci goes there.
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < num_frames; i++) {
+    uint64_t frame = (uint64_t) (uintptr_t) frames[i].method_id
+      ^ ((uint64_t) (uint32_t) frames[i].lineno << 32);
+    hash = (hash ^ frame) * 1099511628211ULL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+static bool Equal(const JVMPI_CallFrame *frames, int num_frames,
+    const JVMPI_CallTrace &trace) {
+  if (trace.num_frames != num_frames) {
+    return false;
+  }
+  for (int i = 0; i < num_frames; i++) {
+    if (frames[i].method_id != trace.frames[i].method_id
+        || frames[i].lineno != trace.frames[i].lineno) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AsyncSafeTraceMultiset::Add(const JVMPI_CallTrace &trace) {
+  int num_frames = trace.num_frames;
+  if (num_frames <= 0) {
+    return false;
+  }
+  if (num_frames > kMaxFramesToCapture) {
+    num_frames = kMaxFramesToCapture;
+  }
+
+  uint64_t hash = CalculateHash(trace.frames, num_frames);
+  for (int probe = 0; probe < kMaxTraceProbes; probe++) {
+    int idx = (int) ((hash + probe) % kMaxStackTraces);
+    TraceData *data = &traces_[idx];
+    intptr_t count = data->count;
+
+    if (count == 0) {
+      if (NoBarrier_CompareAndSwap(&data->count, 0, kTraceSlotFilling) == 0) {
+        memcpy(frame_buffer_[idx], trace.frames,
+            sizeof(JVMPI_CallFrame) * num_frames);
+        hashes_[idx] = hash;
+        data->trace.env_id = trace.env_id;
+        data->trace.num_frames = num_frames;
+        data->trace.frames = frame_buffer_[idx];
+        __sync_synchronize();
+        data->count = 1;
+        return true;
+      }
+      count = data->count;
+    }
+
+    // A slot that is still being filled may hold this very trace; rather
+    // than wait on another thread, carry on probing.  The printer merges
+    // the duplicates this can leave behind.
+    if (count > 0 && hashes_[idx] == hash
+        && Equal(trace.frames, num_frames, data->trace)) {
+      NoBarrier_AtomicIncrement(&data->count, 1);
+      return true;
+    }
+  }
+
+  NoBarrier_AtomicIncrement(&dropped_, 1);
+  return false;
+}
+
+void AsyncSafeTraceMultiset::Clear() {
+  memset(traces_, 0, sizeof(traces_));
+  memset(hashes_, 0, sizeof(hashes_));
+  dropped_ = 0;
+}
+
+// Count of a FrameCounts slot whose frame is still being written.  Far
+// enough below 0 that a handler which matched the slot before it was
+// drained and refilled cannot increment it back into view.
+static const intptr_t kFrameSlotFilling = INTPTR_MIN / 2;
+
+const double LineHistogram::kEvictSamples = 1.0 / 16;
+
+bool FrameCounts::Add(const JVMPI_CallFrame &frame) {
+  uint64_t hash = CalculateHash(&frame, 1);
+  for (int probe = 0; probe < kMaxTraceProbes; probe++) {
+    int idx = (int) ((hash + probe) % kSlots);
+    intptr_t count = counts_[idx];
+
+    if (count == 0) {
+      if (NoBarrier_CompareAndSwap(&counts_[idx], 0, kFrameSlotFilling) == 0) {
+        frames_[idx] = frame;
+        __sync_synchronize();
+        counts_[idx] = 1;
+        return true;
+      }
+      count = counts_[idx];
+    }
+
+    if (count > 0 && frames_[idx].method_id == frame.method_id
+        && frames_[idx].lineno == frame.lineno) {
+      NoBarrier_AtomicIncrement(&counts_[idx], 1);
+      return true;
+    }
+  }
+
+  NoBarrier_AtomicIncrement(&dropped_, 1);
+  return false;
+}
+
+void FrameCounts::Clear() {
+  memset(frames_, 0, sizeof(frames_));
+  memset((void *) counts_, 0, sizeof(counts_));
+  dropped_ = 0;
+}
+
+void FrameCounts::Drain(std::vector<std::pair<JVMPI_CallFrame, long> > *out) {
+  for (int i = 0; i < kSlots; i++) {
+    intptr_t count = counts_[i];
+    // A slot with a count is not refilled until we empty it, so its
+    // frame holds still; handlers may still add, so retry until the
+    // count we take is the one we replace.
+    while (count > 0) {
+      __sync_synchronize();
+      JVMPI_CallFrame frame = frames_[i];
+      intptr_t seen = NoBarrier_CompareAndSwap(&counts_[i], count, 0);
+      if (seen == count) {
+        out->push_back(std::make_pair(frame, (long) count));
+        break;
+      }
+      count = seen;
+    }
+  }
+}
+
+void LineHistogram::Add(const SampledLine &line, double samples) {
+  counts_[line] += samples;
+}
+
+void LineHistogram::Decay(double factor) {
+  for (auto it = counts_.begin(); it != counts_.end();) {
+    it->second *= factor;
+    if (it->second < kEvictSamples) {
+      it = counts_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void LineHistogram::Draw(int num_draws, double floor,
+    std::vector<SampledLine> *out) const {
+  if (counts_.empty()) {
+    return;
+  }
+  std::vector<SampledLine> lines;
+  std::vector<double> cumulative;
+  double total = 0;
+  for (auto &line : counts_) {
+    lines.push_back(line.first);
+    cumulative.push_back(line.second);
+    total += line.second;
+  }
+
+  double uniform = floor / lines.size();
+  double sum = 0;
+  for (size_t i = 0; i < cumulative.size(); i++) {
+    sum += (1 - floor) * cumulative[i] / total + uniform;
+    cumulative[i] = sum;
+  }
+  for (int d = 0; d < num_draws; d++) {
+    double u = sum * rand() / ((double) RAND_MAX + 1);
+    size_t i = std::upper_bound(cumulative.begin(), cumulative.end(), u)
+      - cumulative.begin();
+    out->push_back(lines[std::min(i, lines.size() - 1)]);
+  }
+}
@@ -19,6 +19,14 @@
  * a copy of the license that was included with that original work.
  */
 
+#include <stdio.h>
+#include <string.h>
+
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "globals.h"
 
 #ifndef STACKTRACES_H
@@ -76,6 +84,135 @@ enum CallTraceErrors {
   kSafepoint               = -10,
 };
 
+struct TraceData {
+  intptr_t count;
+  JVMPI_CallTrace trace;
+};
+
+// A fixed-size multiset of stack traces that signal handlers can add to
+// without locks.  Each trace is counted in its own slot; a slot's count
+// is 0 while it is empty and kTraceSlotFilling while a handler is
+// copying frames into it.  A trace with no room in the few slots after
+// its hash is dropped, so once the table fills up new traces are
+// dropped at a fixed cost, while traces already present keep counting.
+class AsyncSafeTraceMultiset {
+  public:
+    AsyncSafeTraceMultiset() { Clear(); }
+
+    // Counts one occurrence of trace, keeping at most
+    // kMaxFramesToCapture frames from the callee end.  Returns false if
+    // there was no slot for it.  Async-signal-safe.
+    bool Add(const JVMPI_CallTrace &trace);
+
+    // Empties the table.  No handler may be adding at the same time.
+    void Clear();
+
+    int MaxEntries() const { return kMaxStackTraces; }
+
+    // Slots with a count of 0 (or less) are unused.
+    TraceData *GetTraces() { return traces_; }
+
+    // Samples dropped because the table had no room near their slot.
+    intptr_t Dropped() const { return dropped_; }
+
+  private:
+    TraceData traces_[kMaxStackTraces];
+
+    uint64_t hashes_[kMaxStackTraces];
+
+    JVMPI_CallFrame frame_buffer_[kMaxStackTraces][kMaxFramesToCapture];
+
+    volatile intptr_t dropped_;
+
+    DISALLOW_COPY_AND_ASSIGN(AsyncSafeTraceMultiset);
+};
+
+// Samples per frame (method and bci) since the agent thread last
+// drained them.  Signal handlers add without locks; only the agent
+// thread drains, and draining empties every slot it takes a count from,
+// so the table only has to hold the frames of one round.
+class FrameCounts {
+  public:
+    FrameCounts() { Clear(); }
+
+    // Counts one sample of frame.  Returns false if there was no slot
+    // for it.  Async-signal-safe.
+    bool Add(const JVMPI_CallFrame &frame);
+
+    // Empties the table.  No handler may be adding at the same time.
+    void Clear();
+
+    // Moves every count into *out and empties the table.  A frame may
+    // come out more than once.  Handlers may add meanwhile.
+    void Drain(std::vector<std::pair<JVMPI_CallFrame, long> > *out);
+
+    // Samples dropped because the table had no room near their slot.
+    intptr_t Dropped() const { return dropped_; }
+
+  private:
+    static const int kSlots = 8192;
+
+    JVMPI_CallFrame frames_[kSlots];
+
+    // 0 while a slot is empty, negative while its frame is being
+    // written.
+    volatile intptr_t counts_[kSlots];
+
+    volatile intptr_t dropped_;
+
+    DISALLOW_COPY_AND_ASSIGN(FrameCounts);
+};
+
+// A source line of a method.
+struct SampledLine {
+  jmethodID method_id;
+  jint lineno;
+
+  bool operator==(const SampledLine &other) const {
+    return method_id == other.method_id && lineno == other.lineno;
+  }
+};
+
+struct SampledLineHash {
+  size_t operator()(const SampledLine &line) const {
+    return std::hash<void *>()((void *) line.method_id) * 31 + line.lineno;
+  }
+};
+
+// Sample counts per line that fade with age, from which experiment
+// lines are drawn.  Only the agent thread uses it.  Lines whose count
+// decays below kEvictSamples are forgotten, so a long run keeps only the
+// lines that have been sampled lately.
+class LineHistogram {
+  public:
+    LineHistogram() {}
+
+    void Add(const SampledLine &line, double samples);
+
+    void Clear() { counts_.clear(); }
+
+    // Scales every count by factor, between 0 and 1, and forgets the
+    // lines that fall below kEvictSamples.
+    void Decay(double factor);
+
+    // Appends num_draws lines, drawn with replacement.  Each draw takes
+    // a line with probability (1 - floor) times its share of the counts
+    // plus floor over the number of lines, so lines that have gone cold
+    // are still drawn now and then.  Appends nothing to an empty table.
+    void Draw(int num_draws, double floor, std::vector<SampledLine> *out) const;
+
+    // Lines in the table.
+    int Size() const { return (int) counts_.size(); }
+
+  private:
+    // About four half-lives after a line's last sample.
+    static const double kEvictSamples;
+
+    std::unordered_map<SampledLine, double, SampledLineHash> counts_;
+
+    DISALLOW_COPY_AND_ASSIGN(LineHistogram);
+};
+
 class Asgct {
   public:
     static void SetAsgct(ASGCTType asgct) {
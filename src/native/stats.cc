@@ -0,0 +1,79 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+
+#include "userthreads.h"
+
+struct ThreadStats ProfilerStats::agent_;
+struct ThreadStats ProfilerStats::shared_;
+struct ThreadStats ProfilerStats::retired_;
+
+static void MoveCounter(StatCounter *from, StatCounter *to) {
+  to->Add(from->value.exchange(0, std::memory_order_relaxed));
+}
+
+static void MoveHistogram(StatHistogram *from, StatHistogram *to) {
+  for (int i = 0; i < kHistogramBuckets; i++) {
+    MoveCounter(&from->buckets[i], &to->buckets[i]);
+  }
+  MoveCounter(&from->count, &to->count);
+  MoveCounter(&from->total, &to->total);
+}
+
+void ProfilerStats::Retire(struct ThreadStats *stats) {
+  MoveCounter(&stats->samples, &retired_.samples);
+  MoveCounter(&stats->samples_dropped, &retired_.samples_dropped);
+  MoveCounter(&stats->spin_wait_ns, &retired_.spin_wait_ns);
+  for (int i = 0; i < kCallTraceSlots; i++) {
+    MoveCounter(&stats->call_trace_results[i], &retired_.call_trace_results[i]);
+  }
+  MoveHistogram(&stats->handler_latency, &retired_.handler_latency);
+  MoveHistogram(&stats->delay_overshoot, &retired_.delay_overshoot);
+  MoveHistogram(&stats->agent_cycle, &retired_.agent_cycle);
+}
+
+static void AddHistogram(const StatHistogram &histogram, uint64_t *out) {
+  for (int i = 0; i < kHistogramBuckets; i++) {
+    out[i] += histogram.buckets[i].Get();
+  }
+  out[kHistogramBuckets] += histogram.count.Get();
+  out[kHistogramBuckets + 1] += histogram.total.Get();
+}
+
+static void AddStats(const struct ThreadStats &stats, uint64_t *out) {
+  out[kStatsSamples] += stats.samples.Get();
+  out[kStatsSamplesDropped] += stats.samples_dropped.Get();
+  out[kStatsSpinWaitNanos] += stats.spin_wait_ns.Get();
+  for (int i = 0; i < kCallTraceSlots; i++) {
+    out[kStatsCallTraceResults + i] += stats.call_trace_results[i].Get();
+  }
+  AddHistogram(stats.handler_latency, out + kStatsHandlerLatency);
+  AddHistogram(stats.delay_overshoot, out + kStatsDelayOvershoot);
+  AddHistogram(stats.agent_cycle, out + kStatsAgentCycle);
+}
+
+void ProfilerStats::Snapshot(uint64_t out[kStatsLength]) {
+  memset(out, 0, sizeof(uint64_t) * kStatsLength);
+  AddStats(agent_, out);
+  AddStats(shared_, out);
+  AddStats(retired_, out);
+  int high_water = UserThreadSlab::HighWater();
+  for (int i = 0; i < high_water; i++) {
+    AddStats(UserThreadSlab::Slot(i)->stats, out);
+  }
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "globals.h"
+#include "stacktraces.h"
+
+#ifndef STATS_H
+#define STATS_H
+
+// Bucket i of a histogram counts values in [2^i, 2^(i+1)) nanoseconds;
+// bucket 0 also takes zero.
+static const int kHistogramBuckets = 32;
+
+// AsyncGetCallTrace results: slot i counts a result of -i (see
+// CallTraceErrors), then one slot for codes we do not know and one for
+// successful walks.
+static const int kCallTraceUnknownSlot = kNumCallTraceErrors + 1;
+static const int kCallTraceOkSlot = kNumCallTraceErrors + 2;
+static const int kCallTraceSlots = kNumCallTraceErrors + 3;
+
+// Layout of the array returned by ProfilerStats::Snapshot, and so of
+// JCozProfiler.getOverheadStatsNative().  Keep the two in sync.
+static const int kStatsSamples = 0;
+static const int kStatsSamplesDropped = 1;
+static const int kStatsSpinWaitNanos = 2;
+static const int kStatsCallTraceResults = 3;
+static const int kStatsHandlerLatency = kStatsCallTraceResults + kCallTraceSlots;
+// Each histogram is its buckets followed by its count and its sum.
+static const int kStatsHistogramLength = kHistogramBuckets + 2;
+static const int kStatsDelayOvershoot = kStatsHandlerLatency + kStatsHistogramLength;
+static const int kStatsAgentCycle = kStatsDelayOvershoot + kStatsHistogramLength;
+static const int kStatsLength = kStatsAgentCycle + kStatsHistogramLength;
+
+// A counter that is safe to bump from a signal handler.
+struct StatCounter {
+  std::atomic<uint64_t> value;
+
+  void Add(uint64_t delta) {
+    value.fetch_add(delta, std::memory_order_relaxed);
+  }
+
+  uint64_t Get() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+struct StatHistogram {
+  StatCounter buckets[kHistogramBuckets];
+  StatCounter count;
+  StatCounter total;
+
+  void Record(uint64_t nanos) {
+    int bucket = nanos == 0 ? 0 : 63 - __builtin_clzll(nanos);
+    if (bucket >= kHistogramBuckets) {
+      bucket = kHistogramBuckets - 1;
+    }
+    buckets[bucket].Add(1);
+    count.Add(1);
+    total.Add(nanos);
+  }
+};
+
+// Assumed size of a cache line, for keeping per-thread data apart.
+static const int kCacheLineSize = 64;
+
+// Self-overhead counters.  Each application thread keeps its own block
+// in its UserThread slot so the signal handler never shares a cache
+// line with another thread; the agent thread has its own block too.
+// The alignment starts each block on a line of its own and pads it to
+// whole lines, and also lines up the UserThread slots that hold them.
+struct alignas(kCacheLineSize) ThreadStats {
+  StatCounter samples;
+  StatCounter samples_dropped;
+  StatCounter spin_wait_ns;
+  StatCounter call_trace_results[kCallTraceSlots];
+  StatHistogram handler_latency;
+  StatHistogram delay_overshoot;
+  StatHistogram agent_cycle;
+};
+
+class ProfilerStats {
+  public:
+    // Monotonic clock in nanoseconds; async-signal-safe.
+    static uint64_t Now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static void RecordCallTrace(struct ThreadStats *stats, jint num_frames) {
+      int slot;
+      if (num_frames > 0) {
+        slot = kCallTraceOkSlot;
+      } else if (-num_frames <= kNumCallTraceErrors) {
+        slot = -num_frames;
+      } else {
+        slot = kCallTraceUnknownSlot;
+      }
+      stats->call_trace_results[slot].Add(1);
+    }
+
+    // Stats for the agent thread.
+    static struct ThreadStats *Agent() { return &agent_; }
+
+    // Stats for threads that have no block of their own.
+    static struct ThreadStats *Shared() { return &shared_; }
+
+    // Folds a block into the totals kept for threads that have exited,
+    // and zeroes it so its slot can be reused.
+    static void Retire(struct ThreadStats *stats);
+
+    // Sums every block into out, laid out as described by kStats*.
+    // Counters are read without stopping writers, so a snapshot taken
+    // while threads come and go may be off by the samples in flight.
+    static void Snapshot(uint64_t out[kStatsLength]);
+
+  private:
+    static struct ThreadStats agent_;
+
+    static struct ThreadStats shared_;
+
+    static struct ThreadStats retired_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(ProfilerStats);
+};
+
+#endif  // STATS_H
@@ -0,0 +1,227 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "timeline.h"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+#include "display.h"
+#include "options.h"
+#include "stats.h"
+
+TimelineBuffer *Timeline::agent_ = NULL;
+TimelineBuffer *Timeline::shared_ = NULL;
+
+// The agent and shared buffers take events from many sources, so they
+// get this many times a thread's capacity.
+static const int kSharedCapacityFactor = 4;
+
+TimelineBuffer::TimelineBuffer(int capacity)
+  : events_(new TimelineEvent[capacity]), capacity_(capacity), next_(0),
+    dropped_(0) {
+  Clear();
+}
+
+TimelineBuffer::~TimelineBuffer() {
+  delete[] events_;
+}
+
+void TimelineBuffer::Record(uint64_t time_ns, int type, pid_t tid,
+    jmethodID method, jint line, int64_t value) {
+  // A signal may land while this thread is recording, so the slot is
+  // claimed atomically even though the buffer has a single owner.
+  int i = next_.fetch_add(1, std::memory_order_relaxed);
+  if (i >= capacity_) {
+    next_.store(capacity_, std::memory_order_relaxed);
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  TimelineEvent *event = &events_[i];
+  event->time_ns = time_ns;
+  event->value = value;
+  event->method = method;
+  event->line = line;
+  event->tid = tid;
+  event->type.store(type, std::memory_order_release);
+}
+
+void TimelineBuffer::Record(int type, pid_t tid, jmethodID method,
+    jint line, int64_t value) {
+  Record(ProfilerStats::Now(), type, tid, method, line, value);
+}
+
+void TimelineBuffer::Clear() {
+  for (int i = 0; i < capacity_; i++) {
+    events_[i].type.store(kTimelineNone, std::memory_order_relaxed);
+  }
+  next_.store(0, std::memory_order_release);
+  dropped_.store(0, std::memory_order_relaxed);
+}
+
+int TimelineBuffer::Size() const {
+  return std::min(next_.load(std::memory_order_acquire), capacity_);
+}
+
+void Timeline::Init() {
+  if (AgentOptions::timeline_file.empty() || agent_ != NULL) {
+    return;
+  }
+  agent_ = new TimelineBuffer(AgentOptions::timeline_events * kSharedCapacityFactor);
+  shared_ = new TimelineBuffer(AgentOptions::timeline_events * kSharedCapacityFactor);
+}
+
+TimelineBuffer *Timeline::NewThreadBuffer() {
+  if (AgentOptions::timeline_file.empty()) {
+    return NULL;
+  }
+  return new TimelineBuffer(AgentOptions::timeline_events);
+}
+
+void Timeline::RecordShared(TimelineBuffer *buffer, int type,
+    jmethodID method, jint line, int64_t value) {
+  if (buffer != NULL) {
+    buffer->Record(type, (pid_t) syscall(SYS_gettid), method, line, value);
+  }
+}
+
+// Class and method names only hold characters that need no escaping
+// except for these.
+static std::string JsonString(const std::string &s) {
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') {
+      out += '\\';
+    }
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+static std::string MethodName(StackTracesPrinter *printer, jmethodID method) {
+  if (method == NULL) {
+    return "unknown";
+  }
+  const MethodSymbols &symbols = printer->Symbols(method);
+  if (!symbols.resolved) {
+    return "unknown";
+  }
+  return symbols.qualified_name;
+}
+
+bool Timeline::Write(const char *path, jvmtiEnv *jvmti,
+    const std::vector<const TimelineBuffer *> &buffers) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+
+  uint64_t origin = UINT64_MAX;
+  for (size_t b = 0; b < buffers.size(); b++) {
+    for (int i = 0; i < buffers[b]->Size(); i++) {
+      origin = std::min(origin, buffers[b]->Get(i).time_ns);
+    }
+  }
+
+  StackTracesPrinter printer(file, jvmti);
+  pid_t pid = getpid();
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+      "\"args\":{\"name\":\"JCoz\"}}", (int) pid);
+  std::unordered_map<pid_t, bool> named;
+  for (size_t b = 0; b < buffers.size(); b++) {
+    const TimelineBuffer *buffer = buffers[b];
+    for (int i = 0; i < buffer->Size(); i++) {
+      const TimelineEvent &event = buffer->Get(i);
+      int type = event.type.load(std::memory_order_acquire);
+      if (type == kTimelineNone) {
+        continue;
+      }
+      if (buffer == agent_ && !named[event.tid]) {
+        named[event.tid] = true;
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"tid\":%d,\"args\":{\"name\":\"JCoz agent\"}}", (int) pid,
+            (int) event.tid);
+      }
+
+      double ts = (event.time_ns - origin) / 1000.0;
+      std::string name;
+      const char *ph = "i";
+      std::string args;
+      switch (type) {
+        case kTimelineExperimentStart:
+        case kTimelineExperimentEnd:
+          name = MethodName(&printer, event.method) + ":"
+            + std::to_string(event.line) + " +"
+            + std::to_string(event.value) + "%";
+          ph = type == kTimelineExperimentStart ? "B" : "E";
+          args = "\"speedup\":" + std::to_string(event.value);
+          break;
+        case kTimelineDelay:
+          name = "delay";
+          ph = "X";
+          args = "\"ns\":" + std::to_string(event.value);
+          break;
+        case kTimelineProgress:
+          name = "progress";
+          break;
+        case kTimelineGcStart:
+        case kTimelineGcFinish:
+          name = "GC";
+          ph = type == kTimelineGcStart ? "B" : "E";
+          break;
+        case kTimelineCompile:
+          name = "compile " + MethodName(&printer, event.method);
+          break;
+        case kTimelineUnload:
+          name = "unload " + MethodName(&printer, event.method);
+          break;
+        case kTimelineThreadStart:
+          name = "thread start";
+          break;
+        case kTimelineThreadEnd:
+          name = "thread end";
+          break;
+        case kTimelineMount:
+        case kTimelineUnmount:
+          name = "virtual thread " + std::to_string(event.value);
+          ph = type == kTimelineMount ? "B" : "E";
+          break;
+        default:
+          continue;
+      }
+      fprintf(file, ",\n{\"name\":%s,\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+          JsonString(name).c_str(), ph, ts, (int) pid, (int) event.tid);
+      if (ph[0] == 'X') {
+        fprintf(file, ",\"dur\":%.3f", event.value / 1000.0);
+      } else if (ph[0] == 'i') {
+        fprintf(file, ",\"s\":\"t\"");
+      }
+      if (!args.empty()) {
+        fprintf(file, ",\"args\":{%s}", args.c_str());
+      }
+      fprintf(file, "}");
+    }
+  }
+  fprintf(file, "\n]}\n");
+  bool ok = ferror(file) == 0;
+  return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,136 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jvmti.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <vector>
+
+#include "globals.h"
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+enum TimelineEventType {
+  // An event that is still being written.
+  kTimelineNone = 0,
+  kTimelineExperimentStart,
+  kTimelineExperimentEnd,
+  // A thread slept off its delay debt.
+  kTimelineDelay,
+  kTimelineProgress,
+  kTimelineGcStart,
+  kTimelineGcFinish,
+  kTimelineCompile,
+  kTimelineUnload,
+  kTimelineThreadStart,
+  kTimelineThreadEnd,
+  // A virtual thread mounted on or unmounted from this carrier.
+  kTimelineMount,
+  kTimelineUnmount,
+};
+
+struct TimelineEvent {
+  uint64_t time_ns;
+  // Nanoseconds slept for a delay, speedup in percent for an experiment,
+  // the virtual thread's id for a mount.
+  int64_t value;
+  // The experiment's method, or the method compiled or unloaded.
+  jmethodID method;
+  jint line;
+  pid_t tid;
+  std::atomic<int32_t> type;
+};
+
+// A fixed-size log of events.  Each profiled thread writes to its own,
+// which is kept in its UserThread slot; the agent thread has one, and
+// VM and compiler threads share one.  Once full, new events are dropped.
+class TimelineBuffer {
+  public:
+    explicit TimelineBuffer(int capacity);
+
+    ~TimelineBuffer();
+
+    // Async-signal-safe, and safe against other writers.
+    void Record(uint64_t time_ns, int type, pid_t tid, jmethodID method,
+        jint line, int64_t value);
+
+    void Record(int type, pid_t tid, jmethodID method, jint line,
+        int64_t value);
+
+    // Forgets every event.  No one may be recording at the same time.
+    void Clear();
+
+    // Events recorded so far; those still of type kTimelineNone are
+    // being written and should be skipped.
+    int Size() const;
+
+    const TimelineEvent &Get(int i) const { return events_[i]; }
+
+    long Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    TimelineEvent *events_;
+
+    int capacity_;
+
+    std::atomic<int> next_;
+
+    std::atomic<long> dropped_;
+
+    DISALLOW_COPY_AND_ASSIGN(TimelineBuffer);
+};
+
+// The optional event log behind AgentOptions::timeline_file, written as
+// Chrome trace JSON (chrome://tracing, ui.perfetto.dev) when profiling
+// stops.  Every buffer is NULL while the timeline is off, so callers
+// only test for NULL.
+class Timeline {
+  public:
+    // Creates the agent and shared buffers if the timeline is on.
+    static void Init();
+
+    // A new buffer for a profiled thread, or NULL if the timeline is off.
+    static TimelineBuffer *NewThreadBuffer();
+
+    static TimelineBuffer *Agent() { return agent_; }
+
+    // For threads without a buffer of their own: GC and JIT callbacks.
+    static TimelineBuffer *Shared() { return shared_; }
+
+    // Records into a buffer with no fixed thread, taking the caller's id.
+    static void RecordShared(TimelineBuffer *buffer, int type,
+        jmethodID method, jint line, int64_t value);
+
+    // Writes the events of every buffer to path, naming methods through
+    // jvmti.  Returns false if the file cannot be written.
+    static bool Write(const char *path, jvmtiEnv *jvmti,
+        const std::vector<const TimelineBuffer *> &buffers);
+
+  private:
+    static TimelineBuffer *agent_;
+
+    static TimelineBuffer *shared_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(Timeline);
+};
+
+#endif  // TIMELINE_H
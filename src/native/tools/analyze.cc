@@ -0,0 +1,701 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Offline analysis of .coz profiles.  Reads any number of profiles,
+// groups every experiment by line and speedup once, and fits each
+// line's speedup curve with bootstrap confidence intervals.  Lines are
+// bootstrapped in parallel, one line at a time per worker thread.
+//
+// The estimates are those of jcoz.profile.LineSpeedup: a line's
+// baseline is its own 0% experiments, and the program speedup at line
+// speedup s is one less the time per progress point at s over the time
+// per point at the baseline.  A line's impact is the least squares
+// slope, through the origin, of program speedup against line speedup.
+// As there, GC pauses are left out of durations and experiments
+// dominated by them are dropped, unless --keep-gc is given.
+//
+// Each bootstrap replicate resamples the experiments of every (line,
+// speedup) group with replacement.  Groups larger than
+// kExactResampleLimit are drawn from the normal approximation of their
+// resampled sums instead, so a replicate costs the same however many
+// experiments a group has.
+//
+// With --diff, the two profiles given are analyzed apart and lined up
+// by line, old first.  A line's impact changed if the bootstrap interval
+// of the difference leaves out 0 and the difference is at least
+// --min-change.  --fail-on-change then exits with status 3, so the diff
+// can gate a release.
+//
+// Usage: jcoz-analyze [--format=json|csv] [--bootstrap=<replicates>]
+//          [--confidence=<0..1>] [--threads=<n>] [--seed=<n>]
+//          [--min-baseline=<points>] [--keep-gc] <profile.coz>...
+//        jcoz-analyze --diff [--min-change=<impact>] [--fail-on-change]
+//          [options as above] <old.coz> <new.coz>
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Groups with more experiments than this are bootstrapped from the
+// normal approximation of their sums.
+static const size_t kExactResampleLimit = 256;
+
+// Share of an experiment's duration above which GC pauses dominate it;
+// Experiment.GC_DOMINATED_SHARE.
+static const double kGcDominatedShare = 0.5;
+
+struct Options {
+  bool csv = false;
+  int replicates = 1000;
+  double confidence = 0.95;
+  int threads = 0;
+  uint64_t seed = 1;
+  double min_baseline = 5;
+  bool keep_gc = false;
+  bool diff = false;
+  double min_change = 0.05;
+  bool fail_on_change = false;
+};
+
+static Options options;
+
+// One experiment: its delay-free duration and progress points.
+struct Sample {
+  double duration;
+  double hits;
+};
+
+// The experiments of one line at one speedup.
+struct Group {
+  std::vector<Sample> samples;
+  double sum_d = 0;
+  double sum_h = 0;
+  double sum_dd = 0;
+  double sum_hh = 0;
+  double sum_dh = 0;
+
+  void Add(const Sample &sample) {
+    samples.push_back(sample);
+    sum_d += sample.duration;
+    sum_h += sample.hits;
+    sum_dd += sample.duration * sample.duration;
+    sum_hh += sample.hits * sample.hits;
+    sum_dh += sample.duration * sample.hits;
+  }
+};
+
+// A point of a line's speedup curve.
+struct CurvePoint {
+  int percent;
+  size_t experiments;
+  double program_speedup;
+  double low;
+  double high;
+};
+
+struct Line {
+  std::string class_sig;
+  int lineno;
+  // By speedup in percent; 0 is the baseline.
+  std::map<int, Group> groups;
+  size_t experiments = 0;
+
+  bool analyzed = false;
+  std::vector<CurvePoint> curve;
+  double impact = 0;
+  double impact_low = 0;
+  double impact_high = 0;
+  // Bootstrap replicates of the impact, in the order drawn.
+  std::vector<double> impacts;
+};
+
+// Every line in one or more profiles read together.
+struct Profile {
+  std::unordered_map<std::string, Line> lines;
+  size_t experiments = 0;
+  size_t dropped_gc = 0;
+  // Lines sorted by class and line number.
+  std::vector<Line *> all;
+  // Analyzed lines, highest impact first.
+  std::vector<Line *> ranked;
+};
+
+// splitmix64, seeded per line so results do not depend on the number
+// of threads.
+class Random {
+  public:
+    explicit Random(uint64_t seed) : state_(seed) {}
+
+    uint64_t Next() {
+      uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, 1).
+    double Uniform() { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    size_t Below(size_t n) { return (size_t) (Uniform() * n); }
+
+    // Standard normal, by Box-Muller.
+    double Normal() {
+      double u = Uniform();
+      double v = Uniform();
+      return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+    }
+
+  private:
+    uint64_t state_;
+};
+
+// Time per progress point, or -1 if there were no points.
+static double Period(double duration, double hits) {
+  return hits > 0 ? duration / hits : -1;
+}
+
+static double ProgramSpeedup(double period, double baseline) {
+  return (baseline - period) / baseline;
+}
+
+// Least squares slope through the origin of program speedup against
+// line speedup, over the points with a value.
+static double Slope(const std::vector<int> &percents,
+    const std::vector<double> &speedups) {
+  double sxy = 0;
+  double sxx = 0;
+  for (size_t i = 0; i < percents.size(); i++) {
+    if (isnan(speedups[i])) {
+      continue;
+    }
+    double x = percents[i] / 100.0;
+    sxy += x * speedups[i];
+    sxx += x * x;
+  }
+  return sxx > 0 ? sxy / sxx : NAN;
+}
+
+// Resampled sums of a group's durations and points.
+static void Resample(const Group &group, Random *random, double *duration,
+    double *hits) {
+  size_t n = group.samples.size();
+  if (n <= kExactResampleLimit) {
+    *duration = 0;
+    *hits = 0;
+    for (size_t i = 0; i < n; i++) {
+      const Sample &sample = group.samples[random->Below(n)];
+      *duration += sample.duration;
+      *hits += sample.hits;
+    }
+    return;
+  }
+  double var_d = std::max(0.0, group.sum_dd / n - pow(group.sum_d / n, 2));
+  double var_h = std::max(0.0, group.sum_hh / n - pow(group.sum_h / n, 2));
+  double cov = group.sum_dh / n - (group.sum_d / n) * (group.sum_h / n);
+  double sd_d = sqrt(var_d);
+  double z1 = random->Normal();
+  double z2 = random->Normal();
+  double root_n = sqrt((double) n);
+  *duration = group.sum_d + root_n * sd_d * z1;
+  if (sd_d > 0) {
+    double rest = std::max(0.0, var_h - cov * cov / var_d);
+    *hits = group.sum_h + root_n * (cov / sd_d * z1 + sqrt(rest) * z2);
+  } else {
+    *hits = group.sum_h + root_n * sqrt(var_h) * z2;
+  }
+  *hits = std::max(0.0, *hits);
+}
+
+// Reorders values.
+static double Quantile(std::vector<double> *values, double q) {
+  if (values->empty()) {
+    return NAN;
+  }
+  size_t k = std::min(values->size() - 1, (size_t) (q * values->size()));
+  std::nth_element(values->begin(), values->begin() + k, values->end());
+  return (*values)[k];
+}
+
+// FNV-1a, so a line gets the same seed in every run.  The two sides of
+// a diff pass different salts so that their replicates are independent.
+static uint64_t LineSeed(const Line &line, uint64_t salt) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < line.class_sig.size(); i++) {
+    hash = (hash ^ (unsigned char) line.class_sig[i]) * 1099511628211ULL;
+  }
+  hash = (hash ^ (uint64_t) line.lineno) * 1099511628211ULL;
+  return hash ^ ((options.seed + salt) * 0x9e3779b97f4a7c15ULL);
+}
+
+static void AnalyzeLine(Line *line, uint64_t salt) {
+  auto baseline = line->groups.find(0);
+  if (baseline == line->groups.end()
+      || baseline->second.sum_h <= options.min_baseline) {
+    return;
+  }
+  double base_period = Period(baseline->second.sum_d, baseline->second.sum_h);
+
+  std::vector<int> percents;
+  std::vector<const Group *> groups;
+  std::vector<double> estimates;
+  for (auto &group : line->groups) {
+    if (group.first == 0) {
+      continue;
+    }
+    double period = Period(group.second.sum_d, group.second.sum_h);
+    percents.push_back(group.first);
+    groups.push_back(&group.second);
+    estimates.push_back(period < 0 ? NAN : ProgramSpeedup(period, base_period));
+  }
+  if (percents.empty()) {
+    return;
+  }
+
+  Random random(LineSeed(*line, salt));
+  std::vector<std::vector<double> > replicates(percents.size());
+  std::vector<double> impacts;
+  std::vector<double> speedups(percents.size());
+  for (int r = 0; r < options.replicates; r++) {
+    double duration, hits;
+    Resample(baseline->second, &random, &duration, &hits);
+    double base = Period(duration, hits);
+    if (base <= 0) {
+      continue;
+    }
+    for (size_t i = 0; i < groups.size(); i++) {
+      Resample(*groups[i], &random, &duration, &hits);
+      double period = Period(duration, hits);
+      speedups[i] = period < 0 ? NAN : ProgramSpeedup(period, base);
+      if (!isnan(speedups[i])) {
+        replicates[i].push_back(speedups[i]);
+      }
+    }
+    double slope = Slope(percents, speedups);
+    if (!isnan(slope)) {
+      impacts.push_back(slope);
+    }
+  }
+
+  double alpha = (1 - options.confidence) / 2;
+  for (size_t i = 0; i < percents.size(); i++) {
+    CurvePoint point;
+    point.percent = percents[i];
+    point.experiments = groups[i]->samples.size();
+    point.program_speedup = estimates[i];
+    point.low = Quantile(&replicates[i], alpha);
+    point.high = Quantile(&replicates[i], 1 - alpha);
+    line->curve.push_back(point);
+  }
+  line->impact = Slope(percents, estimates);
+  line->impacts = impacts;
+  line->impact_low = Quantile(&impacts, alpha);
+  line->impact_high = Quantile(&impacts, 1 - alpha);
+  line->analyzed = !isnan(line->impact);
+}
+
+static bool ReadFile(const char *path, std::string *contents) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  std::vector<char> buf(1 << 20);
+  size_t n;
+  while ((n = fread(&buf[0], 1, buf.size(), file)) > 0) {
+    contents->append(&buf[0], n);
+  }
+  bool ok = ferror(file) == 0;
+  fclose(file);
+  return ok;
+}
+
+// The value of "\t<key>=" in [begin, end), or NULL.
+static const char *Field(const char *begin, const char *end, const char *key) {
+  size_t key_length = strlen(key);
+  for (const char *p = begin; p < end; p++) {
+    if (*p == '\t' && (size_t) (end - p) > key_length + 1
+        && strncmp(p + 1, key, key_length) == 0 && p[key_length + 1] == '=') {
+      return p + key_length + 2;
+    }
+  }
+  return NULL;
+}
+
+// Adds every experiment in a profile to lines.  Returns the number of
+// experiments read.
+static size_t ParseProfile(const std::string &contents,
+    std::unordered_map<std::string, Line> *lines, size_t *dropped_gc) {
+  size_t experiments = 0;
+  const char *p = contents.c_str();
+  const char *end = p + contents.size();
+  const char *experiment = NULL;
+  const char *experiment_end = NULL;
+  while (p < end) {
+    const char *eol = (const char *) memchr(p, '\n', end - p);
+    if (eol == NULL) {
+      eol = end;
+    }
+    if (strncmp(p, "experiment\t", 11) == 0) {
+      experiment = p;
+      experiment_end = eol;
+    } else if (strncmp(p, "progress-point\t", 15) == 0 && experiment != NULL) {
+      const char *selected = Field(experiment, experiment_end, "selected");
+      const char *speedup = Field(experiment, experiment_end, "speedup");
+      const char *duration = Field(experiment, experiment_end, "duration");
+      const char *gc_pause = Field(experiment, experiment_end, "gc-pause");
+      const char *delta = Field(p, eol, "delta");
+      if (selected != NULL && speedup != NULL && duration != NULL
+          && delta != NULL) {
+        const char *tab = (const char *) memchr(selected, '\t',
+            experiment_end - selected);
+        const char *colon = (const char *) memchr(selected, ':',
+            (tab != NULL ? tab : experiment_end) - selected);
+        if (colon != NULL) {
+          std::string key(selected, (tab != NULL ? tab : experiment_end) - selected);
+          Sample sample;
+          sample.duration = strtod(duration, NULL);
+          sample.hits = strtod(delta, NULL);
+          double gc = gc_pause != NULL ? strtod(gc_pause, NULL) : 0;
+          if (!options.keep_gc && gc > kGcDominatedShare * sample.duration) {
+            (*dropped_gc)++;
+          } else {
+            if (!options.keep_gc) {
+              sample.duration -= gc;
+            }
+            Line &line = (*lines)[key];
+            if (line.class_sig.empty()) {
+              line.class_sig.assign(selected, colon - selected);
+              line.lineno = atoi(colon + 1);
+            }
+            line.groups[(int) lround(strtod(speedup, NULL) * 100)].Add(sample);
+            line.experiments++;
+            experiments++;
+          }
+        }
+      }
+      experiment = NULL;
+    }
+    p = eol + 1;
+  }
+  return experiments;
+}
+
+static std::string Json(const std::string &s) {
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '"' || s[i] == '\\') {
+      out += '\\';
+    }
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+// NaN is not JSON.
+static void PrintNumber(double value) {
+  if (isnan(value)) {
+    printf("null");
+  } else {
+    printf("%.6g", value);
+  }
+}
+
+static void PrintJson(const std::vector<Line *> &ranked, size_t experiments,
+    size_t skipped, size_t dropped_gc) {
+  printf("{\"experiments\":%zu,\"gc_dominated_dropped\":%zu,"
+      "\"lines_skipped\":%zu,\"confidence\":%g,\"lines\":[",
+      experiments, dropped_gc, skipped, options.confidence);
+  for (size_t i = 0; i < ranked.size(); i++) {
+    const Line *line = ranked[i];
+    printf("%s\n{\"class\":%s,\"line\":%d,\"experiments\":%zu,\"impact\":",
+        i == 0 ? "" : ",", Json(line->class_sig).c_str(), line->lineno,
+        line->experiments);
+    PrintNumber(line->impact);
+    printf(",\"impact_low\":");
+    PrintNumber(line->impact_low);
+    printf(",\"impact_high\":");
+    PrintNumber(line->impact_high);
+    printf(",\"curve\":[");
+    for (size_t j = 0; j < line->curve.size(); j++) {
+      const CurvePoint &point = line->curve[j];
+      printf("%s{\"speedup\":%g,\"experiments\":%zu,\"program_speedup\":",
+          j == 0 ? "" : ",", point.percent / 100.0, point.experiments);
+      PrintNumber(point.program_speedup);
+      printf(",\"low\":");
+      PrintNumber(point.low);
+      printf(",\"high\":");
+      PrintNumber(point.high);
+      printf("}");
+    }
+    printf("]}");
+  }
+  printf("\n]}\n");
+}
+
+static void PrintCsv(const std::vector<Line *> &ranked) {
+  printf("class,line,impact,impact_low,impact_high,speedup,experiments,"
+      "program_speedup,low,high\n");
+  for (size_t i = 0; i < ranked.size(); i++) {
+    const Line *line = ranked[i];
+    for (size_t j = 0; j < line->curve.size(); j++) {
+      const CurvePoint &point = line->curve[j];
+      printf("%s,%d,%.6g,%.6g,%.6g,%g,%zu,%.6g,%.6g,%.6g\n",
+          line->class_sig.c_str(), line->lineno, line->impact,
+          line->impact_low, line->impact_high, point.percent / 100.0,
+          point.experiments, point.program_speedup, point.low, point.high);
+    }
+  }
+}
+
+// One line in both profiles of a diff.
+struct LineDiff {
+  const Line *old_line;
+  const Line *new_line;
+  double delta;
+  double low;
+  double high;
+  bool changed;
+};
+
+static std::vector<LineDiff> Diff(const Profile &old_profile,
+    const Profile &new_profile) {
+  std::vector<LineDiff> diffs;
+  double alpha = (1 - options.confidence) / 2;
+  for (size_t i = 0; i < new_profile.ranked.size(); i++) {
+    const Line *new_line = new_profile.ranked[i];
+    auto found = old_profile.lines.find(
+        new_line->class_sig + ":" + std::to_string(new_line->lineno));
+    if (found == old_profile.lines.end() || !found->second.analyzed) {
+      continue;
+    }
+    const Line *old_line = &found->second;
+    // The profiles are independent, so any pairing of their replicates
+    // is a draw of the difference.
+    std::vector<double> deltas;
+    size_t n = std::min(old_line->impacts.size(), new_line->impacts.size());
+    for (size_t r = 0; r < n; r++) {
+      deltas.push_back(new_line->impacts[r] - old_line->impacts[r]);
+    }
+    LineDiff diff;
+    diff.old_line = old_line;
+    diff.new_line = new_line;
+    diff.delta = new_line->impact - old_line->impact;
+    diff.low = Quantile(&deltas, alpha);
+    diff.high = Quantile(&deltas, 1 - alpha);
+    diff.changed = (diff.low > 0 || diff.high < 0)
+      && fabs(diff.delta) >= options.min_change;
+    diffs.push_back(diff);
+  }
+  std::stable_sort(diffs.begin(), diffs.end(),
+      [](const LineDiff &a, const LineDiff &b) {
+    return fabs(a.delta) > fabs(b.delta);
+  });
+  return diffs;
+}
+
+static void PrintImpactJson(const char *name, const Line *line) {
+  printf(",\"%s\":{\"experiments\":%zu,\"impact\":", name, line->experiments);
+  PrintNumber(line->impact);
+  printf(",\"impact_low\":");
+  PrintNumber(line->impact_low);
+  printf(",\"impact_high\":");
+  PrintNumber(line->impact_high);
+  printf("}");
+}
+
+static void PrintDiffJson(const std::vector<LineDiff> &diffs, size_t changed,
+    size_t only_old, size_t only_new) {
+  printf("{\"confidence\":%g,\"min_change\":%g,\"changed\":%zu,"
+      "\"only_old\":%zu,\"only_new\":%zu,\"lines\":[", options.confidence,
+      options.min_change, changed, only_old, only_new);
+  for (size_t i = 0; i < diffs.size(); i++) {
+    const LineDiff &diff = diffs[i];
+    printf("%s\n{\"class\":%s,\"line\":%d,\"changed\":%s,\"delta\":",
+        i == 0 ? "" : ",", Json(diff.new_line->class_sig).c_str(),
+        diff.new_line->lineno, diff.changed ? "true" : "false");
+    PrintNumber(diff.delta);
+    printf(",\"delta_low\":");
+    PrintNumber(diff.low);
+    printf(",\"delta_high\":");
+    PrintNumber(diff.high);
+    PrintImpactJson("old", diff.old_line);
+    PrintImpactJson("new", diff.new_line);
+    printf("}");
+  }
+  printf("\n]}\n");
+}
+
+static void PrintDiffCsv(const std::vector<LineDiff> &diffs) {
+  printf("class,line,changed,delta,delta_low,delta_high,old_impact,old_low,"
+      "old_high,new_impact,new_low,new_high\n");
+  for (size_t i = 0; i < diffs.size(); i++) {
+    const LineDiff &diff = diffs[i];
+    printf("%s,%d,%d,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n",
+        diff.new_line->class_sig.c_str(), diff.new_line->lineno,
+        diff.changed ? 1 : 0, diff.delta, diff.low, diff.high,
+        diff.old_line->impact, diff.old_line->impact_low,
+        diff.old_line->impact_high, diff.new_line->impact,
+        diff.new_line->impact_low, diff.new_line->impact_high);
+  }
+}
+
+// Reads and analyzes every profile in paths as one.
+static bool LoadProfile(const std::vector<const char *> &paths,
+    uint64_t salt, Profile *profile) {
+  for (size_t i = 0; i < paths.size(); i++) {
+    std::string contents;
+    if (!ReadFile(paths[i], &contents)) {
+      fprintf(stderr, "jcoz-analyze: cannot read %s: %s\n", paths[i],
+          strerror(errno));
+      return false;
+    }
+    profile->experiments += ParseProfile(contents, &profile->lines,
+        &profile->dropped_gc);
+  }
+
+  for (auto &line : profile->lines) {
+    profile->all.push_back(&line.second);
+  }
+  std::sort(profile->all.begin(), profile->all.end(),
+      [](const Line *a, const Line *b) {
+    return a->class_sig != b->class_sig ? a->class_sig < b->class_sig
+      : a->lineno < b->lineno;
+  });
+
+  std::vector<Line *> &all = profile->all;
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < options.threads; t++) {
+    workers.push_back(std::thread([&all, &next, salt]() {
+      size_t i;
+      while ((i = next.fetch_add(1)) < all.size()) {
+        AnalyzeLine(all[i], salt);
+      }
+    }));
+  }
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+
+  for (size_t i = 0; i < all.size(); i++) {
+    if (all[i]->analyzed) {
+      profile->ranked.push_back(all[i]);
+    }
+  }
+  std::stable_sort(profile->ranked.begin(), profile->ranked.end(),
+      [](const Line *a, const Line *b) {
+    return a->impact > b->impact;
+  });
+  return true;
+}
+
+static void PrintUsage(const char *name) {
+  fprintf(stderr, "usage: %s [--format=json|csv] [--bootstrap=<replicates>]"
+      " [--confidence=<0..1>] [--threads=<n>] [--seed=<n>]"
+      " [--min-baseline=<points>] [--keep-gc] <profile.coz>...\n"
+      "       %s --diff [--min-change=<impact>] [--fail-on-change]"
+      " [options as above] <old.coz> <new.coz>\n", name, name);
+}
+
+int main(int argc, char **argv) {
+  std::vector<const char *> paths;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--format=json") == 0) {
+      options.csv = false;
+    } else if (strcmp(argv[i], "--format=csv") == 0) {
+      options.csv = true;
+    } else if (strncmp(argv[i], "--bootstrap=", 12) == 0) {
+      options.replicates = atoi(argv[i] + 12);
+    } else if (strncmp(argv[i], "--confidence=", 13) == 0) {
+      options.confidence = atof(argv[i] + 13);
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      options.threads = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      options.seed = strtoull(argv[i] + 7, NULL, 10);
+    } else if (strncmp(argv[i], "--min-baseline=", 15) == 0) {
+      options.min_baseline = atof(argv[i] + 15);
+    } else if (strcmp(argv[i], "--keep-gc") == 0) {
+      options.keep_gc = true;
+    } else if (strcmp(argv[i], "--diff") == 0) {
+      options.diff = true;
+    } else if (strncmp(argv[i], "--min-change=", 13) == 0) {
+      options.min_change = atof(argv[i] + 13);
+    } else if (strcmp(argv[i], "--fail-on-change") == 0) {
+      options.fail_on_change = true;
+    } else if (argv[i][0] == '-') {
+      PrintUsage(argv[0]);
+      return 1;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty() || (options.diff && paths.size() != 2)
+      || options.replicates < 1 || options.confidence <= 0
+      || options.confidence >= 1) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+  if (options.threads <= 0) {
+    options.threads = std::max(1, (int) std::thread::hardware_concurrency());
+  }
+
+  if (options.diff) {
+    Profile old_profile;
+    Profile new_profile;
+    if (!LoadProfile(std::vector<const char *>(1, paths[0]), 0, &old_profile)
+        || !LoadProfile(std::vector<const char *>(1, paths[1]), 1,
+          &new_profile)) {
+      return 1;
+    }
+    std::vector<LineDiff> diffs = Diff(old_profile, new_profile);
+    size_t changed = 0;
+    for (size_t i = 0; i < diffs.size(); i++) {
+      changed += diffs[i].changed;
+    }
+    if (options.csv) {
+      PrintDiffCsv(diffs);
+    } else {
+      // Lines analyzed in one profile only, such as new code.
+      PrintDiffJson(diffs, changed, old_profile.ranked.size() - diffs.size(),
+          new_profile.ranked.size() - diffs.size());
+    }
+    return options.fail_on_change && changed > 0 ? 3 : 0;
+  }
+
+  Profile profile;
+  if (!LoadProfile(paths, 0, &profile)) {
+    return 1;
+  }
+  if (options.csv) {
+    PrintCsv(profile.ranked);
+  } else {
+    PrintJson(profile.ranked, profile.experiments,
+        profile.all.size() - profile.ranked.size(), profile.dropped_gc);
+  }
+  return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Prints the experiments an agent publishes to its result ring
+// (ring=<path>), as coz records, so that
+//   jcoz-tail --follow app.ring >> app.coz
+// builds up a profile without JMX and without the agent waiting on the
+// reader.  The ring is mapped read-only and records are read in place;
+// see ringformat.h for the layout and how torn reads are detected.
+//
+// By default every record still in the ring is printed and jcoz-tail
+// exits.  --new skips those.  --follow keeps printing records as they
+// are published; if the agent restarts and replaces the ring, it
+// follows the new one from its start.  Records the reader fell too far
+// behind to see are reported on stderr.
+//
+// Usage: jcoz-tail [--follow] [--new] [--poll-ms=<ms>] <ring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "ringformat.h"
+
+struct Options {
+  bool follow = false;
+  bool skip_existing = false;
+  long poll_ms = 200;
+};
+
+static Options options;
+
+struct Ring {
+  const struct RingHeader *header = NULL;
+  const struct RingRecord *records = NULL;
+  size_t length = 0;
+  ino_t inode = 0;
+};
+
+static void Unmap(Ring *ring) {
+  if (ring->header != NULL) {
+    munmap((void *) ring->header, ring->length);
+  }
+  *ring = Ring();
+}
+
+// Maps the ring at path.  Returns false, quietly if quiet is set, if
+// there is no complete ring there yet.
+static bool Map(const char *path, bool quiet, Ring *ring) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    if (!quiet) {
+      fprintf(stderr, "jcoz-tail: cannot open %s: %s\n", path, strerror(errno));
+    }
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(RingHeader)) {
+    close(fd);
+    if (!quiet) {
+      fprintf(stderr, "jcoz-tail: %s is not a result ring\n", path);
+    }
+    return false;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    if (!quiet) {
+      fprintf(stderr, "jcoz-tail: cannot map %s: %s\n", path, strerror(errno));
+    }
+    return false;
+  }
+
+  const struct RingHeader *header = static_cast<const struct RingHeader *>(map);
+  bool valid = header->magic == kRingMagic;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  valid = valid && header->version == kRingVersion
+    && header->record_size == sizeof(RingRecord)
+    && header->capacity > 0
+    && sizeof(RingHeader) + header->capacity * sizeof(RingRecord)
+      <= (size_t) st.st_size;
+  if (!valid) {
+    munmap(map, st.st_size);
+    if (!quiet) {
+      fprintf(stderr, "jcoz-tail: %s is not a version %u result ring\n", path,
+          kRingVersion);
+    }
+    return false;
+  }
+  ring->header = header;
+  ring->records = reinterpret_cast<const struct RingRecord *>(header + 1);
+  ring->length = st.st_size;
+  ring->inode = st.st_ino;
+  return true;
+}
+
+// True if path now names a different file than the one mapped.
+static bool Replaced(const char *path, const Ring &ring) {
+  struct stat st;
+  return stat(path, &st) == 0 && st.st_ino != ring.inode;
+}
+
+// Copies record n into *out.  Returns false if the writer has already
+// reused its slot.
+static bool ReadRecord(const Ring &ring, uint64_t n, struct RingRecord *out) {
+  const struct RingRecord *record =
+    &ring.records[n & (ring.header->capacity - 1)];
+  uint64_t seq = record->seq.load(std::memory_order_acquire);
+  if (seq != n + 1) {
+    return false;
+  }
+  out->end_ns = record->end_ns;
+  out->duration_ns = record->duration_ns;
+  out->points_hit = record->points_hit;
+  out->sample_period_ns = record->sample_period_ns;
+  out->gc_pause_ns = record->gc_pause_ns;
+  out->speedup = record->speedup;
+  out->lineno = record->lineno;
+  out->flags = record->flags;
+  memcpy(out->class_sig, record->class_sig, kRingClassSigLength);
+  out->class_sig[kRingClassSigLength - 1] = '\0';
+  memcpy(out->progress_point, record->progress_point, kRingPointLength);
+  out->progress_point[kRingPointLength - 1] = '\0';
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return record->seq.load(std::memory_order_relaxed) == seq;
+}
+
+// The record Profiler::appendToProfile writes.
+static void PrintRecord(const struct RingRecord &record) {
+  printf("experiment\tselected=%s:%d\tspeedup=%g\tduration=%lld\tperiod=%lld"
+      "\tgc-pause=%lld\n"
+      "progress-point\tname=%s\ttype=source\tdelta=%lld\n",
+      record.class_sig, record.lineno, record.speedup,
+      (long long) record.duration_ns, (long long) record.sample_period_ns,
+      (long long) record.gc_pause_ns, record.progress_point,
+      (long long) record.points_hit);
+}
+
+// Prints records from *next up to what has been published, and moves
+// *next past them.
+static void Drain(const Ring &ring, uint64_t *next) {
+  uint64_t published = ring.header->published.load(std::memory_order_acquire);
+  uint64_t capacity = ring.header->capacity;
+  uint64_t lost = 0;
+  struct RingRecord record;
+  while (*next < published) {
+    if (published - *next > capacity) {
+      lost += published - capacity - *next;
+      *next = published - capacity;
+    }
+    if (ReadRecord(ring, *next, &record)) {
+      PrintRecord(record);
+      ++*next;
+      continue;
+    }
+    // Overwritten while we read it; skip ahead to what is left.
+    published = ring.header->published.load(std::memory_order_acquire);
+    if (published - *next <= capacity) {
+      // Published but not yet readable cannot happen with one writer
+      // that stores seq before published, so this record is gone.
+      lost++;
+      ++*next;
+    }
+  }
+  if (lost > 0) {
+    fprintf(stderr, "jcoz-tail: fell behind and lost %llu experiments\n",
+        (unsigned long long) lost);
+  }
+  fflush(stdout);
+}
+
+static void PrintUsage(const char *name) {
+  fprintf(stderr, "usage: %s [--follow] [--new] [--poll-ms=<ms>] <ring>\n",
+      name);
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--follow") == 0 || strcmp(argv[i], "-f") == 0) {
+      options.follow = true;
+    } else if (strcmp(argv[i], "--new") == 0) {
+      options.skip_existing = true;
+    } else if (strncmp(argv[i], "--poll-ms=", 10) == 0) {
+      options.poll_ms = atol(argv[i] + 10);
+    } else if (argv[i][0] == '-' || path != NULL) {
+      PrintUsage(argv[0]);
+      return 1;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (path == NULL || options.poll_ms <= 0) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  Ring ring;
+  // When following, wait for the agent to create the ring.
+  while (!Map(path, options.follow, &ring)) {
+    if (!options.follow) {
+      return 1;
+    }
+    usleep(options.poll_ms * 1000);
+  }
+  uint64_t next = options.skip_existing
+    ? ring.header->published.load(std::memory_order_acquire) : 0;
+  Drain(ring, &next);
+
+  while (options.follow) {
+    usleep(options.poll_ms * 1000);
+    Drain(ring, &next);
+    if (Replaced(path, ring)) {
+      Ring replacement;
+      if (Map(path, true, &replacement)) {
+        // Whatever the old agent published last, then the new ring from
+        // its start.
+        Drain(ring, &next);
+        Unmap(&ring);
+        ring = replacement;
+        next = 0;
+        fprintf(stderr, "jcoz-tail: following a new ring from pid %u\n",
+            ring.header->pid);
+      }
+    }
+  }
+  Unmap(&ring);
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "userthreads.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "options.h"
+
+struct UserThread UserThreadSlab::slots_[kMaxUserThreads];
+std::atomic<uint64_t> UserThreadSlab::free_head_(0xffffffffULL);
+std::atomic<int> UserThreadSlab::high_water_(0);
+int UserThreadSlab::signal_cursor_ = 0;
+
+static inline int HeadIndex(uint64_t head) {
+  return (int) (uint32_t) head;
+}
+
+static inline uint64_t MakeHead(uint64_t old_head, int index) {
+  return ((old_head >> 32) + 1) << 32 | (uint32_t) index;
+}
+
+static inline pid_t CurrentTid() {
+  return (pid_t) syscall(SYS_gettid);
+}
+
+struct UserThread *UserThreadSlab::Claim() {
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while (HeadIndex(head) != -1) {
+    int index = HeadIndex(head);
+    int next = slots_[index].next_free;
+    if (free_head_.compare_exchange_weak(head, MakeHead(head, next),
+          std::memory_order_acq_rel, std::memory_order_acquire)) {
+      return &slots_[index];
+    }
+  }
+
+  // Nothing to recycle, so carve a fresh slot off the end.
+  int index = high_water_.load(std::memory_order_relaxed);
+  do {
+    if (index >= kMaxUserThreads) {
+      return NULL;
+    }
+  } while (!high_water_.compare_exchange_weak(index, index + 1,
+        std::memory_order_acq_rel, std::memory_order_relaxed));
+  return &slots_[index];
+}
+
+void UserThreadSlab::PushFree(struct UserThread *ut) {
+  int index = (int) (ut - slots_);
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  do {
+    ut->next_free = HeadIndex(head);
+  } while (!free_head_.compare_exchange_weak(head, MakeHead(head, index),
+        std::memory_order_acq_rel, std::memory_order_acquire));
+}
+
+void UserThreadSlab::Reset(struct UserThread *ut) {
+  ut->local_delay = 0;
+  ut->points_hit = 0;
+  ut->num_signals_received = 0;
+  ut->samples_taken = 0;
+  ut->adopt_signals = 0;
+  ut->java_thread = NULL;
+  ut->carrier = false;
+  ut->vthread = NULL;
+  if (ut->frames == NULL) {
+    ut->frames = static_cast<JVMPI_CallFrame *>(
+        malloc(sizeof(JVMPI_CallFrame) * AgentOptions::stack_depth));
+  }
+  if (ut->timeline == NULL) {
+    ut->timeline = Timeline::NewThreadBuffer();
+  }
+}
+
+struct UserThread *UserThreadSlab::Acquire() {
+  struct UserThread *ut = Claim();
+  if (ut == NULL) {
+    return NULL;
+  }
+  Reset(ut);
+  ut->thread = pthread_self();
+  ut->tid = CurrentTid();
+  ut->state.store(kSlotActive, std::memory_order_release);
+  return ut;
+}
+
+void UserThreadSlab::Release(struct UserThread *ut) {
+  int expected = kSlotActive;
+  while (!ut->state.compare_exchange_weak(expected, kSlotFree,
+        std::memory_order_acq_rel, std::memory_order_acquire)) {
+    // The agent thread is in the middle of signaling us.  That only
+    // lasts for one pthread_kill.
+    expected = kSlotActive;
+  }
+
+  ProfilerStats::Retire(&ut->stats);
+  PushFree(ut);
+}
+
+bool UserThreadSlab::Adopt(pid_t tid) {
+  int high_water = HighWater();
+  for (int i = 0; i < high_water; i++) {
+    if (slots_[i].state.load(std::memory_order_acquire) != kSlotFree &&
+        slots_[i].tid == tid) {
+      return false;
+    }
+  }
+
+  struct UserThread *ut = Claim();
+  if (ut == NULL) {
+    return false;
+  }
+  Reset(ut);
+  ut->tid = tid;
+  ut->state.store(kSlotAdopted, std::memory_order_release);
+  return true;
+}
+
+struct UserThread *UserThreadSlab::Bind() {
+  pid_t tid = CurrentTid();
+  int high_water = HighWater();
+  for (int i = 0; i < high_water; i++) {
+    struct UserThread *ut = &slots_[i];
+    if (ut->tid != tid) {
+      continue;
+    }
+    int state;
+    // We are usually running because SignalAll just signaled this slot,
+    // so wait for it to put the slot back.
+    while ((state = ut->state.load(std::memory_order_acquire)) == kSlotSignaling)
+      ;
+    if (state != kSlotAdopted) {
+      continue;
+    }
+    int expected = kSlotAdopted;
+    if (ut->state.compare_exchange_strong(expected, kSlotActive,
+          std::memory_order_acq_rel, std::memory_order_acquire)) {
+      ut->thread = pthread_self();
+      return ut;
+    }
+  }
+  return NULL;
+}
+
+int UserThreadSlab::Active() {
+  int active = 0;
+  int high_water = HighWater();
+  for (int i = 0; i < high_water; i++) {
+    int state = slots_[i].state.load(std::memory_order_acquire);
+    if (state == kSlotActive || state == kSlotSignaling) {
+      active++;
+    }
+  }
+  return active;
+}
+
+void UserThreadSlab::SignalAll(int signum, int max_threads) {
+  pid_t pid = getpid();
+  int high_water = HighWater();
+  if (signal_cursor_ >= high_water) {
+    signal_cursor_ = 0;
+  }
+  int signaled = 0;
+  int i = signal_cursor_;
+  for (int visited = 0; visited < high_water && signaled < max_threads; visited++) {
+    struct UserThread *ut = &slots_[i];
+    i = i + 1 < high_water ? i + 1 : 0;
+    int expected = kSlotActive;
+    if (ut->state.compare_exchange_strong(expected, kSlotSignaling,
+          std::memory_order_acquire, std::memory_order_relaxed)) {
+      pthread_kill(ut->thread, signum);
+      ut->state.store(kSlotActive, std::memory_order_release);
+      signaled++;
+    } else if (expected == kSlotAdopted &&
+        ut->state.compare_exchange_strong(expected, kSlotSignaling,
+          std::memory_order_acquire, std::memory_order_relaxed)) {
+      // There is no pthread_t for a thread we did not see start, only
+      // its kernel id, which goes stale once the thread exits.
+      bool alive = syscall(SYS_tgkill, pid, ut->tid, signum) == 0;
+      if (alive && ++ut->adopt_signals < kMaxAdoptSignals) {
+        ut->state.store(kSlotAdopted, std::memory_order_release);
+      } else {
+        ut->state.store(kSlotFree, std::memory_order_release);
+        PushFree(ut);
+      }
+      signaled++;
+    }
+  }
+  signal_cursor_ = i;
+}
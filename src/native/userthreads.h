@@ -0,0 +1,162 @@
+/*
+ * This file is part of JCoz.
+ *
+ * JCoz is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * JCoz is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with JCoz.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <jvmti.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <atomic>
+
+#include "globals.h"
+#include "stats.h"
+#include "timeline.h"
+
+#ifndef USERTHREADS_H
+#define USERTHREADS_H
+
+// A virtual thread's part of the delay accounting.  Signals go to the
+// carrier pthread it is mounted on, so while it is mounted its debt is
+// the carrier slot's; when it unmounts the debt is kept here until its
+// next mount, on whichever carrier that is.  Kept in the virtual
+// thread's JVMTI thread-local storage.
+struct VirtualThread {
+  // Numbered from 1 in the order the agent first saw them.
+  long id;
+  // Delays it owed, global_delay - local_delay, when it last unmounted.
+  long debt;
+  // The experiment the debt was run up in; debt is only owed within one.
+  unsigned long experiment;
+};
+
+struct UserThread {
+  pthread_t thread;
+  pid_t tid;
+  long local_delay = 0;
+  long points_hit = 0;
+  unsigned int num_signals_received = 0;
+  unsigned int samples_taken = 0;
+  jthread java_thread;
+  struct ThreadStats stats;
+
+  // AgentOptions::stack_depth frames for the signal handler to fill.
+  // Allocated the first time the slot is used and kept across reuse,
+  // so NULL only if that allocation failed.
+  JVMPI_CallFrame *frames = NULL;
+
+  // This slot's timeline events, kept across reuse like frames.  NULL
+  // while the timeline is off.
+  TimelineBuffer *timeline = NULL;
+
+  // Set once a virtual thread has mounted on this thread, which makes it
+  // a carrier.  vthread is the one mounted now, NULL between them.
+  bool carrier = false;
+  struct VirtualThread *volatile vthread = NULL;
+
+  // Slab bookkeeping, owned by UserThreadSlab.
+  std::atomic<int> state;
+  int next_free;
+  int adopt_signals;
+};
+
+// A fixed pool of UserThread slots.  Threads claim a slot when they
+// start and hand it back when they end, so thread churn neither
+// allocates nor takes a lock that the agent thread also holds.
+//
+// A slot is FREE, ACTIVE (owned by a live thread) or SIGNALING (the
+// agent thread is delivering SIGPROF to its owner).  The agent thread
+// only ever moves ACTIVE -> SIGNALING -> ACTIVE, and a thread releasing
+// its slot waits for SIGNALING to clear, so we never pthread_kill a
+// thread that has already gone away.
+//
+// When the agent is attached to a running JVM, the threads that already
+// exist never see ThreadStart.  Adopt gives each of them that ThreadStart
+// would have profiled an ADOPTED slot keyed by kernel thread id, and the thread binds it (ADOPTED -> ACTIVE)
+// from its signal handler the first time it is signaled.  Adopted slots
+// whose thread has exited, or never binds, are reclaimed by SignalAll.
+class UserThreadSlab {
+  public:
+    static const int kSlotFree = 0;
+    static const int kSlotActive = 1;
+    static const int kSlotSignaling = 2;
+    static const int kSlotAdopted = 3;
+
+    // An adopted slot that has been signaled this many times without
+    // being bound is given up on.
+    static const int kMaxAdoptSignals = 64;
+
+    // Returns a zeroed, ACTIVE slot for the calling thread, or NULL if
+    // all kMaxUserThreads slots are in use.
+    static struct UserThread *Acquire();
+
+    // Returns the slot to the pool, folding its stats into the totals
+    // for exited threads.  Must be called by the owning thread.
+    static void Release(struct UserThread *ut);
+
+    // Claims an ADOPTED slot for the thread with kernel id tid.  Returns
+    // false if tid already has a slot or all slots are in use.  Not
+    // async-signal-safe.
+    static bool Adopt(pid_t tid);
+
+    // Turns the calling thread's ADOPTED slot ACTIVE and returns it, or
+    // returns NULL if it has none.  Async-signal-safe.
+    static struct UserThread *Bind();
+
+    // Sends signum to the owner of every ACTIVE or ADOPTED slot, or to
+    // the next max_threads of them, carrying on from where the last call
+    // stopped so every thread gets its turn.
+    static void SignalAll(int signum, int max_threads = kMaxUserThreads);
+
+    // Number of threads that own a slot: ACTIVE, or being signaled.
+    // Adopted threads count once they have bound.
+    static int Active();
+
+    // Number of slots ever handed out; an upper bound on the number of
+    // slots that may be ACTIVE.
+    static int HighWater() {
+      return high_water_.load(std::memory_order_acquire);
+    }
+
+    static struct UserThread *Slot(int i) { return &slots_[i]; }
+
+  private:
+    // Pops a slot off the free list, or carves a fresh one off the end.
+    static struct UserThread *Claim();
+
+    // Pushes a slot that no thread owns onto the free list.
+    static void PushFree(struct UserThread *ut);
+
+    // Readies a claimed slot for a new owner.
+    static void Reset(struct UserThread *ut);
+
+    static struct UserThread slots_[kMaxUserThreads];
+
+    // Treiber stack of free slot indices.  The low 32 bits hold the
+    // index of the top slot (-1 if empty), the high 32 bits an ABA tag.
+    static std::atomic<uint64_t> free_head_;
+
+    static std::atomic<int> high_water_;
+
+    // Slot SignalAll starts from.  Only the agent thread signals.
+    static int signal_cursor_;
+
+    DISALLOW_IMPLICIT_CONSTRUCTORS(UserThreadSlab);
+};
+
+#endif  // USERTHREADS_H